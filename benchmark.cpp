@@ -0,0 +1,86 @@
+#include <midnight/midnight.hpp>
+#include <midnight/Graphics/HeadlessTarget.hpp>
+
+#include <chrono>
+#include <iostream>
+
+#ifndef SOURCE_DIR
+#define SOURCE_DIR "."
+#endif
+
+struct Constants
+{
+	mn::Graphics::Buffer::gpu_addr models;
+};
+
+// Nanoseconds per call of f, averaged over calls
+template<typename F>
+double time_per_call(uint32_t calls, F&& f)
+{
+	const auto start = std::chrono::steady_clock::now();
+	for (uint32_t c = 0; c < calls; c++) f();
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / calls;
+}
+
+// What recording a draw costs on the CPU, without a window or anything presented
+int main()
+{
+	using namespace mn;
+
+	constexpr uint32_t frames = 100;
+	constexpr uint32_t draws = 10'000;
+
+	Graphics::HeadlessTarget target(Math::Vec2u{ 1280U, 720U });
+
+	const auto pipeline = std::make_shared<Graphics::Pipeline>(
+		Graphics::PipelineBuilder::fromLua(SOURCE_DIR, "/main.lua")
+			.setPushConstantObject<Constants>()
+			.build()
+	);
+
+	const auto mesh = std::make_shared<Graphics::Mesh>(Graphics::Mesh::fromFrame([]()
+	{
+		Graphics::Mesh::Frame frame;
+		frame.vertices = {
+			{ { -1.f,  1.f, -5.5f } },
+			{ { -1.f, -1.f, -5.5f } },
+			{ {  1.f, -1.f, -5.5f } },
+			{ {  1.f,  1.f, -5.5f } }
+		};
+
+		frame.indices = { 0, 1, 2, 2, 3, 0 };
+
+		return frame;
+	}()));
+
+	Graphics::TypeBuffer<Math::Mat4<float>> model_mats;
+	model_mats.resize(2);
+	model_mats[0] = Math::perspective<float>(target.aspectRatio(), Math::Angle::degrees(50), { 0.1f, 100.f });
+	model_mats[1] = Math::rotation<float>(Math::Vec3<Math::Angle>( {
+		Math::Angle::radians(0),
+		Math::Angle::radians(0),
+		Math::Angle::radians(0)
+	} ));
+
+	Constants c;
+	c.models = model_mats.getAddress();
+
+	// Only the recording is timed, the first frame warms up the pipeline and the pools
+	double total = 0;
+	for (uint32_t f = 0; f <= frames; f++)
+	{
+		auto rf = target.startFrame();
+		rf.startRender();
+		rf.setPushConstant(*pipeline, c);
+
+		const auto per_draw = time_per_call(draws, [&]() { rf.draw(pipeline, mesh); });
+		if (f) total += per_draw;
+
+		rf.endRender();
+		target.endFrame(rf);
+	}
+	target.finishWork();
+
+	std::cout << "RenderFrame::draw: " << total / frames << " ns/call over " << frames << " frames of " << draws << " draws\n";
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Def.hpp>
+
+#include "../Buffer.hpp"
+
+#include <mutex>
+
+namespace mn::Graphics::Backend
+{
+    // Mapped, bump-allocated buffer memory that lives for a single frame.
+    // Allocations are pointer bumps into one big buffer, nothing is freed individually,
+    // instead the whole arena is reset once the frame's render fence has signaled.
+    // When a frame needs more than the arena holds another block is chained on, and the
+    // next reset merges everything back into a single block big enough for the peak.
+    struct FrameArena
+    {
+        FrameArena(std::size_t capacity);
+        ~FrameArena();
+
+        FrameArena(const FrameArena&) = delete;
+        FrameArena(FrameArena&&) = delete;
+
+        // Thread safe, so parallel recorders of a frame can share the arena
+        BufferSlice allocate(std::size_t size, std::size_t alignment);
+
+        // Must only be called once the GPU is done with every slice handed out
+        void reset();
+
+        std::size_t used() const { return _used; }
+        std::size_t capacity() const;
+
+    private:
+        struct Block
+        {
+            mn::handle_t buffer, allocation;
+            std::byte* mapped;
+            std::uintptr_t address;
+            std::size_t size, head;
+        };
+
+        Block create(std::size_t size) const;
+        void destroy(const Block& block) const;
+
+        std::vector<Block> blocks;
+        std::size_t _used, min_alignment;
+        std::mutex mutex;
+    };
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <Def.hpp>
+
+#include "../Image.hpp"
+
+#include <optional>
+
+namespace mn::Graphics
+{
+    enum class Access;
+}
+
+namespace mn::Graphics::Backend
+{
+    struct Dispatch;
+    struct CommandBuffer;
+
+    // Stages and accesses (VkPipelineStageFlags2, VkAccessFlags2) behind an Access
+    std::pair<uint64_t, uint64_t> access_scope(Access access);
+
+    // Layout (VkImageLayout) an attachment is used in for an Access. Sampling and copies get
+    // their own, everything else happens in the general layout (which ImGui reads them in).
+    u32 access_layout(Access access);
+
+    // What attachments keep about their last use, for buffers, which don't keep it themselves
+    struct BufferUsage
+    {
+        uint64_t write_stages = 0, write_access = 0, read_stages = 0;
+    };
+
+    // The image transitions and buffer barriers of one sync point, recorded as a single
+    // vkCmdPipelineBarrier2.
+    // Every attachment remembers its layout and how it was last used, so its barrier only
+    // waits on the stages that last touched it, only makes its last write visible, keeps its
+    // contents unless told otherwise, and is left out altogether when a read follows a read.
+    struct BarrierBatch
+    {
+        // Batches for a command buffer that goes to the async compute queue, where graphics
+        // stages don't exist. The graphics queue only sees what's done there through a
+        // semaphore, so anything used there is left to wait on all commands next time.
+        BarrierBatch(bool compute_queue = false) : compute_queue(compute_queue) { }
+
+        // The attachment is about to be used in layout (VkImageLayout) at stages with access
+        // (VkPipelineStageFlags2, VkAccessFlags2). With discard its contents aren't kept.
+        void use(const Image::Attachment& attachment, u32 layout, uint64_t stages, uint64_t access, bool discard = false);
+
+        // Same for size bytes of buffer at offset, last used as usage says
+        void use(BufferUsage& usage, mn::handle_t buffer, std::size_t offset, std::size_t size, uint64_t stages, uint64_t access);
+
+        // Record everything added since the last record, nothing when nothing needed a barrier
+        void record(const Dispatch& vk, const CommandBuffer& cmd);
+
+        bool empty() const { return transitions.empty() && buffers.empty(); }
+
+        // Barriers record() has actually recorded so far
+        uint32_t recorded() const { return dependencies; }
+
+    private:
+        struct Transition
+        {
+            mn::handle_t image;
+            u32 format;
+            u32 old_layout, new_layout;
+            uint64_t src_stages, src_access, dst_stages, dst_access;
+        };
+
+        struct BufferRange
+        {
+            mn::handle_t buffer;
+            std::size_t offset, size;
+            uint64_t src_stages, src_access, dst_stages, dst_access;
+        };
+
+        // Moves the last use on to this one, returns the stages and accesses the barrier for it
+        // has to wait on, nothing when it doesn't need one
+        std::optional<std::pair<uint64_t, uint64_t>> advance(uint64_t& write_stages, uint64_t& write_access, uint64_t& read_stages, uint64_t stages, uint64_t access, bool transition) const;
+
+        std::vector<Transition> transitions;
+        std::vector<BufferRange> buffers;
+        uint32_t dependencies = 0;
+        bool compute_queue;
+    };
+}
@@ -3,6 +3,7 @@
 #include <Def.hpp>
 
 #include "../Image.hpp"
+#include "Sync.hpp"
 
 namespace mn::Graphics
 {
@@ -12,40 +13,67 @@ namespace mn::Graphics
 namespace mn::Graphics::Backend
 {
     struct CommandBuffer;
-    struct Fence;
+    enum class QueueType;
 
+    // Command buffers from a pool can't be reset one by one, the whole pool is reset
+    // at once when the GPU is done with everything recorded from it. That's the cheap
+    // path on every driver, and buffers can be handed out linearly in between.
     struct CommandPool
     {
-        CommandPool();
+        // Buffers from the pool can only be submitted to queues of its type's family
+        CommandPool(QueueType type);
         ~CommandPool();
 
         CommandPool(const CommandPool&) = delete;
         CommandPool(CommandPool&&) = default;
 
-        void reset() const;
-        std::unique_ptr<CommandBuffer> allocateBuffer() const;
+        // Puts every buffer allocated from the pool back into the initial state
+        void reset();
+
+        // The next unused buffer of that level, allocated the first time around.
+        // After reset() the same buffers are handed out again in the same order.
+        CommandBuffer& next(bool secondary = false);
+
+        // A buffer that's owned by the caller rather than handed out by next()
+        std::unique_ptr<CommandBuffer> allocateBuffer(bool secondary = false) const;
 
     private:
         Handle<CommandPool> handle;
+
+        // Primary and secondary buffers, and how many of each were handed out since the last reset
+        std::vector<std::unique_ptr<CommandBuffer>> buffers[2];
+        std::size_t used[2] = { 0, 0 };
     };
 
     struct CommandBuffer
     {
         friend struct CommandPool;
+        friend struct Device;
+        friend struct UploadEngine;
 
         CommandBuffer(const CommandBuffer&) = delete;
         CommandBuffer(CommandBuffer&&) = default;
 
+        // Starts a fresh recording, the pool must have been reset since the last one
         void begin(bool one_time = true) const;
+
+        // Begin a secondary command buffer that's executed inside a dynamic rendering instance
+        // with these attachment formats (depth_format 0 for none)
+        void beginSecondary(const std::vector<u32>& color_formats, u32 depth_format) const;
         void end() const;
-        void reset() const;
 
         auto getHandle() const { return handle; }
-        void submit(std::shared_ptr<Fence> fence) const;
+
+        // Submit to the graphics queue, returns the ticket it signals on the device's timeline
+        GpuTimeline::Ticket submit() const;
         void bufferToImage(std::shared_ptr<Buffer> buffer, const Image::Attachment& image) const;
 
     private:    
-        CommandBuffer(Handle<CommandPool> pool);
+        CommandBuffer() = default;
+        CommandBuffer(Handle<CommandPool> pool, bool secondary = false);
+
+        // Wrap a command buffer the device allocated itself
+        static CommandBuffer adopt(Handle<CommandBuffer> buffer);
 
         Handle<CommandBuffer> handle;
     };
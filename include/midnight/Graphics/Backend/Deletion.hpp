@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Def.hpp>
+
+#include "Sync.hpp"
+
+#include <deque>
+#include <mutex>
+#include <functional>
+
+namespace mn::Graphics::Backend
+{
+    // Destruction of anything the GPU may still be using. Objects hand their release over
+    // instead of destroying their Vulkan handles directly. Everything pushed while a frame
+    // is being recorded is sealed with that frame's ticket once it's submitted (frames
+    // submit in order, so that covers every frame it could have been used in) and run
+    // once the timeline passes it. Recording a draw doesn't have to keep anything alive.
+    struct DeletionQueue
+    {
+        DeletionQueue(const GpuTimeline& timeline);
+        ~DeletionQueue();
+
+        DeletionQueue(const DeletionQueue&) = delete;
+        DeletionQueue(DeletionQueue&&) = delete;
+
+        // release mustn't go through the Instance, it may run while the Instance is being destroyed
+        void push(std::function<void()> release);
+
+        // Everything pushed so far may be used by the submission behind ticket
+        void seal(GpuTimeline::Ticket ticket);
+
+        // Run whatever the GPU is done with
+        void collect();
+
+        // Run everything, the device has to be idle
+        void flush();
+
+    private:
+        struct Entry
+        {
+            GpuTimeline::Ticket ticket;
+            std::vector<std::function<void()>> releases;
+        };
+
+        const GpuTimeline& timeline;
+
+        std::vector<std::function<void()>> open;
+        std::deque<Entry> sealed;
+        std::mutex mutex;
+    };
+}
@@ -3,11 +3,16 @@
 #include <Def.hpp>
 #include <Math.hpp>
 
+#include "Sync.hpp"
+
+#include <mutex>
+
 namespace mn::Graphics
 {
     struct Window;
     struct Shader;
     struct Image;
+    enum class PresentMode;
 }
 
 namespace mn::Graphics::Backend
@@ -17,6 +22,12 @@ namespace mn::Graphics::Backend
     struct CommandBuffer;
     struct Semaphore;
     struct Fence;
+    struct StagingRing;
+    struct BufferPool;
+    struct Dispatch;
+    struct DeletionQueue;
+    struct ReadbackQueue;
+    struct UploadEngine;
 
     struct Queue
     {
@@ -24,6 +35,55 @@ namespace mn::Graphics::Backend
         uint32_t index;
     };
 
+    // Which queue a command pool's buffers are submitted to
+    enum class QueueType
+    {
+        Graphics, Transfer, Compute
+    };
+
+    struct MemoryStats
+    {
+        struct Heap
+        {
+            // budget and usage come from the driver when VK_EXT_memory_budget is available,
+            // otherwise they are VMA's estimates (80% of the heap, and our own allocations)
+            std::size_t size, budget, usage;
+            std::size_t block_bytes, allocation_bytes;
+            uint32_t block_count, allocation_count;
+            bool device_local;
+        };
+
+        std::vector<Heap> heaps;
+
+        std::size_t block_bytes, allocation_bytes;
+        uint32_t block_count, allocation_count;
+
+        // Free space inside VMA's blocks, split into this many ranges
+        std::size_t unused_range_count, largest_unused_range;
+
+        // Live objects
+        std::size_t buffers, images, descriptors;
+
+        bool driver_budget;
+
+        // 0 when all the free space is one contiguous range, approaching 1 as it gets chopped up
+        float fragmentation() const
+        {
+            const auto unused = block_bytes - allocation_bytes;
+            return ( unused ? 1.f - static_cast<float>(largest_unused_range) / static_cast<float>(unused) : 0.f );
+        }
+    };
+
+    // What one Device::defragmentStep() did
+    struct DefragmentationPass
+    {
+        std::size_t bytes_moved;
+        std::size_t bytes_reclaimed; // Drop in VMA's block bytes across the pass
+        uint32_t allocations_moved;
+        uint32_t allocations_skipped; // Allocations VMA wanted to move that have no owner to patch
+        bool finished;
+    };
+
     struct Sampler
     {
         enum Type
@@ -45,24 +105,114 @@ namespace mn::Graphics::Backend
         mn::handle_t   getPhysicalDevice() const { return physical_device; }
         Queue          getGraphicsQueue() const { return graphics; }
 
-        std::tuple<handle_t, std::vector<handle_t>, uint32_t, Math::Vec2u>  
-        createSwapchain(Handle<Window> window, mn::handle_t surface) const;
+        // A transfer only queue family when the device has one (usually a dedicated DMA
+        // engine), otherwise this is the graphics queue
+        Queue getTransferQueue() const { return transfer; }
+        bool  hasTransferQueue() const { return transfer.index != graphics.index; }
+
+        // A compute family without graphics when the device has one, so compute work can run
+        // alongside rendering, otherwise this is the graphics queue. It may be the same queue
+        // as getTransferQueue() on devices with few families.
+        Queue getComputeQueue() const { return compute; }
+        bool  hasComputeQueue() const { return compute.index != graphics.index; }
+
+        // Families buffers and images are shared between concurrently, which is every family
+        // in use once there's an async compute queue. Empty when resources are exclusive to the
+        // graphics family, uploads then hand them over with an ownership transfer instead.
+        const std::vector<uint32_t>& getSharedFamilies() const { return shared_families; }
+
+        // Only usable from translation units that include Backend/Dispatch.hpp
+        const Dispatch& getDispatch() const { return *dispatch; }
+
+        // The size swapchains for surface are made with right now. It's zero while the window
+        // is minimized, and no swapchain can be made until it isn't.
+        Math::Vec2u getSurfaceExtent(Handle<Window> window, mn::handle_t surface) const;
+
+        // mode falls back to FIFO (always supported) when the surface doesn't support it.
+        // image_count is clamped to what the surface allows, 0 picks one more than its minimum.
+        // old_swapchain is the one being replaced, it's retired but still has to be destroyed.
+        // Returns the swapchain, its images, their format, size and usage (VkImageUsageFlags).
+        std::tuple<handle_t, std::vector<handle_t>, uint32_t, Math::Vec2u, uint32_t>  
+        createSwapchain(Handle<Window> window, mn::handle_t surface, PresentMode mode, uint32_t image_count = 0, mn::handle_t old_swapchain = nullptr) const;
         
         std::vector<mn::handle_t> getSwapchainImages(mn::handle_t swapchain) const;
         void destroySwapchain(mn::handle_t swapchain) const;
 
-        std::pair<Handle<Image>, mn::handle_t> createImage(const Math::Vec2u& size, uint32_t format, bool depth = false) const;
+        // The VkImageUsageFlags images of format are made with
+        uint32_t getImageUsage(uint32_t format, bool depth = false, bool storage = false) const;
+
+        // Only images compute shaders write into should be made with storage, it keeps some
+        // drivers from compressing them
+        std::pair<Handle<Image>, mn::handle_t> createImage(const Math::Vec2u& size, uint32_t format, bool depth = false, bool storage = false) const;
         void destroyImage(Handle<Image> image, mn::handle_t alloc) const;
 
+        // Same image createImage() makes, without any memory bound to it yet
+        Handle<Image> createUnboundImage(const Math::Vec2u& size, uint32_t format, bool depth = false, bool storage = false) const;
+
+        // Same image createImage() makes, placed into an existing allocation
+        Handle<Image> bindImage(const Math::Vec2u& size, uint32_t format, bool depth, bool storage, mn::handle_t alloc) const;
+
         mn::handle_t createImageView(Handle<Image> image, uint32_t format, bool depth = false) const;
         void destroyImageView(mn::handle_t image_view) const;
 
-        Handle<CommandPool> createCommandPool() const;
+        // A pool for the family of the given queue
+        Handle<CommandPool> createCommandPool(QueueType type = QueueType::Graphics) const;
         void destroyCommandPool(Handle<CommandPool> pool) const;
 
-        Handle<CommandBuffer> createCommandBuffer(Handle<CommandPool> command_pool) const;
+        Handle<CommandBuffer> createCommandBuffer(Handle<CommandPool> command_pool, bool secondary = false) const;
 
-        void immediateSubmit(std::function<void(Backend::CommandBuffer&)> func) const;
+        // Record func into the device's own command buffer, submit it and wait for it.
+        // Serialized across threads, so func mustn't call immediateSubmit itself.
+        // transfer_ticket is passed on to submit().
+        GpuTimeline::Ticket immediateSubmit(std::function<void(Backend::CommandBuffer&)> func, GpuTimeline::Ticket transfer_ticket = 0) const;
+
+        // Submit cmd to the graphics queue, returns the ticket it signals on the timeline.
+        // The optional binary semaphores are for presentation: image_acquired is waited on
+        // before color attachment output, render_finished is signaled when cmd is done.
+        // A non zero compute_ticket holds cmd's compute_stages (VkPipelineStageFlags2) back until
+        // the compute timeline has reached it. A non zero transfer_ticket does the same with
+        // the transfer timeline, at the stages uploads are used at (see UploadEngine::acquire).
+        GpuTimeline::Ticket submit(const CommandBuffer& cmd, Handle<Semaphore> image_acquired = nullptr, Handle<Semaphore> render_finished = nullptr,
+            GpuTimeline::Ticket compute_ticket = 0, uint64_t compute_stages = 0, GpuTimeline::Ticket transfer_ticket = 0) const;
+
+        // Submit cmd (allocated from a transfer pool) to the transfer queue once the graphics
+        // timeline has reached graphics_ticket (0 to not wait), returns the ticket it signals on
+        // the transfer timeline
+        GpuTimeline::Ticket submitTransfer(const CommandBuffer& cmd, GpuTimeline::Ticket graphics_ticket = 0) const;
+
+        // The last ticket submitted to the graphics queue. Frames up to it can have used
+        // anything that existed when they were recorded.
+        GpuTimeline::Ticket lastSubmitted() const { return graphics_submitted.load(); }
+
+        // Submit cmd (allocated from a compute pool) to the compute queue once the graphics
+        // timeline has reached graphics_ticket (0 to not wait), returns the ticket it signals
+        // on the compute timeline. Only when hasComputeQueue().
+        GpuTimeline::Ticket submitCompute(const CommandBuffer& cmd, GpuTimeline::Ticket graphics_ticket) const;
+
+        // Present image_index once wait has signaled, on the graphics queue.
+        // Returns the VkResult, suboptimal and out of date are left for the caller to handle.
+        // A non zero present_id tags the present for waitForPresent(), ids have to increase
+        // with every present to the same swapchain. Ignored without present wait support.
+        int32_t present(mn::handle_t swapchain, uint32_t image_index, Handle<Semaphore> wait, uint64_t present_id = 0) const;
+
+        // VK_KHR_present_id and VK_KHR_present_wait, both optional
+        bool hasPresentWait() const { return present_wait; }
+
+        // Block until the present tagged present_id (or a later one) is on screen, or timeout
+        // (in nanoseconds) passes. Returns false on timeout.
+        bool waitForPresent(mn::handle_t swapchain, uint64_t present_id, uint64_t timeout) const;
+
+        // Everything submitted to the graphics queue
+        GpuTimeline& getTimeline() const { return *timeline; }
+
+        // Everything submitted to the transfer queue, tickets aren't comparable with getTimeline()'s
+        GpuTimeline& getTransferTimeline() const { return *transfer_timeline; }
+
+        // Everything submitted to the compute queue, tickets aren't comparable with the others
+        GpuTimeline& getComputeTimeline() const { return *compute_timeline; }
+
+        // Where anything that may still be in use by the GPU goes to be destroyed
+        DeletionQueue& getDeletionQueue() const { return *deletion; }
 
         Handle<Semaphore> createSemaphore() const;
         void destroySemaphore(Handle<Semaphore> semaphore) const;
@@ -75,6 +225,42 @@ namespace mn::Graphics::Backend
 
         std::shared_ptr<Sampler> getSampler(Sampler::Type type);
 
+        // Ring used to fill device-local buffers, created the first time it's needed
+        StagingRing& getStagingRing();
+
+        // Large VkBuffers that small pooled Buffers are sub-allocated from
+        BufferPool& getBufferPool();
+
+        // Copies of attachments back to the host, created the first time it's needed
+        ReadbackQueue& getReadbackQueue();
+
+        // Uploads on the transfer queue that don't hold up frames, created the first time it's needed
+        UploadEngine& getUploadEngine();
+
+        // Snapshot of VMA's allocations, the heap budgets and live object counts. Not free,
+        // it walks every allocation, so don't call it more than about once a frame
+        MemoryStats memoryStats() const;
+
+        bool hasMemoryBudget() const { return memory_budget; }
+
+        // VK_KHR_swapchain, without it only headless rendering works
+        bool hasSwapchainSupport() const { return swapchain_support; }
+
+        // Incremental defragmentation, meant to be run a step per frame (between frames,
+        // never while one is being recorded) until a step reports it's finished.
+        // Each step idles the GPU, moves at most the given amount and patches the owners
+        // of what moved, see Relocatable. Buffer device addresses change when a buffer
+        // moves, so anything holding on to one has to fetch it again afterwards.
+        void beginDefragmentation(std::size_t max_bytes_per_pass = 64 * 1024 * 1024, uint32_t max_allocations_per_pass = 64);
+        DefragmentationPass defragmentStep();
+        bool isDefragmenting() const { return defragmentation != nullptr; }
+
+        // Lets VMA refresh the heap budgets, called once per frame by the Window
+        void nextFrame();
+
+        // Frees every VMA allocation owned by the device, must run before the allocator is destroyed
+        void releaseMemory();
+
         void waitForIdle() const;
 
         mn::handle_t getImGuiPool();
@@ -85,6 +271,34 @@ namespace mn::Graphics::Backend
         mn::handle_t   physical_device;
 
         std::unordered_map<Sampler::Type, std::shared_ptr<Sampler>> samplers;
-        Queue graphics;
+        std::unique_ptr<StagingRing> staging;
+        std::unique_ptr<BufferPool> pool;
+        std::unique_ptr<ReadbackQueue> readback;
+        std::unique_ptr<UploadEngine> uploads;
+        std::unique_ptr<Dispatch> dispatch;
+        std::unique_ptr<GpuTimeline> timeline, transfer_timeline, compute_timeline;
+        std::unique_ptr<DeletionQueue> deletion;
+        Queue graphics, transfer, compute;
+        std::vector<uint32_t> shared_families;
+
+        // Queues aren't thread safe, and tickets have to be submitted in the order they're handed out.
+        // Queues that turned out to be the same VkQueue share a lock, see queue_lock().
+        mutable std::mutex queue_mutex, transfer_mutex, compute_mutex;
+        std::mutex& queue_lock(const Queue& queue) const;
+
+        // See lastSubmitted()
+        mutable std::atomic<GpuTimeline::Ticket> graphics_submitted;
+
+        mutable std::mutex immediate_mutex;
+        mutable Handle<CommandPool> immediate_pool;
+        mutable std::unique_ptr<CommandBuffer> immediate_buffer;
+
+        void end_defragmentation();
+
+        // The allocator is kept so the context can still be ended while the Instance is being destroyed
+        mn::handle_t defragmentation, defragmentation_allocator;
+
+        bool memory_budget, swapchain_support, present_wait;
+        uint32_t frame_index;
     };
 }
\ No newline at end of file
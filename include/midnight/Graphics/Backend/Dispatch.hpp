@@ -0,0 +1,56 @@
+#pragma once
+
+// Unlike the rest of the headers this one pulls in Vulkan, so it should only ever be
+// included from translation units, never from another public header.
+#include <vulkan/vulkan.h>
+
+namespace mn::Graphics::Backend
+{
+    // Device level function pointers, loaded once when the device is created.
+    // Extension entry points would otherwise need a vkGetDeviceProcAddr string lookup
+    // on every call, and calling the core recording functions through here skips the
+    // loader's trampoline as well.
+    struct Dispatch
+    {
+        void load(VkDevice device);
+
+        // VK_KHR_synchronization2
+        PFN_vkCmdPipelineBarrier2KHR vkCmdPipelineBarrier2KHR = nullptr;
+        PFN_vkQueueSubmit2KHR        vkQueueSubmit2KHR        = nullptr;
+
+        // VK_KHR_timeline_semaphore
+        PFN_vkGetSemaphoreCounterValueKHR vkGetSemaphoreCounterValueKHR = nullptr;
+        PFN_vkWaitSemaphoresKHR           vkWaitSemaphoresKHR           = nullptr;
+
+        // VK_KHR_dynamic_rendering
+        PFN_vkCmdBeginRenderingKHR vkCmdBeginRenderingKHR = nullptr;
+        PFN_vkCmdEndRenderingKHR   vkCmdEndRenderingKHR   = nullptr;
+
+        // VK_KHR_present_wait, null when the device doesn't have it
+        PFN_vkWaitForPresentKHR vkWaitForPresentKHR = nullptr;
+
+        // VK_KHR_buffer_device_address
+        PFN_vkGetBufferDeviceAddressKHR vkGetBufferDeviceAddressKHR = nullptr;
+
+        // Core, used while recording
+        PFN_vkCmdBindPipeline       vkCmdBindPipeline       = nullptr;
+        PFN_vkCmdBindDescriptorSets vkCmdBindDescriptorSets = nullptr;
+        PFN_vkCmdBindVertexBuffers  vkCmdBindVertexBuffers  = nullptr;
+        PFN_vkCmdBindIndexBuffer    vkCmdBindIndexBuffer    = nullptr;
+        PFN_vkCmdPushConstants      vkCmdPushConstants      = nullptr;
+        PFN_vkCmdSetViewport        vkCmdSetViewport        = nullptr;
+        PFN_vkCmdSetScissor         vkCmdSetScissor         = nullptr;
+        PFN_vkCmdDraw               vkCmdDraw               = nullptr;
+        PFN_vkCmdDrawIndexed        vkCmdDrawIndexed        = nullptr;
+        PFN_vkCmdDispatch           vkCmdDispatch           = nullptr;
+        PFN_vkCmdDispatchIndirect   vkCmdDispatchIndirect   = nullptr;
+        PFN_vkCmdCopyBuffer         vkCmdCopyBuffer         = nullptr;
+        PFN_vkCmdCopyImage          vkCmdCopyImage          = nullptr;
+        PFN_vkCmdCopyImageToBuffer  vkCmdCopyImageToBuffer  = nullptr;
+        PFN_vkCmdCopyBufferToImage  vkCmdCopyBufferToImage  = nullptr;
+        PFN_vkCmdClearColorImage    vkCmdClearColorImage    = nullptr;
+        PFN_vkCmdBlitImage          vkCmdBlitImage          = nullptr;
+        PFN_vkCmdPipelineBarrier    vkCmdPipelineBarrier    = nullptr;
+        PFN_vkCmdExecuteCommands    vkCmdExecuteCommands    = nullptr;
+    };
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Def.hpp>
+
+#include "../Buffer.hpp"
+
+#include <optional>
+#include <mutex>
+
+namespace mn::Graphics::Backend
+{
+    struct Device;
+
+    // Shares a handful of large VkBuffers between many small Buffers. Each block is a
+    // single VkBuffer with a VMA virtual block tracking which ranges of it are in use,
+    // a pooled Buffer is then just an (offset, size) range inside one of those blocks.
+    // Blocks are kept per memory type and usage flags, so a range is only ever usable the
+    // way its Buffer's kind is, same as a dedicated buffer.
+    struct BufferPool
+    {
+        struct Range
+        {
+            mn::handle_t buffer, allocation;
+            std::byte* mapped;
+            std::size_t offset;
+            uint32_t block;
+        };
+
+        BufferPool(const Device& device, mn::handle_t allocator, std::size_t block_size, std::size_t max_allocation);
+        ~BufferPool();
+
+        BufferPool(const BufferPool&) = delete;
+        BufferPool(BufferPool&&) = delete;
+
+        // usage is the VkBufferUsageFlags of the Buffer's kind.
+        // Returns nothing when size is too large to be pooled.
+        std::optional<Range> allocate(Graphics::Buffer::Memory memory, u32 usage, std::size_t size);
+        void free(const Range& range);
+
+        std::size_t maxAllocation() const { return max_allocation; }
+
+    private:
+        struct Block
+        {
+            mn::handle_t buffer, allocation, virtual_block;
+            std::byte* mapped;
+            Graphics::Buffer::Memory memory;
+            u32 usage;
+            std::size_t live;
+        };
+
+        std::optional<Range> allocate_from(uint32_t index, std::size_t size);
+        uint32_t create(Graphics::Buffer::Memory memory, u32 usage);
+        void destroy(Block& block) const;
+
+        mn::handle_t allocator;
+        std::size_t block_size, max_allocation, alignment;
+        std::vector<uint32_t> families; // Device::getSharedFamilies()
+
+        std::vector<Block> blocks;
+        std::mutex mutex;
+    };
+}
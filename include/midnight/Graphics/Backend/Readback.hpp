@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Def.hpp>
+#include <Math.hpp>
+
+#include "Sync.hpp"
+#include "../Image.hpp"
+
+#include <deque>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <filesystem>
+#include <condition_variable>
+
+namespace mn::Graphics::Backend
+{
+    struct Device;
+    struct CommandBuffer;
+
+    // Pixels copied back from an image attachment
+    struct ReadbackResult
+    {
+        Math::Vec2u size;
+        u32 format;              // The attachment's VkFormat
+        std::size_t pixel_size;  // Bytes per pixel, rows are tightly packed
+        std::vector<std::byte> pixels;
+    };
+
+    // Copies attachments back into host-visible buffers without stalling anything. A copy
+    // is recorded into the frame's command buffer, sealed with the frame's ticket when it's
+    // submitted, and a worker thread waits on the timeline, copies the pixels out (and
+    // optionally writes them to a PNG) and resolves the future. The staging buffers are
+    // kept and reused for later readbacks.
+    struct ReadbackQueue
+    {
+        ReadbackQueue(const Device& device, mn::handle_t allocator);
+        ~ReadbackQueue();
+
+        ReadbackQueue(const ReadbackQueue&) = delete;
+        ReadbackQueue(ReadbackQueue&&) = delete;
+
+        // Record the copy of a color attachment into cmd, outside of a render pass. The attachment
+        // is left in the transfer source layout, with its tracking saying so. A non empty png is
+        // where the worker writes the image before resolving (8 bit formats only).
+        std::future<ReadbackResult> record(const CommandBuffer& cmd, const Image::Attachment& attachment, const std::filesystem::path& png = {});
+
+        // Everything recorded since the last seal is in flight behind ticket
+        void seal(GpuTimeline::Ticket ticket);
+
+    private:
+        struct Staging
+        {
+            mn::handle_t buffer, allocation;
+            std::byte* mapped;
+            std::size_t size;
+        };
+
+        struct Request
+        {
+            Staging staging;
+            Math::Vec2u size;
+            u32 format;
+            std::size_t pixel_size;
+            std::filesystem::path png;
+            std::promise<ReadbackResult> promise;
+            GpuTimeline::Ticket ticket = 0;
+        };
+
+        Staging acquire(std::size_t size);
+        void destroy(const Staging& staging) const;
+
+        void run();
+        void resolve(Request& request) const;
+
+        const Device& device;
+        mn::handle_t allocator;
+
+        std::vector<Request> open;
+        std::deque<Request> sealed;
+        std::vector<Staging> free; // Buffers of finished readbacks, waiting to be reused
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stop;
+        std::thread worker; // Started by the first readback
+    };
+}
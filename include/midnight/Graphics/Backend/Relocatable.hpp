@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Def.hpp>
+
+namespace mn::Graphics::Backend
+{
+    struct CommandBuffer;
+
+    // Owner of a VMA allocation that Device::defragmentStep() is allowed to move.
+    // The owner stores itself (as a Relocatable*) in the allocation's user data and has to
+    // keep it up to date when it moves. Allocations without an owner (pool blocks, the
+    // staging ring, frame arenas, anything waiting to be destroyed) are never moved.
+    struct Relocatable
+    {
+        // Create a resource identical to the one on allocation, bound to target (the pass's
+        // temporary allocation), and record the copy of its contents into cmd.
+        // Returns the new resource's handle.
+        virtual mn::handle_t relocate(mn::handle_t allocation, mn::handle_t target, CommandBuffer& cmd) = 0;
+
+        // The pass is over and allocation now refers to the new memory. Switch over to
+        // resource and destroy the old one, nothing is using it anymore.
+        virtual void relocated(mn::handle_t allocation, mn::handle_t resource) = 0;
+
+    protected:
+        ~Relocatable() = default;
+    };
+}
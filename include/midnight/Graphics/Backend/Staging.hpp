@@ -0,0 +1,101 @@
+#pragma once
+
+#include <Def.hpp>
+
+#include "Sync.hpp"
+
+#include <optional>
+#include <deque>
+#include <mutex>
+#include <functional>
+
+namespace mn::Graphics
+{
+    struct Buffer;
+}
+
+namespace mn::Graphics::Backend
+{
+    struct Device;
+    struct CommandBuffer;
+
+    // Persistently mapped, host-visible ring buffer used to fill device-local buffers.
+    // Uploads are memcpy'd into the ring and queued. The queued copies are recorded into
+    // a command buffer at the next flush point (start of a frame or render pass) and the
+    // ring space is reused once the device's timeline passes the submission that carried them.
+    struct StagingRing
+    {
+        StagingRing(const Device& device, mn::handle_t allocator, std::size_t capacity);
+        ~StagingRing();
+
+        StagingRing(const StagingRing&) = delete;
+        StagingRing(StagingRing&&) = delete;
+
+        // Queue a copy of size bytes from data into destination at offset
+        void upload(Handle<Graphics::Buffer> destination, std::size_t offset, const void* data, std::size_t size);
+
+        // Queue a GPU side copy of size bytes between two buffers
+        void copy(Handle<Graphics::Buffer> source, std::size_t source_offset, Handle<Graphics::Buffer> destination, std::size_t destination_offset, std::size_t size);
+
+        // Run release once the copies queued so far have executed, and whatever frame is being
+        // recorded has finished. For a buffer that's still the source of a queued copy.
+        void defer(std::function<void()> release);
+
+        // Drop any queued (not yet recorded) copies into [offset, offset + size) of destination
+        void cancel(Handle<Graphics::Buffer> destination, std::size_t offset, std::size_t size);
+
+        // Record every queued copy into cmd, must be called outside of a render pass
+        void record(const CommandBuffer& cmd);
+
+        // Everything recorded since the last submit is in flight behind ticket
+        void submit(GpuTimeline::Ticket ticket);
+
+        // Release the space and garbage of every batch the GPU has finished with
+        void retire();
+
+        // Record and submit the queued copies on their own, then wait for them
+        void flush();
+
+        std::size_t capacity() const { return _capacity; }
+
+    private:
+        struct Copy
+        {
+            mn::handle_t source, destination;
+            std::size_t source_offset, destination_offset, size;
+        };
+
+        struct Allocation
+        {
+            mn::handle_t buffer, allocation;
+        };
+
+        struct Batch
+        {
+            std::optional<std::size_t> begin;
+            std::vector<Allocation> garbage; // Overflow staging buffers
+            std::vector<std::function<void()>> deferred;
+            GpuTimeline::Ticket ticket = 0; // 0 until submitted
+            bool recorded = false;
+        };
+
+        void create();
+        Batch& open_batch();
+        std::optional<std::size_t> reserve(std::size_t size);
+        std::optional<std::size_t> try_fit(std::size_t size);
+        void record_copies(mn::handle_t cmd);
+        void collect();
+        void destroy(const Allocation& a) const;
+
+        const Device& device;
+        mn::handle_t allocator;
+
+        Allocation ring;
+        std::byte* mapped;
+        std::size_t _capacity, head;
+
+        std::vector<Copy> copies;
+        std::deque<Batch> batches;
+        std::mutex mutex;
+    };
+}
@@ -2,8 +2,12 @@
 
 #include <Def.hpp>
 
+#include <atomic>
+
 namespace mn::Graphics::Backend
 {
+    struct Device;
+
     struct Fence
     {
         Fence();
@@ -25,7 +29,48 @@ namespace mn::Graphics::Backend
 
         auto getHandle() const { return handle; }
 
+        // Give up the handle, destroying it is up to the caller from then on
+        Handle<Semaphore> release();
+
     private:
         Handle<Semaphore> handle;
     };
+
+    // Timeline semaphore counting the submissions made to a queue. Every submit signals
+    // the next value, which is handed back to the caller as a ticket. Whether the GPU has
+    // got to a ticket is a counter read, and since a queue completes its submissions in
+    // order, reaching a ticket means everything submitted before it is done as well.
+    struct GpuTimeline
+    {
+        using Ticket = uint64_t;
+
+        GpuTimeline(const Device& device);
+        ~GpuTimeline();
+
+        GpuTimeline(const GpuTimeline&) = delete;
+        GpuTimeline(GpuTimeline&&) = delete;
+
+        // Reserve the value the next submit will signal. Tickets have to be signaled in
+        // the order they were handed out, so this belongs under the queue's lock.
+        Ticket advance() { return ++_pending; }
+
+        // The last ticket handed out
+        Ticket pending() const { return _pending; }
+
+        // Ask the GPU which ticket it has got to
+        Ticket completed() const;
+
+        // Doesn't block, only goes to the driver when the last value it saw is behind
+        bool reached(Ticket ticket) const;
+
+        void wait(Ticket ticket) const;
+
+        Handle<GpuTimeline> getHandle() const { return handle; }
+
+    private:
+        const Device& device;
+        Handle<GpuTimeline> handle;
+        std::atomic<Ticket> _pending;
+        mutable std::atomic<Ticket> _completed;
+    };
 }
\ No newline at end of file
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <Def.hpp>
+
+#include "Sync.hpp"
+
+#include <deque>
+#include <mutex>
+
+namespace mn::Graphics
+{
+    struct Buffer;
+    struct Image;
+}
+
+namespace mn::Graphics::Backend
+{
+    struct Device;
+    struct CommandBuffer;
+
+    // Uploads that don't go through a frame, for loading assets while the render loop keeps
+    // going. The data is copied into staging memory straight away and queued, and submit()
+    // sends everything queued as one batch to the transfer queue (the graphics queue when the
+    // device has no dedicated transfer family) without waiting for it. A batch only waits on
+    // the GPU for the frames submitted before it when it overwrites memory those frames may
+    // have used. Once it's done, the next frame started takes the destinations over to the
+    // graphics queue family with acquire() (and updates the images' layout tracking), and
+    // only that frame's submission waits for the batch. They can be used by any frame started
+    // once acquired() returns true for the ticket.
+    struct UploadEngine
+    {
+        using Ticket = GpuTimeline::Ticket;
+
+        UploadEngine(const Device& device, mn::handle_t allocator);
+        ~UploadEngine();
+
+        UploadEngine(const UploadEngine&) = delete;
+        UploadEngine(UploadEngine&&) = delete;
+
+        // Queue a copy of size bytes from data into destination at offset. The destination
+        // mustn't be resized or written through its own upload() until the batch is acquired.
+        // Only device-local or Generic buffers, the others are written through their mapping.
+        void upload(const std::shared_ptr<Graphics::Buffer>& destination, std::size_t offset, const void* data, std::size_t size);
+
+        // Queue the tightly packed pixels of a whole color attachment of destination, which
+        // ends up in the shader read only layout. size has to cover exactly that.
+        void upload(const std::shared_ptr<Graphics::Image>& destination, uint32_t attachment, const void* data, std::size_t size);
+
+        // Submit everything queued so far, returns the transfer timeline ticket the batch
+        // signals, or 0 when nothing was queued
+        Ticket submit();
+
+        // Whether the GPU has finished copying the batch behind ticket
+        bool finished(Ticket ticket) const;
+
+        // Record the queue family ownership acquires of the batches the GPU has finished into
+        // cmd, which goes to the graphics queue. Returns the last of their tickets, which the
+        // submission of cmd has to wait for at consumerStages(), or 0 when there were none.
+        // Called at the start of every frame, on the thread recording it.
+        Ticket acquire(const CommandBuffer& cmd);
+
+        // Whether the batch behind ticket has been acquired, so frames started from now on can use it
+        bool acquired(Ticket ticket) const;
+
+        // The stages that wait for a batch, which cover everything uploads are used at
+        static uint64_t consumerStages();
+
+        // Submit, wait for all of it and acquire in the device's own command buffer. Like
+        // acquire(), only from the thread recording frames.
+        void flush();
+
+    private:
+        struct Staging
+        {
+            mn::handle_t buffer, allocation;
+        };
+
+        // What the graphics queue has to acquire once the batch is done. The handles are the
+        // ones the copy went to. The destination is kept alive until the batch is done, one
+        // destroyed before that would have the copy write into memory that was freed.
+        struct Destination
+        {
+            std::shared_ptr<Graphics::Buffer> buffer;
+            std::shared_ptr<Graphics::Image> image;
+            mn::handle_t handle;
+            uint32_t attachment; // Of the image
+            std::size_t offset, size;
+        };
+
+        struct Copy
+        {
+            Staging staging;
+            Destination destination;
+            u32 width, height; // Zero for buffers
+            uint64_t allocated_at; // See Buffer::allocatedAt()
+        };
+
+        struct Commands
+        {
+            mn::handle_t pool, buffer;
+        };
+
+        struct Batch
+        {
+            Commands commands;
+            std::vector<Staging> staging;
+            std::vector<Destination> destinations;
+            Ticket ticket;
+            bool acquired;
+        };
+
+        Staging create_staging(const void* data, std::size_t size);
+        void destroy(const Staging& staging) const;
+        Commands acquire_commands();
+        Ticket submit_batch();
+
+        void record_copies(mn::handle_t cmd) const;
+        Ticket record_acquires(mn::handle_t cmd);
+        void collect();
+
+        const Device& device;
+        mn::handle_t allocator;
+        bool ownership_transfer; // The transfer and graphics queues are different families, and resources aren't shared
+
+        std::vector<Copy> copies;
+        std::deque<Batch> batches;
+        std::vector<Commands> free_commands;
+        Ticket last_acquired = 0;
+        mutable std::mutex mutex;
+    };
+}
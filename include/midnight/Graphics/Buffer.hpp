@@ -3,15 +3,50 @@
 #include <Def.hpp>
 
 #include "ObjectHandle.hpp"
+#include <Utility/LiveCount.hpp>
+#include "Backend/Relocatable.hpp"
+
+#include <optional>
+#include <cstring>
+#include <type_traits>
 
 namespace mn::Graphics
 {
-    struct Buffer : ObjectHandle<Buffer>
+    struct Buffer : ObjectHandle<Buffer>, Utility::LiveCount<Buffer>, private Backend::Relocatable
     {
         using gpu_addr = void*;
 
-        MN_SYMBOL Buffer();
-        Buffer(Buffer&&);
+        // HostVisible buffers are persistently mapped and written straight through rawData().
+        // DeviceLocal buffers live in VRAM, they have no mapping and are filled with upload(),
+        // which goes through the device's staging ring and lands at the next flush point
+        // (the start of a frame or of a render pass).
+        enum class Memory
+        {
+            HostVisible, DeviceLocal
+        };
+
+        // Dedicated buffers get a VkBuffer of their own. Pooled buffers are a range inside
+        // one of the device's shared pool blocks, which keeps the number of VkBuffers (and
+        // rebinds between draws) down when there are lots of small buffers. Pooled buffers
+        // too large for the pool quietly fall back to a dedicated allocation.
+        enum class Backing
+        {
+            Dedicated, Pooled
+        };
+
+        // What the buffer is used for, which decides its usage flags and memory type.
+        // Generic can be used as anything, at the cost of the most restrictive placement.
+        // Staging (CPU writes, GPU copies out) and Readback (GPU copies in, CPU reads) are
+        // always host visible and never pooled. Other than those, only device-local and
+        // Generic buffers can be copied on the GPU, so only they are moved by defragmentation.
+        enum class Kind
+        {
+            Generic, Vertex, Index, Uniform, Storage, Staging, Readback
+        };
+
+        MN_SYMBOL Buffer(Memory memory = Memory::HostVisible, Backing backing = Backing::Dedicated);
+        MN_SYMBOL Buffer(Kind kind, Memory memory = Memory::HostVisible, Backing backing = Backing::Dedicated);
+        MN_SYMBOL Buffer(Buffer&&);
         Buffer(const Buffer&) = delete;
         virtual ~Buffer() { rawFree(); }
 
@@ -21,23 +56,87 @@ namespace mn::Graphics
         void allocateBytes(std::size_t bytes) { rawResize(bytes); }
         auto* rawData() const { return reinterpret_cast<std::byte*>(_data); }
         auto allocated() const { return _size; }
+        auto capacity() const { return _capacity; }
+        auto memory() const { return _memory; }
+        auto kind() const { return _kind; }
+        bool mapped() const { return _data != nullptr; }
+        bool pooled() const { return _block.has_value(); }
+
+        // Where this buffer starts inside getHandle(), always 0 unless pooled
+        auto getOffset() const { return _offset; }
+
+        // The last graphics ticket submitted when the current memory was allocated, frames up
+        // to it can't have used it
+        auto allocatedAt() const { return _allocated_at; }
+
+        // Copy size bytes from data into the buffer at offset
+        MN_SYMBOL void upload(const void* data, std::size_t size, std::size_t offset = 0);
 
         MN_SYMBOL gpu_addr getAddress() const;
 
+        // Make GPU writes visible to rawData(), needed before reading a Readback buffer
+        MN_SYMBOL void invalidate() const;
+
+        // Make sure at least bytes can be held without reallocating
+        MN_SYMBOL void reserveBytes(std::size_t bytes);
+
+        // Give back any capacity beyond the current size
+        MN_SYMBOL void shrinkToFit();
+
     protected:
+        // Sizes within the capacity never reallocate (shrinking, even to 0, keeps the memory),
+        // growing past it reallocates geometrically.
+        // The old contents are carried over with a single copy (GPU side for device-local
+        // buffers) and the old allocation is destroyed once the GPU is done with it.
         MN_SYMBOL void rawResize(std::size_t newsize);
+        MN_SYMBOL void rawReallocate(std::size_t newcapacity);
         MN_SYMBOL void rawFree();
         MN_SYMBOL auto rawSize() const { return _size; }
 
     private:
-        Handle<Buffer> allocation;
+        // Destroy the allocation (or give back the pool range) once the GPU is done with it
+        void release(mn::handle_t buffer, mn::handle_t allocation, bool copying) const;
+
+        // Dedicated allocations can be moved by defragmentation, pooled ranges never are
+        mn::handle_t relocate(mn::handle_t allocation, mn::handle_t target, Backend::CommandBuffer& cmd) override;
+        void relocated(mn::handle_t allocation, mn::handle_t resource) override;
+
+        Kind _kind;
+        Memory _memory;
+        Backing _backing;
+        u32 _usage; // VkBufferUsageFlags, pooled blocks are picked by it as well
+        Handle<Buffer> allocation; // VmaAllocation, or the pool's VmaVirtualAllocation when pooled
         void* _data;
-        std::size_t _size;
+        std::size_t _size, _capacity, _offset;
+        uint64_t _allocated_at;
+        std::optional<uint32_t> _block;
+    };
+
+    // A sub-range of some larger buffer (e.g. a frame's transient arena). The slice
+    // doesn't own anything, it's only valid for as long as the memory behind it is.
+    struct BufferSlice
+    {
+        std::byte* data;
+        Handle<Buffer> buffer;
+        std::size_t offset, size;
+        Buffer::gpu_addr address;
+        std::size_t stride = 0;
+
+        std::size_t count() const { return ( stride ? size / stride : 0 ); }
+
+        template<typename T>
+        std::span<T> as() const
+        {
+            return std::span<T>(reinterpret_cast<T*>(data), size / sizeof(T));
+        }
     };
 
     template<typename T>
     struct TypeBuffer : Buffer
     {
+        TypeBuffer(Memory memory = Memory::HostVisible, Backing backing = Backing::Dedicated) : Buffer(memory, backing) { }
+        TypeBuffer(Kind kind, Memory memory = Memory::HostVisible, Backing backing = Backing::Dedicated) : Buffer(kind, memory, backing) { }
+
         uint32_t getSize() const override { return sizeof(T); }
         uint32_t vertices() const override { return size(); }
 
@@ -49,6 +148,7 @@ namespace mn::Graphics
 
         T& at(std::size_t index)
         {
+            MIDNIGHT_ASSERT(mapped(), "Buffer is not host visible, use upload()");
             MIDNIGHT_ASSERT(index < size(), "Index out of bounds");
             return *(reinterpret_cast<T*>(rawData()) + index);
         }
@@ -72,91 +172,133 @@ namespace mn::Graphics
         {
             this->rawResize(count * sizeof(T));
         }
+
+        void reserve(std::size_t count)
+        {
+            this->reserveBytes(count * sizeof(T));
+        }
+
+        using Buffer::upload;
+
+        void upload(std::span<const T> values, std::size_t index = 0)
+        {
+            Buffer::upload(values.data(), values.size_bytes(), index * sizeof(T));
+        }
     };
 
+    // Growable array in host visible GPU memory, for things like per-instance streams.
+    // Elements live directly in the mapped buffer, so T has to be trivially copyable.
+    // Growth is geometric and goes through Buffer, so getAddress() changes when the
+    // vector reallocates but the old address stays valid until in-flight frames finish.
     template<typename T>
     struct Vector 
     {
-        Vector() : count{0} { }
+        static_assert(std::is_trivially_copyable_v<T>, "Vector elements are copied around as raw bytes");
+
+        Vector() = default;
 
-        Vector(uint32_t elements)
+        Vector(std::size_t elements)
         {
             resize(elements);
         }
 
-        uint32_t size() const
-        {
-            return count;
-        }
+        std::size_t size() const { return memory.allocated() / sizeof(T); }
+        std::size_t capacity() const { return memory.capacity() / sizeof(T); }
+        bool empty() const { return !size(); }
 
         Buffer::gpu_addr getAddress() const
         {
             return memory.getAddress();
         }
 
-        void reserve(const uint32_t& count)
-        {
-            // If count < this->count, we need to call the destructors
-            for (uint32_t i = count; i < this->count; i++)
-                reinterpret_cast<T*>(memory.rawData() + i * sizeof(T))->~T();
+        const Buffer& buffer() const { return memory; }
 
-            memory.allocateBytes(count * sizeof(T));
-        }
+        T* data() { return reinterpret_cast<T*>(memory.rawData()); }
+        const T* data() const { return reinterpret_cast<const T*>(memory.rawData()); }
 
-        void resize(const uint32_t& count)
+        std::span<T> span() { return std::span<T>(data(), size()); }
+        std::span<const T> span() const { return std::span<const T>(data(), size()); }
+
+        T* begin() { return data(); }
+        T* end() { return data() + size(); }
+        const T* begin() const { return data(); }
+        const T* end() const { return data() + size(); }
+
+        void reserve(std::size_t count)
         {
-            if (count == this->count) return; 
-            
-            // If count < this->count, we need to call the destructors
-            for (uint32_t i = count; i < this->count; i++)
-                reinterpret_cast<T*>(memory.rawData() + i * sizeof(T))->~T();
+            memory.reserveBytes(count * sizeof(T));
+        }
 
+        void resize(std::size_t count)
+        {
+            const auto old = size();
             memory.allocateBytes(count * sizeof(T));
 
-            // default construct each object in the new region
-            for (uint32_t i = this->count; i < count; i++)
-                new(memory.rawData() + i * sizeof(T)) T();
+            // value initialize each object in the new region
+            for (std::size_t i = old; i < count; i++)
+                new(data() + i) T();
+        }
 
-            this->count = count;
+        void clear()
+        {
+            memory.allocateBytes(0);
+        }
+
+        void shrink_to_fit()
+        {
+            memory.shrinkToFit();
         }
 
         void push_back(const T& value)
         {
-            if (count == memory.allocated() / sizeof(T))
-                reserve((memory.allocated() / sizeof(T) + 5) * 1.75f * sizeof(T));
-            new(memory.rawData() + count * sizeof(T)) T(value);
-        }   
+            emplace_back(value);
+        }
 
         template<typename... Args>
-        void emplace_back(Args&&... args)
+        T& emplace_back(Args&&... args)
         {
-            if (count == memory.allocated() / sizeof(T))
-                reserve((memory.allocated() / sizeof(T) + 5) * 1.75f * sizeof(T));
-            new(memory.rawData() + count * sizeof(T)) T(std::forward<Args>(args)...);
+            const auto index = size();
+            memory.allocateBytes((index + 1) * sizeof(T));
+            return *new(data() + index) T(std::forward<Args>(args)...);
         }
 
-        T& at(uint32_t index)
+        void append(std::span<const T> values)
         {
-            return *reinterpret_cast<T*>(memory.rawData() + index * sizeof(T));
+            if (values.empty()) return;
+
+            const auto index = size();
+            memory.allocateBytes((index + values.size()) * sizeof(T));
+            std::memcpy(data() + index, values.data(), values.size_bytes());
         }
 
-        const T& at(uint32_t index) const
+        void pop_back()
+        {
+            MIDNIGHT_ASSERT(size(), "pop_back on an empty Vector");
+            memory.allocateBytes((size() - 1) * sizeof(T));
+        }
+
+        T& at(std::size_t index)
+        {
+            MIDNIGHT_ASSERT(index < size(), "Index out of bounds");
+            return data()[index];
+        }
+
+        const T& at(std::size_t index) const
         {
             return const_cast<Vector<T>*>(this)->at(index);
         }
 
-        T& operator[](uint32_t index)
+        T& operator[](std::size_t index)
         {
             return at(index);
         }
 
-        const T& operator[](uint32_t index) const
+        const T& operator[](std::size_t index) const
         {
             return at(index);
         }
 
     private:
-        uint32_t count;
         Buffer memory;
     };
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ObjectHandle.hpp"
+#include <Utility/LiveCount.hpp>
 
 namespace mn::Graphics
 {
@@ -16,15 +17,16 @@ namespace Backend
     // Basic abstraction of vulkan descriptor set
     // We should have pools built *out* as well, but for now each
     // set has its own pool (bad)
-    struct Descriptor : ObjectHandle<Descriptor>
+    struct Descriptor : ObjectHandle<Descriptor>, Utility::LiveCount<Descriptor>
     {
         struct Layout : ObjectHandle<Layout>
         {
             struct Binding
             {
+                // StorageImage is read and written by compute shaders, in the general layout
                 enum Type
                 {
-                    Image, Sampler
+                    Image, Sampler, StorageImage
                 } type;
 
                 uint32_t count;
@@ -106,6 +108,12 @@ namespace Backend
         using Type = std::vector<std::shared_ptr<Backend::Sampler>>;
     };
 
+    template<>
+    struct Descriptor::Layout::BindingData<Descriptor::Layout::Binding::StorageImage>
+    {
+        using Type = std::vector<std::shared_ptr<Image>>;
+    };
+
     struct DescriptorLayoutBuilder
     {
         MN_SYMBOL DescriptorLayoutBuilder& addBinding(Descriptor::Layout::Binding binding);
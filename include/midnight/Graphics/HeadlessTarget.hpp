@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Def.hpp>
+#include <Math.hpp>
+
+#include <Graphics/Backend/Sync.hpp>
+
+#include "Window.hpp"
+#include "RenderFrame.hpp"
+
+namespace mn::Graphics
+{
+    struct HeadlessOptions
+    {
+        // Same as WindowOptions::frames_in_flight
+        uint32_t frames_in_flight = 2;
+
+        // Images rendered into in turn, 0 uses one per frame in flight
+        uint32_t image_count = 0;
+
+        u32 color_format = Image::B8G8R8A8_UNORM;
+    };
+
+    // Offscreen stand in for a Window, for servers, CI and benchmarks. Frames are recorded
+    // the same way (startFrame, RenderFrame, endFrame) into plain Images instead of a
+    // swapchain, and nothing touches SDL or a surface. Like a Window, it owns the Instance
+    // and destroys it when it goes.
+    struct HeadlessTarget
+    {
+        MN_SYMBOL HeadlessTarget(const Math::Vec2u& size, const HeadlessOptions& options = {});
+
+        HeadlessTarget(const HeadlessTarget&) = delete;
+        HeadlessTarget(HeadlessTarget&&) = delete;
+
+        MN_SYMBOL ~HeadlessTarget();
+
+        auto size() const { return _size; }
+        float aspectRatio() const { return (float)Math::x(_size) / (float)Math::y(_size); }
+
+        MN_SYMBOL RenderFrame startFrame() const;
+        MN_SYMBOL void endFrame(RenderFrame& rf) const;
+        MN_SYMBOL void runFrame(const std::function<void(RenderFrame& rf)>& func) const;
+
+        MN_SYMBOL void finishWork() const;
+
+        uint32_t imageCount() const { return static_cast<uint32_t>(images.size()); }
+
+        // The image a frame rendered into, at its RenderFrame::image_index. It's left in
+        // the general layout, and is safe to read once getTicket(index) has been reached.
+        const std::shared_ptr<Image>& getImage(uint32_t index) const { return images[index]; }
+
+        // Ticket of the last frame rendered into the image at index, 0 if there hasn't been one
+        Backend::GpuTimeline::Ticket getTicket(uint32_t index) const { return images_in_flight[index]; }
+
+    private:
+        std::shared_ptr<FrameData> get_next_frame() const;
+
+        std::vector<std::shared_ptr<Image>> images;
+        mutable std::vector<Backend::GpuTimeline::Ticket> images_in_flight;
+
+        std::vector<std::shared_ptr<FrameData>> frame_data;
+        mutable uint64_t frame_count;
+        Math::Vec2u _size;
+    };
+}
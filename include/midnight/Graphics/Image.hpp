@@ -3,6 +3,10 @@
 #include <Math.hpp>
 
 #include "ObjectHandle.hpp"
+#include <Utility/LiveCount.hpp>
+#include "Backend/Relocatable.hpp"
+
+#include <optional>
 
 namespace mn::Graphics
 {
@@ -10,7 +14,7 @@ namespace mn::Graphics
     // Then we can add has_attachment<>() function to determine if there's depth/stencil
     struct ImageFactory;
 
-    struct Image
+    struct Image : Utility::LiveCount<Image>, private Backend::Relocatable
     {
         enum Type
         {
@@ -22,6 +26,32 @@ namespace mn::Graphics
             mn::handle_t handle, allocation, view;
             u32 format;
             Math::Vec2u size;
+            u32 usage = 0; // VkImageUsageFlags it was made with
+
+            // VkImageLayout the image was last transitioned to while recording (0 is undefined,
+            // i.e. nothing worth keeping). Updated through const references, hence mutable.
+            mutable u32 layout = 0;
+
+            // How it was last used, for Backend::BarrierBatch: the stages and accesses
+            // (VkPipelineStageFlags2, VkAccessFlags2) of the last write, and the stages that
+            // have been synchronized with that write since
+            mutable uint64_t write_stages = 0, write_access = 0, read_stages = 0;
+
+            // The last graphics ticket submitted when it was allocated, frames up to it can't
+            // have used it
+            uint64_t allocated_at = 0;
+
+            // Left in layout by something that isn't tracked (an upload, a copy), so the next
+            // use waits on everything before it
+            void setLayout(u32 layout) const;
+
+            // Nothing in the image is worth keeping, the next use transitions it from undefined
+            // and only waits on stages
+            void discard(uint64_t stages = 0) const;
+
+            // Same, for memory another image was using: its writes (access at stages) still
+            // have to be finished before the first write to this one lands on top of them
+            void discard(uint64_t stages, uint64_t access) const;
 
             // IF IMGUI
             mn::handle_t imgui_ds;
@@ -41,10 +71,14 @@ namespace mn::Graphics
         };
 
         Image(const Image&) = delete;
-        Image(Image&&) = default;
+        Image(Image&&);
 
         ~Image();
 
+        // Keep defragmentation from moving this image's attachments. Needed once their views
+        // are written into descriptor sets, which nothing would rewrite after a move.
+        void pin();
+
         bool hasDepthAttachment() const
         {
             return depth_attachment.has_value();
@@ -79,21 +113,32 @@ namespace mn::Graphics
 
         Image() = default;
 
+        // Point the attachments' allocations at this image, so defragmentation can find it
+        void track();
+
+        Attachment* find(mn::handle_t allocation);
+
+        mn::handle_t relocate(mn::handle_t allocation, mn::handle_t target, Backend::CommandBuffer& cmd) override;
+        void relocated(mn::handle_t allocation, mn::handle_t resource) override;
+
         std::vector<Attachment> color_attachments;
         std::optional<Attachment> depth_attachment;
+        bool pinned = false;
     };
 
     struct ImageFactory
     {
         ImageFactory();
 
+        // With storage, compute shaders can write into it (Descriptor StorageImage bindings).
+        // Leave it off otherwise, it keeps some drivers from compressing the image.
         template<Image::Type T>
         ImageFactory&
-        addAttachment(u32 format, const Math::Vec2u& size);
+        addAttachment(u32 format, const Math::Vec2u& size, bool storage = false);
 
         template<Image::Type T>
         ImageFactory&
-        addImage(handle_t handle, u32 format, const Math::Vec2u& size);
+        addImage(handle_t handle, u32 format, const Math::Vec2u& size, u32 usage);
 
         [[nodiscard]] Image&& 
         build();
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <Def.hpp>
+
+namespace mn::Graphics
+{
+    // ImGui window that samples Backend::Device::memoryStats() every frame and graphs
+    // heap usage against the budget, VMA block/allocation bytes and live object counts
+    struct MemoryMonitor
+    {
+        MN_SYMBOL MemoryMonitor(std::size_t history = 600);
+
+        // Call between Window::startFrame and Window::endFrame
+        MN_SYMBOL void draw(bool* open = nullptr);
+
+    private:
+        struct Series
+        {
+            std::vector<float> values;
+        };
+
+        void push(Series& series, float value);
+        void plot(const char* label, const Series& series) const;
+
+        std::size_t history, count, next;
+        std::vector<float> frames;
+        Series usage, budget, blocks, allocations, buffers, images, descriptors;
+        float frame;
+    };
+}
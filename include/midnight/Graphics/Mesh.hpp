@@ -3,10 +3,10 @@
 #include <Def.hpp>
 #include <Math.hpp>
 
+#include "Buffer.hpp"
+
 namespace mn::Graphics
 {
-    template<typename T>
-    struct TypeBuffer;
     struct RenderFrame;
 
     struct Mesh
@@ -26,7 +26,13 @@ namespace mn::Graphics
             std::vector<uint32_t> indices;
         };
 
-        MN_SYMBOL static Mesh fromFrame(const Frame& frame);
+        // Static geometry should use Buffer::Memory::DeviceLocal, the vertices()/indices()
+        // spans are only available for host visible meshes. Lots of small meshes should
+        // also use Buffer::Backing::Pooled so they share VkBuffers.
+        MN_SYMBOL static Mesh fromFrame(
+            const Frame& frame, 
+            Buffer::Memory memory = Buffer::Memory::HostVisible, 
+            Buffer::Backing backing = Buffer::Backing::Dedicated);
         MN_SYMBOL static Mesh fromLua(const std::string& lua_file);
 
         MN_SYMBOL std::size_t vertexCount() const;
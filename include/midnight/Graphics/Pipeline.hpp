@@ -53,9 +53,13 @@ namespace mn::Graphics
         
         const auto& getAttributes() const { MIDNIGHT_ASSERT(type == ShaderType::Vertex, "Attributes only for vertex shader"); return *attributes; }
 
+        // local_size_x/y/z declared by a compute shader
+        const auto& getWorkgroupSize() const { MIDNIGHT_ASSERT(type == ShaderType::Compute, "Workgroup size only for compute shader"); return *workgroup_size; }
+
     private:
         ShaderType type;
         std::optional<std::vector<Attribute>> attributes;
+        std::optional<Math::Vec3u> workgroup_size;
     };
 
     struct PipelineBuilder;
@@ -71,16 +75,17 @@ namespace mn::Graphics
 
         auto getBindingStride() const { return binding_strides[0]; }
 
-        MN_SYMBOL void setPushConstant(const std::unique_ptr<Backend::CommandBuffer>& cmd, const void* data) const;
+        MN_SYMBOL void setPushConstant(const Backend::CommandBuffer& cmd, const void* data) const;
 
         template<typename T>
-        void setPushConstant(const std::unique_ptr<Backend::CommandBuffer>& cmd, const T& value) const
+        void setPushConstant(const Backend::CommandBuffer& cmd, const T& value) const
         {
             MIDNIGHT_ASSERT(sizeof(T) == push_constant_size, "Push constant size descrepancy");
             setPushConstant(cmd, reinterpret_cast<const void*>(&value));
         }
 
         auto getLayoutHandle() const { return layout; }
+        auto getPushConstantSize() const { return push_constant_size; }
         const auto& getDescriptorLayouts() const { return descriptor_layouts; }
 
     private:
@@ -137,4 +142,69 @@ namespace mn::Graphics
         bool backface_cull = true, blending = true, depth = true, clockwise = true;
         uint32_t depth_format = 0, push_constant_size = 0;
     };
+
+    struct ComputePipelineBuilder;
+
+    // A single compute shader with its layout. Bound and dispatched through RenderFrame,
+    // outside of startRender/endRender.
+    struct ComputePipeline : ObjectHandle<ComputePipeline>
+    {
+        friend struct ComputePipelineBuilder;
+
+        ComputePipeline(const ComputePipeline&) = delete;
+        MN_SYMBOL ComputePipeline(ComputePipeline&&);
+
+        MN_SYMBOL ~ComputePipeline();
+
+        MN_SYMBOL void setPushConstant(const Backend::CommandBuffer& cmd, const void* data) const;
+
+        template<typename T>
+        void setPushConstant(const Backend::CommandBuffer& cmd, const T& value) const
+        {
+            MIDNIGHT_ASSERT(sizeof(T) == push_constant_size, "Push constant size descrepancy");
+            setPushConstant(cmd, reinterpret_cast<const void*>(&value));
+        }
+
+        // Threads per workgroup, to work out how many groups cover a given amount of work
+        const auto& getWorkgroupSize() const { return workgroup_size; }
+
+        auto getLayoutHandle() const { return layout; }
+        auto getPushConstantSize() const { return push_constant_size; }
+        const auto& getDescriptorLayouts() const { return descriptor_layouts; }
+
+    private:
+        ComputePipeline(Handle<ComputePipeline> h) : ObjectHandle(h) {  }
+
+        uint32_t push_constant_size;
+        std::vector<std::shared_ptr<Descriptor::Layout>> descriptor_layouts;
+        Math::Vec3u workgroup_size;
+        mn::handle_t layout;
+    };
+
+    struct ComputePipelineBuilder
+    {
+        MN_SYMBOL static ComputePipelineBuilder fromLua(const std::string& source_dir, const std::string& script);
+
+        MN_SYMBOL ComputePipelineBuilder& setShader(std::filesystem::path path);
+        MN_SYMBOL ComputePipelineBuilder& setShader(std::shared_ptr<Shader> shader);
+        MN_SYMBOL ComputePipelineBuilder& addDescriptorLayout(std::shared_ptr<Descriptor::Layout> d);
+
+        template<typename T>
+        ComputePipelineBuilder& setPushConstantObject()
+        {
+            push_constant_size = sizeof(T);
+            return *this;
+        }
+
+        [[nodiscard]] MN_SYMBOL ComputePipeline build() const;
+
+        ComputePipelineBuilder() = default;
+        ComputePipelineBuilder(const ComputePipelineBuilder&) = default;
+        ComputePipelineBuilder(ComputePipelineBuilder&&) = default;
+
+    private:
+        std::shared_ptr<Shader> shader;
+        std::vector<std::shared_ptr<Descriptor::Layout>> descriptor_layouts;
+        uint32_t push_constant_size = 0;
+    };
 }
@@ -2,28 +2,54 @@
 
 #include <Def.hpp>
 
+#include <cstring>
+#include <array>
+
 #include "Mesh.hpp"
 #include "Buffer.hpp"
 #include "Image.hpp"
 
+#include "Backend/Readback.hpp"
+
+namespace mn::Graphics::Backend
+{
+    struct BarrierBatch;
+}
+
 namespace mn::Graphics
 {
     struct Window;
+    struct HeadlessTarget;
+    struct RenderGraph;
     struct FrameData;
     struct Pipeline;
+    struct ComputePipeline;
     struct Descriptor;
 
-    // [x] Remove any `const T&` arguments, replace with std::shared_ptr<T>
-    // [x] Store the passed in pointers in an std::vector<std::shared_ptr<void>> in the frame_data
-    // [x] Add `.release()` function to frame_data that clears this vector (call it from the Window::startFrame method)
-    // [x] Add multiple color attachments to image
-    // [ ] Pass optional image into startRender() (no passed in image defaults to given)
-    // [x] Add explicit binding methods
-    // [x] Require descriptor set std::shared_ptr in pipeline
+    // How a pass touches a resource, for RenderFrame::barrier
+    enum class Access
+    {
+        ComputeRead, ComputeWrite, // Storage buffers and images in compute shaders
+        ShaderRead,                // Vertex and fragment shaders
+        VertexInput,               // Vertex and index buffers
+        IndirectCommand,           // Arguments of indirect draws and dispatches
+        ColorAttachment,
+        TransferRead, TransferWrite,
+        HostRead
+    };
+
+    // Binds a RenderFrame sent to Vulkan, and the redundant ones it dropped because the same
+    // pipeline, descriptor set, vertex/index buffer or push constant data was already bound
+    struct BindStats
+    {
+        uint32_t issued = 0, skipped = 0;
+    };
 
     struct RenderFrame
     {
         friend struct Window;
+        friend struct HeadlessTarget;
+        friend struct RenderGraph;
 
         const uint32_t image_index;
         std::shared_ptr<Image> image;
@@ -31,6 +57,21 @@ namespace mn::Graphics
         MN_SYMBOL void startRender(std::optional<std::shared_ptr<Image>> image = std::nullopt);
         MN_SYMBOL void endRender();
 
+        // Same as startRender, but the drawing is spread over worker threads. Each worker
+        // records through its own recorder(index), backed by its own command pool and a
+        // secondary command buffer, and endRender executes them in index order. Nothing can
+        // be drawn through this RenderFrame itself until endRender.
+        MN_SYMBOL void startParallelRender(uint32_t workers, std::optional<std::shared_ptr<Image>> image = std::nullopt);
+
+        // Only valid between startParallelRender and endRender, from one thread at a time
+        RenderFrame& recorder(uint32_t index) { return recorders[index]; }
+        uint32_t recorderCount() const { return static_cast<uint32_t>(recorders.size()); }
+
+        // This frame's binds so far, a parallel render's recorders are added in at endRender.
+        // Push constants set through Pipeline::setPushConstant directly aren't tracked, and
+        // leave the tracked ones stale.
+        const BindStats& bindStats() const { return bind_stats; }
+
         MN_SYMBOL void clear(std::tuple<float, float, float> color, float alpha = 1.f, std::optional<std::shared_ptr<Image>> image = std::nullopt, int attachment_index = -1) const;
         
         MN_SYMBOL void setPushConstant(const Pipeline& pipeline, const void* data) const;
@@ -40,14 +81,42 @@ namespace mn::Graphics
             setPushConstant(pipeline, reinterpret_cast<const void*>(&value));
         }
 
+        // Transient memory that stays valid until this frame has finished on the GPU
+        MN_SYMBOL BufferSlice allocate(std::size_t size, std::size_t alignment = 16) const;
+
+        template<typename T>
+        BufferSlice upload(std::span<const T> values) const
+        {
+            auto slice = allocate(values.size_bytes(), alignof(T));
+            std::memcpy(slice.data, values.data(), values.size_bytes());
+            slice.stride = sizeof(T);
+            return slice;
+        }
+
+        template<typename T>
+        BufferSlice upload(const std::vector<T>& values) const
+        {
+            return upload(std::span<const T>(values));
+        }
+
         MN_SYMBOL void blit(const Image::Attachment& source, const Image::Attachment& destination) const;
 
+        // Copy a color attachment back to the host, outside of startRender/endRender. Resolves on
+        // a worker thread once this frame has finished on the GPU, never stalls the frame loop.
+        // With png set, the worker also writes the image there first.
+        MN_SYMBOL std::future<Backend::ReadbackResult> readback(const Image::Attachment& attachment, const std::filesystem::path& png = {}) const;
+
         MN_SYMBOL void bind(const std::shared_ptr<Pipeline>& pipeline) const;
 
         // Does not bind pipeline
         MN_SYMBOL void bind(uint32_t set_index, const std::shared_ptr<Pipeline>& pipeline, const std::shared_ptr<Descriptor>& descriptor) const;
 
+        MN_SYMBOL void bindVertices(const BufferSlice& vertices, uint32_t binding = 0) const;
+        MN_SYMBOL void bindIndices(const BufferSlice& indices) const;
+
         MN_SYMBOL void draw(uint32_t vertices, uint32_t instances = 1) const;
+        MN_SYMBOL void draw(const BufferSlice& vertices, uint32_t instances = 1) const;
+        MN_SYMBOL void drawIndexed(const BufferSlice& vertices, const BufferSlice& indices, uint32_t instances = 1) const;
         MN_SYMBOL void draw(const std::shared_ptr<Buffer>& buffer, uint32_t instances = 1) const;
         MN_SYMBOL void draw(const std::shared_ptr<Mesh>& mesh, uint32_t instances = 1) const;
         MN_SYMBOL void drawIndexed(
@@ -60,12 +129,111 @@ namespace mn::Graphics
         MN_SYMBOL void draw(const std::shared_ptr<Pipeline>& pipeline, uint32_t vertices, uint32_t instances = 1) const;
         MN_SYMBOL void draw(const std::shared_ptr<Pipeline>& pipeline, const std::shared_ptr<Buffer>& buffer, uint32_t instances = 1) const;
         MN_SYMBOL void draw(const std::shared_ptr<Pipeline>& pipeline, const std::shared_ptr<Mesh>& mesh, uint32_t instances = 1) const;
+        MN_SYMBOL void draw(const std::shared_ptr<Pipeline>& pipeline, const BufferSlice& vertices, uint32_t instances = 1) const;
 
         MN_SYMBOL void drawIndexed(const std::shared_ptr<Pipeline>& pipeline, const std::shared_ptr<Buffer>& buffer, const std::shared_ptr<TypeBuffer<uint32_t>>& indices, uint32_t instances = 1) const;
 
+        // Compute work is recorded outside of startRender/endRender
+        MN_SYMBOL void bind(const std::shared_ptr<ComputePipeline>& pipeline) const;
+
+        // Does not bind pipeline
+        MN_SYMBOL void bind(uint32_t set_index, const std::shared_ptr<ComputePipeline>& pipeline, const std::shared_ptr<Descriptor>& descriptor) const;
+
+        MN_SYMBOL void setPushConstant(const ComputePipeline& pipeline, const void* data) const;
+        template<typename T>
+        void setPushConstant(const ComputePipeline& pipeline, const T& value) const
+        {
+            setPushConstant(pipeline, reinterpret_cast<const void*>(&value));
+        }
+
+        // Counts are in workgroups, not threads
+        MN_SYMBOL void dispatch(uint32_t x, uint32_t y = 1, uint32_t z = 1) const;
+
+        // The workgroup counts are three uint32_t the GPU reads from the start of args
+        MN_SYMBOL void dispatchIndirect(const BufferSlice& args) const;
+        MN_SYMBOL void dispatchIndirect(const std::shared_ptr<Buffer>& args, std::size_t offset = 0) const;
+
+        // Make what was done to a resource as before visible to what's done as after, between
+        // passes. Without a resource it's a global memory barrier, which covers every buffer and
+        // is what most drivers turn buffer barriers into anyway.
+        MN_SYMBOL void barrier(Access before, Access after) const;
+        MN_SYMBOL void barrier(const BufferSlice& slice, Access before, Access after) const;
+        MN_SYMBOL void barrier(const std::shared_ptr<Buffer>& buffer, Access before, Access after) const;
+
+        // Attachments know how they were last used, so only what they're used for next is
+        // needed. Moves them to the layout for it, general for anything but sampling and copies.
+        MN_SYMBOL void barrier(const Image::Attachment& attachment, Access after) const;
+
+        // Async compute. The compute binds, dispatches and barriers recorded between
+        // startAsyncCompute and endAsyncCompute go to the device's compute queue and run
+        // alongside the frame's graphics work, so barriers in there can only name compute,
+        // indirect, transfer and host accesses. endAsyncCompute submits the graphics recorded
+        // so far and the compute after it, so the compute sees everything recorded before it.
+        // waitAsyncCompute marks where graphics starts to need the results: the work recorded
+        // from there on waits for the compute only at consumer's stages, while the work recorded
+        // in between (shadows, say) overlaps with it. Without waitAsyncCompute the end of the
+        // frame waits for it. Each call that submits costs a queue submission.
+        // Devices without a separate compute queue record all of it in line, and
+        // waitAsyncCompute is a barrier.
+        MN_SYMBOL void startAsyncCompute();
+        MN_SYMBOL void endAsyncCompute();
+        MN_SYMBOL void waitAsyncCompute(Access consumer);
+
     private:
         RenderFrame(uint32_t i, std::shared_ptr<Image> im) : image_index(i), image(im) { }
 
+        // The attachments' barriers are added to batch when there is one, and it's recorded
+        // with them, so whoever passed it gets everything into a single barrier
+        void start_render(const std::shared_ptr<Image>& image, bool secondary_contents, Backend::BarrierBatch* batch = nullptr);
+
+        // What draws are recorded into, the frame's command buffer unless this is a recorder
+        // or async compute is being recorded
+        Backend::CommandBuffer& command_buffer() const;
+
+        // What's bound in command_buffer(), so binds that wouldn't change anything can be
+        // skipped. Forgotten whenever recording moves to another command buffer, or after
+        // secondary command buffers have been executed.
+        struct BoundState
+        {
+            static constexpr uint32_t MaxSets = 8, MaxVertexBindings = 4;
+
+            struct Range
+            {
+                mn::handle_t buffer = nullptr;
+                std::size_t offset = 0;
+            };
+
+            // Graphics and compute have separate bind points
+            struct BindPoint
+            {
+                mn::handle_t pipeline = nullptr;
+                mn::handle_t sets_layout = nullptr, push_layout = nullptr;
+                std::array<mn::handle_t, MaxSets> sets{};
+                std::vector<std::byte> push_constants;
+            } graphics, compute;
+
+            std::array<Range, MaxVertexBindings> vertices;
+            Range indices;
+        };
+
+        // Each of these records what's about to be bound, and returns whether it has to be
+        bool bind_pipeline(BoundState::BindPoint& point, mn::handle_t pipeline) const;
+        bool bind_set(BoundState::BindPoint& point, mn::handle_t layout, uint32_t set, mn::handle_t descriptor) const;
+        bool push_constants(BoundState::BindPoint& point, mn::handle_t layout, const void* data, std::size_t size) const;
+        bool bind_range(BoundState::Range& range, mn::handle_t buffer, std::size_t offset) const;
+        bool count(bool issued) const;
+        void forget_bound() const;
+
+        void bind_vertex_buffer(mn::handle_t buffer, std::size_t offset, uint32_t binding = 0) const;
+        void bind_index_buffer(mn::handle_t buffer, std::size_t offset) const;
+
         std::shared_ptr<FrameData> frame_data;
+        Backend::CommandBuffer* secondary = nullptr;
+        Backend::CommandBuffer* compute = nullptr; // Between startAsyncCompute and endAsyncCompute
+        std::vector<RenderFrame> recorders;
+        bool rendering = false; // Between startRender and endRender
+
+        mutable BoundState bound;
+        mutable BindStats bind_stats;
     };
 }
\ No newline at end of file
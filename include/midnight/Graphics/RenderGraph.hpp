@@ -0,0 +1,177 @@
+#pragma once
+
+#include <Def.hpp>
+#include <Math.hpp>
+
+#include "RenderFrame.hpp"
+#include "Backend/Barrier.hpp"
+
+#include <deque>
+#include <map>
+#include <functional>
+
+namespace mn::Graphics
+{
+    // Passes declare the images and buffers they use and how, and the graph works out the
+    // synchronization between them. It's declared anew every frame between startFrame and
+    // endFrame (reset, then import/create and addPass, then execute) and compiled as it's
+    // executed: passes run in the order they were added, minus the ones nothing uses the
+    // results of, each after a single barrier covering everything it's about to use, and
+    // transient images whose passes don't overlap share memory.
+    //
+    // Transient images are kept from one frame to the next for as long as the graph declares
+    // the same ones used by the same passes, so descriptors written with them stay valid until
+    // its shape changes. Their contents don't carry over from one frame to the next.
+    struct RenderGraph
+    {
+        struct ImageId  { uint32_t index = ~0u; };
+        struct BufferId { uint32_t index = ~0u; };
+
+        // A transient image, only alive from the first pass that needs it to the last
+        struct ImageDesc
+        {
+            Math::Vec2u size;
+            std::vector<u32> colors; // Formats of the color attachments
+            bool depth = false;      // With a DF32_SU8 depth attachment
+        };
+
+        struct Pass
+        {
+            // Draws into image: the graph starts a render on it before the pass runs and ends it
+            // after. Color attachments are loaded and depth is cleared, same as startRender.
+            MN_SYMBOL Pass& render(ImageId image);
+
+            // Every attachment of image, used as access
+            MN_SYMBOL Pass& read(ImageId image, Access access = Access::ShaderRead);
+            MN_SYMBOL Pass& write(ImageId image, Access access = Access::ComputeWrite);
+
+            MN_SYMBOL Pass& read(BufferId buffer, Access access);
+            MN_SYMBOL Pass& write(BufferId buffer, Access access);
+
+            // Never culled, for passes whose results leave the graph some other way (a readback)
+            Pass& keep() { kept = true; return *this; }
+
+        private:
+            friend struct RenderGraph;
+
+            struct Use
+            {
+                uint32_t index;
+                Access access;
+                bool write, target;
+            };
+
+            Pass& use(std::vector<Use>& uses, const Use& use);
+
+            std::string name;
+            std::function<void(RenderFrame&)> execute;
+            std::vector<Use> images, buffers;
+            bool kept = false;
+        };
+
+        struct Stats
+        {
+            uint32_t passes = 0, culled = 0, barriers = 0;
+
+            // What the transient images would take on their own, and what they take aliased
+            std::size_t transient_bytes = 0, allocated_bytes = 0;
+        };
+
+        RenderGraph() = default;
+        RenderGraph(const RenderGraph&) = delete;
+        RenderGraph(RenderGraph&&) = delete;
+
+        MN_SYMBOL ~RenderGraph();
+
+        // Forget the last frame's passes and resources, the transient images stay for reuse
+        MN_SYMBOL void reset();
+
+        // Resources from outside the graph. They're expected to arrive with their last writes
+        // visible, and whatever the graph writes to them counts as its output.
+        MN_SYMBOL ImageId import(const std::shared_ptr<Image>& image);
+        MN_SYMBOL BufferId import(const std::shared_ptr<Buffer>& buffer);
+
+        MN_SYMBOL ImageId create(const ImageDesc& desc);
+
+        // The pass is run with the frame the graph is executed on, and its declarations are
+        // made on what this returns, which stays valid until reset
+        MN_SYMBOL Pass& addPass(std::string name, std::function<void(RenderFrame&)> execute);
+
+        // For transients, only valid while the graph is executing, and null if no pass that
+        // runs uses it
+        MN_SYMBOL const std::shared_ptr<Image>& getImage(ImageId image) const;
+
+        // Compile the graph and record its passes into rf, outside of renders and async compute
+        MN_SYMBOL void execute(RenderFrame& rf);
+
+        // The last execute's
+        const Stats& stats() const { return frame_stats; }
+
+    private:
+        struct ImageResource
+        {
+            std::shared_ptr<Image> image; // A transient's is filled in when the graph is compiled
+            std::optional<ImageDesc> desc;
+            std::optional<uint32_t> transient; // Into transients, when a pass that runs uses it
+            uint32_t first, last;              // Positions of the first and last pass using it
+        };
+
+        struct BufferResource
+        {
+            std::shared_ptr<Buffer> buffer;
+        };
+
+        // What decides where the transients go, the images are kept while it stays the same
+        struct Signature
+        {
+            u32 width, height;
+            std::vector<u32> colors;
+            bool depth;
+            bool storage; // Used by compute shaders
+            uint32_t first, last;
+
+            bool operator==(const Signature&) const = default;
+        };
+
+        // The images behind a transient, and the slot each of its attachments (colors, then
+        // depth) is placed in
+        struct Transient
+        {
+            std::shared_ptr<Image> image;
+            std::vector<uint32_t> slots;
+        };
+
+        // Memory transients take turns in. The attachment that was last in it is what the next
+        // one has to wait for, whether that was earlier in the frame or in the frame before.
+        struct Slot
+        {
+            mn::handle_t allocation;
+            const Image::Attachment* occupant;
+        };
+
+        // Passes that have to run, in order
+        std::vector<uint32_t> cull() const;
+
+        // Create the images and memory for signature, unless that's what's there already
+        void place(std::vector<Signature>&& signature);
+
+        // Hand the transients' images and memory over to the deletion queue
+        void release();
+
+        std::deque<Pass> passes;
+        std::vector<ImageResource> images;
+        std::vector<BufferResource> buffers;
+
+        std::vector<Signature> signature;
+        std::vector<Transient> transients;
+        std::vector<Slot> slots;
+        std::vector<mn::handle_t> transient_images;
+        std::size_t transient_bytes = 0, allocated_bytes = 0;
+
+        // Buffers are identified by their VkBuffer and offset, and only remembered from one
+        // frame to the next if they're imported again
+        std::map<std::pair<mn::handle_t, std::size_t>, Backend::BufferUsage> buffer_usage;
+
+        Stats frame_stats;
+    };
+}
@@ -16,7 +16,11 @@ namespace mn::Graphics
 
         std::shared_ptr<Image> get_image() const { return image; }
 
+        // Whether frames started from now on can sample the image
+        bool ready() const;
+
     private:
         std::shared_ptr<Image> image;
+        uint64_t ticket = 0; // Of the upload
     };
 }
\ No newline at end of file
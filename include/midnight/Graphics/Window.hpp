@@ -2,30 +2,66 @@
 
 #include <Def.hpp>
 #include <Math.hpp>
-#include <set>
+
+#include <optional>
 
 #include <Graphics/Backend/Command.hpp>
 #include <Graphics/Backend/Sync.hpp>
+#include <Graphics/Backend/Arena.hpp>
 
 #include "Event.hpp"
 #include "RenderFrame.hpp"
 
+namespace mn::Graphics::Backend
+{
+    struct Device;
+    struct Dispatch;
+}
+
 namespace mn::Graphics
 {
     struct FrameData
     {
-        std::unique_ptr<Backend::CommandBuffer> command_buffer;
-        std::unique_ptr<Backend::CommandPool>   command_pool;
-        std::unique_ptr<Backend::Semaphore> swapchain_sem, render_sem;
-        std::unique_ptr<Backend::Fence> render_fence;
-
-        // Here we can keep a std::vector<std::shared_ptr<void>> resources
-        // Everytime we use something in RenderFrame, we can push it onto this resources
-        // vector. Then, at the beginning of the frame when we wait on the render_fence (or during destruction
-        // of this FrameData object) we can clear it. This way we ensure if the resources used on this render
-        // are deleted elsewhere, they are at least still valid until the end of the render.
-
-        std::set<std::shared_ptr<void>> resources;
+        // Cached so that recording doesn't have to go through the Instance singleton
+        Backend::Device* device = nullptr;
+        const Backend::Dispatch* dispatch = nullptr;
+
+        // The frame's primary command buffer, handed out by command_pool. Both the pool and
+        // the recorders' pools are reset in release() once the GPU has passed ticket.
+        Backend::CommandBuffer* command_buffer = nullptr;
+        std::unique_ptr<Backend::CommandPool> command_pool;
+        std::unique_ptr<Backend::Semaphore> swapchain_sem;
+
+        // Ticket of this frame's last submit on the device's timeline, 0 before the first one
+        Backend::GpuTimeline::Ticket ticket = 0;
+
+        // Scratch memory for this frame, reset in release() once the GPU has passed ticket.
+        // Nothing else is kept alive per frame, resources destroyed while a frame may still
+        // use them go through the device's DeletionQueue instead.
+        std::unique_ptr<Backend::FrameArena> arena;
+
+        // Secondary command buffers for RenderFrame::startParallelRender, grown on demand.
+        // A pool can only be used by one thread at a time, so each worker gets its own.
+        std::vector<std::unique_ptr<Backend::CommandPool>> recorders;
+
+        // Command buffers for RenderFrame::startAsyncCompute, only when the device has a compute queue
+        std::unique_ptr<Backend::CommandPool> compute_pool;
+
+        // What the next submit of command_buffer waits on. The swapchain image is waited on by
+        // the frame's first submit. compute_ticket is the frame's async compute on the device's
+        // compute timeline, waited on at compute_stages, or by the last submit when that's 0.
+        // transfer_ticket is the last upload batch the frame acquired, waited on by the first submit.
+        Handle<Backend::Semaphore> image_acquired;
+        Backend::GpuTimeline::Ticket compute_ticket = 0;
+        Backend::GpuTimeline::Ticket transfer_ticket = 0;
+        uint64_t compute_stages = 0;
+
+        // End command_buffer and submit it with the waits above, ticket is set to what it signals.
+        // The frame's last submit (and nothing else) has last set, see compute_ticket.
+        Backend::GpuTimeline::Ticket submit(bool last, Handle<Backend::Semaphore> render_finished = nullptr);
+
+        // Carry on recording in a fresh command buffer after a submit that wasn't the last
+        void restart();
 
         void release();
 
@@ -33,11 +69,38 @@ namespace mn::Graphics
         void destroy();
     };
 
+    enum class PresentMode
+    {
+        Fifo,        // Vsync, every image is shown. Always supported
+        FifoRelaxed, // Vsync, but a late image is shown right away (may tear)
+        Mailbox,     // Vsync without blocking, newer images replace queued ones
+        Immediate    // No vsync, may tear
+    };
+
+    struct WindowOptions
+    {
+        // How many frames the CPU may record ahead of the GPU. Each one has its own command
+        // buffer, sync objects and scratch arena. More lets the CPU run further ahead,
+        // at the cost of latency.
+        uint32_t frames_in_flight = 2;
+
+        // Falls back to Fifo when the surface doesn't support it
+        PresentMode present_mode = PresentMode::Fifo;
+
+        // Swapchain images, clamped to what the surface allows. 0 picks one more than its minimum
+        uint32_t image_count = 0;
+
+        // When non zero (and the device supports present wait), startFrame blocks until the
+        // frame from this many presents ago is on screen. Keeps input to photon latency bounded
+        // no matter how far ahead the CPU could otherwise get.
+        uint32_t present_latency = 0;
+    };
+
     struct Window
     {
         inline static bool ImGui_Initialized = false;
 
-        MN_SYMBOL Window(const Math::Vec2u& size, const std::string& name);
+        MN_SYMBOL Window(const Math::Vec2u& size, const std::string& name, const WindowOptions& options = {});
         MN_SYMBOL Window(const std::string& config_file = "");
 
         MN_SYMBOL static Window fromLuaScript(const std::string& config_file);
@@ -69,11 +132,18 @@ namespace mn::Graphics
         bool process_imgui_events = true;
 
     private:
-        void construct_swapchain();
+        void construct_swapchain(mn::handle_t old_swapchain = nullptr);
 
-        void _open(const Math::Vec2u& size, const std::string& name);
+        // Replace the swapchain with one that fits the window again. The old one and
+        // everything made for its images is retired through the deletion queue, frames
+        // still in flight keep using them until they're done. Blocks while the window is
+        // minimized, since there's nothing a swapchain could be made for.
+        void recreate_swapchain() const;
 
-        uint32_t next_image_index(std::shared_ptr<FrameData> fd) const;
+        void _open(const Math::Vec2u& size, const std::string& name, const WindowOptions& options);
+
+        // Nothing when the swapchain is out of date and has to be recreated first
+        std::optional<uint32_t> next_image_index(std::shared_ptr<FrameData> fd) const;
         std::shared_ptr<FrameData> get_next_frame() const;
 
         bool _close;
@@ -83,7 +153,23 @@ namespace mn::Graphics
         std::shared_ptr<Image> imgui_surface;
         std::vector<std::shared_ptr<Image>> images;
 
+        // Per swapchain image. The ticket of the frame that last rendered to it, since
+        // acquire can hand back an image that an earlier frame is still drawing into.
+        // And the semaphore presentation waits on, which can't be reused until the image
+        // comes back around.
+        mutable std::vector<Backend::GpuTimeline::Ticket> images_in_flight;
+        std::vector<std::unique_ptr<Backend::Semaphore>> render_sems;
+
         std::vector<std::shared_ptr<FrameData>> frame_data;
+        mutable uint64_t frame_count;
         Math::Vec2u _size;
+
+        WindowOptions options;
+        mutable uint64_t present_id; // Of the last present, for present wait
+        uint64_t first_present_id;   // The first one issued to the current swapchain
+
+        // Set on resize, or when acquire/present says the swapchain no longer matches the
+        // surface. The swapchain is rebuilt at the start of the next frame.
+        mutable bool swapchain_dirty;
     };
 }
\ No newline at end of file
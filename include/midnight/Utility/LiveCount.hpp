@@ -0,0 +1,25 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace mn::Utility
+{
+    // Inherit from LiveCount<T> to keep track of how many T's are currently alive
+    template<typename T>
+    struct LiveCount
+    {
+        LiveCount() { _count.fetch_add(1, std::memory_order_relaxed); }
+        LiveCount(const LiveCount&) { _count.fetch_add(1, std::memory_order_relaxed); }
+        LiveCount(LiveCount&&) { _count.fetch_add(1, std::memory_order_relaxed); }
+        ~LiveCount() { _count.fetch_sub(1, std::memory_order_relaxed); }
+
+        LiveCount& operator=(const LiveCount&) = default;
+        LiveCount& operator=(LiveCount&&) = default;
+
+        static std::size_t live() { return _count.load(std::memory_order_relaxed); }
+
+    private:
+        inline static std::atomic<std::size_t> _count = 0;
+    };
+}
@@ -23,6 +23,14 @@ namespace mn::Utility
             return _instance;
         }
 
+        // Same as get(), without the reference count traffic of copying the shared_ptr.
+        // Don't hold onto the reference across a destroy()
+        inline static T& ref()
+        {
+            if (!_instance) get();
+            return *_instance;
+        }
+
         inline static void destroy()
         {
             _instance.reset();
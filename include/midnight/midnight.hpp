@@ -10,6 +10,7 @@
 #include "./Graphics/Texture.hpp"
 #include "./Graphics/Keyboard.hpp"
 #include "./Graphics/Mouse.hpp"
+#include "./Graphics/MemoryMonitor.hpp"
 
 #include "./Math/Vector.hpp"
 #include "./Math/Matrix.hpp"
\ No newline at end of file
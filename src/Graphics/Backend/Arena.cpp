@@ -0,0 +1,150 @@
+#include <Graphics/Backend/Arena.hpp>
+#include <Graphics/Backend/Instance.hpp>
+#include <Graphics/Backend/Dispatch.hpp>
+
+#include <vulkan/vulkan.h>
+#include <vk_mem_alloc.h>
+
+namespace mn::Graphics::Backend
+{
+
+static std::size_t align_up(std::size_t value, std::size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+FrameArena::FrameArena(std::size_t capacity) :
+    _used(0)
+{
+    // Slices get bound as uniform/storage buffers too, so every offset has to satisfy those limits
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(static_cast<VkPhysicalDevice>(Instance::ref().getDevice()->getPhysicalDevice()), &properties);
+    min_alignment = std::max<std::size_t>({
+        16,
+        properties.limits.minUniformBufferOffsetAlignment,
+        properties.limits.minStorageBufferOffsetAlignment
+    });
+
+    blocks.push_back(create(capacity));
+}
+
+FrameArena::~FrameArena()
+{
+    for (const auto& block : blocks)
+        destroy(block);
+    blocks.clear();
+}
+
+FrameArena::Block FrameArena::create(std::size_t size) const
+{
+    const auto& families = Instance::ref().getDevice()->getSharedFamilies();
+    VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = nullptr,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT  |
+                 VK_BUFFER_USAGE_INDEX_BUFFER_BIT   |
+                 VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT   |
+                 VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR,
+        .sharingMode = ( families.empty() ? VK_SHARING_MODE_EXCLUSIVE : VK_SHARING_MODE_CONCURRENT ),
+        .queueFamilyIndexCount = static_cast<uint32_t>(families.size()),
+        .pQueueFamilyIndices = families.data()
+    };
+
+    // Coherent so that nothing has to be flushed before submitting the frame
+    VmaAllocationCreateInfo alloc_create_info = {
+        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = VMA_MEMORY_USAGE_AUTO,
+        .requiredFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+    };
+
+    auto& instance = Instance::ref();
+    const auto allocator = static_cast<VmaAllocator>(instance.getAllocator());
+    VkBuffer buff;
+    VmaAllocation alloc;
+    VmaAllocationInfo info;
+    const auto err = vmaCreateBuffer(allocator, &buffer_create_info, &alloc_create_info, &buff, &alloc, &info);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error creating frame arena: " << err);
+
+    const auto& device = instance.getDevice();
+    VkBufferDeviceAddressInfoKHR addr_info {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO_KHR,
+        .pNext = nullptr,
+        .buffer = buff
+    };
+
+    const auto address = device->getDispatch().vkGetBufferDeviceAddressKHR(device->getHandle().as<VkDevice>(), &addr_info);
+
+    return Block {
+        .buffer = static_cast<mn::handle_t>(buff),
+        .allocation = static_cast<mn::handle_t>(alloc),
+        .mapped = reinterpret_cast<std::byte*>(info.pMappedData),
+        .address = static_cast<std::uintptr_t>(address),
+        .size = size,
+        .head = 0
+    };
+}
+
+void FrameArena::destroy(const Block& block) const
+{
+    const auto allocator = static_cast<VmaAllocator>(Instance::ref().getAllocator());
+    vmaDestroyBuffer(allocator, static_cast<VkBuffer>(block.buffer), static_cast<VmaAllocation>(block.allocation));
+}
+
+BufferSlice FrameArena::allocate(std::size_t size, std::size_t alignment)
+{
+    MIDNIGHT_ASSERT(size, "Allocating an empty slice");
+    alignment = std::max(alignment, min_alignment);
+    MIDNIGHT_ASSERT(!(alignment & (alignment - 1)), "Alignment must be a power of two");
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto* block = &blocks.back();
+    auto offset = align_up(block->head, alignment);
+    if (offset + size > block->size)
+    {
+        // Chain on a new block, doubling so a frame that keeps growing only does this a few times
+        blocks.push_back(create(std::max(size, block->size * 2)));
+        block = &blocks.back();
+        offset = 0;
+    }
+
+    block->head = offset + size;
+    _used += size;
+
+    return BufferSlice {
+        .data = block->mapped + offset,
+        .buffer = block->buffer,
+        .offset = offset,
+        .size = size,
+        .address = reinterpret_cast<Buffer::gpu_addr>(block->address + offset)
+    };
+}
+
+void FrameArena::reset()
+{
+    // Fold the chained blocks into one that fits everything the last frame needed
+    if (blocks.size() > 1)
+    {
+        const auto total = capacity();
+        for (const auto& block : blocks)
+            destroy(block);
+        blocks.clear();
+        blocks.push_back(create(total));
+    }
+
+    blocks.back().head = 0;
+    _used = 0;
+}
+
+std::size_t FrameArena::capacity() const
+{
+    std::size_t total = 0;
+    for (const auto& block : blocks)
+        total += block.size;
+    return total;
+}
+
+}
@@ -0,0 +1,209 @@
+#include <Graphics/Backend/Barrier.hpp>
+#include <Graphics/Backend/Command.hpp>
+#include <Graphics/Backend/Dispatch.hpp>
+#include <Graphics/RenderFrame.hpp>
+
+#include <vulkan/vulkan.h>
+
+namespace mn::Graphics::Backend
+{
+
+constexpr VkAccessFlags2 WRITE_ACCESS =
+    VK_ACCESS_2_SHADER_WRITE_BIT_KHR                   |
+    VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR           |
+    VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR         |
+    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR |
+    VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR                 |
+    VK_ACCESS_2_HOST_WRITE_BIT_KHR                     |
+    VK_ACCESS_2_MEMORY_WRITE_BIT_KHR;
+
+// Stages a queue without graphics can run
+constexpr VkPipelineStageFlags2 COMPUTE_QUEUE_STAGES =
+    VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR  |
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR |
+    VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR       |
+    VK_PIPELINE_STAGE_2_HOST_BIT_KHR           |
+    VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR;
+
+static VkImageAspectFlags aspect_mask(u32 format)
+{
+    switch (static_cast<VkFormat>(format))
+    {
+    case VK_FORMAT_D16_UNORM:
+    case VK_FORMAT_X8_D24_UNORM_PACK32:
+    case VK_FORMAT_D32_SFLOAT:          return VK_IMAGE_ASPECT_DEPTH_BIT;
+    case VK_FORMAT_D16_UNORM_S8_UINT:
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:  return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    default:                            return VK_IMAGE_ASPECT_COLOR_BIT;
+    }
+}
+
+std::pair<uint64_t, uint64_t> access_scope(Access access)
+{
+    switch (access)
+    {
+    case Access::ComputeRead:     return { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_READ_BIT_KHR };
+    case Access::ComputeWrite:    return { VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_WRITE_BIT_KHR };
+    case Access::ShaderRead:      return { VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT_KHR | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_READ_BIT_KHR };
+    case Access::VertexInput:     return { VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT_KHR, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT_KHR | VK_ACCESS_2_INDEX_READ_BIT_KHR };
+    case Access::IndirectCommand: return { VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT_KHR };
+    case Access::ColorAttachment: return { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT_KHR | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR };
+    case Access::TransferRead:    return { VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_READ_BIT_KHR };
+    case Access::TransferWrite:   return { VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR };
+    case Access::HostRead:        return { VK_PIPELINE_STAGE_2_HOST_BIT_KHR, VK_ACCESS_2_HOST_READ_BIT_KHR };
+    default:                      return { VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR, VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR };
+    }
+}
+
+u32 access_layout(Access access)
+{
+    switch (access)
+    {
+    case Access::ShaderRead:      return VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    case Access::TransferRead:    return VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    case Access::TransferWrite:   return VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    case Access::ComputeRead:
+    case Access::ComputeWrite:
+    case Access::ColorAttachment: return VK_IMAGE_LAYOUT_GENERAL;
+    default:
+        MIDNIGHT_ASSERT(false, "Images can't be used for that access");
+        return VK_IMAGE_LAYOUT_GENERAL;
+    }
+}
+
+std::optional<std::pair<uint64_t, uint64_t>> BarrierBatch::advance(uint64_t& write_stages, uint64_t& write_access, uint64_t& read_stages, uint64_t stages, uint64_t access, bool transition) const
+{
+    const bool write = ( access & WRITE_ACCESS ) || transition;
+
+    // Reads after reads only need the last write to be visible, which it already is at read_stages
+    if (!write && !(stages & ~read_stages))
+        return std::nullopt;
+
+    // A write has to wait for the reads since the last write as well, but only to execute after them
+    auto src_stages = write_stages | ( write ? read_stages : 0 );
+    if (compute_queue && (src_stages & ~COMPUTE_QUEUE_STAGES))
+        src_stages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR;
+    const auto src_access = write_access;
+
+    if (write)
+    {
+        // A transition is a write too, which is visible to the stages it was made for
+        write_stages = stages;
+        write_access = access & WRITE_ACCESS;
+        read_stages = ( access & WRITE_ACCESS ? 0 : stages );
+    }
+    else
+        read_stages |= stages;
+
+    if (compute_queue)
+    {
+        write_stages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR;
+        read_stages = 0;
+    }
+
+    return std::pair(src_stages, src_access);
+}
+
+void BarrierBatch::use(const Image::Attachment& attachment, u32 layout, uint64_t stages, uint64_t access, bool discard)
+{
+    const auto old_layout = ( discard ? VK_IMAGE_LAYOUT_UNDEFINED : attachment.layout );
+    const bool transition = ( old_layout != layout || discard );
+
+    const auto src = advance(attachment.write_stages, attachment.write_access, attachment.read_stages, stages, access, transition);
+    attachment.layout = layout;
+    if (!src) return;
+
+    transitions.push_back(Transition {
+        .image = attachment.handle,
+        .format = attachment.format,
+        .old_layout = old_layout,
+        .new_layout = layout,
+        .src_stages = src->first,
+        .src_access = src->second,
+        .dst_stages = stages,
+        .dst_access = access
+    });
+}
+
+void BarrierBatch::use(BufferUsage& usage, mn::handle_t buffer, std::size_t offset, std::size_t size, uint64_t stages, uint64_t access)
+{
+    const auto src = advance(usage.write_stages, usage.write_access, usage.read_stages, stages, access, false);
+    if (!src) return;
+
+    buffers.push_back(BufferRange {
+        .buffer = buffer,
+        .offset = offset,
+        .size = size,
+        .src_stages = src->first,
+        .src_access = src->second,
+        .dst_stages = stages,
+        .dst_access = access
+    });
+}
+
+void BarrierBatch::record(const Dispatch& vk, const CommandBuffer& cmd)
+{
+    if (empty()) return;
+
+    std::vector<VkImageMemoryBarrier2> barriers;
+    barriers.reserve(transitions.size());
+    for (const auto& t : transitions)
+    {
+        barriers.push_back(VkImageMemoryBarrier2 {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .pNext = nullptr,
+            .srcStageMask = static_cast<VkPipelineStageFlags2>(t.src_stages),
+            .srcAccessMask = static_cast<VkAccessFlags2>(t.src_access),
+            .dstStageMask = static_cast<VkPipelineStageFlags2>(t.dst_stages),
+            .dstAccessMask = static_cast<VkAccessFlags2>(t.dst_access),
+            .oldLayout = static_cast<VkImageLayout>(t.old_layout),
+            .newLayout = static_cast<VkImageLayout>(t.new_layout),
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = static_cast<VkImage>(t.image),
+            .subresourceRange = {
+                .aspectMask = aspect_mask(t.format),
+                .baseMipLevel = 0,
+                .levelCount = VK_REMAINING_MIP_LEVELS,
+                .baseArrayLayer = 0,
+                .layerCount = VK_REMAINING_ARRAY_LAYERS
+            }
+        });
+    }
+    transitions.clear();
+
+    std::vector<VkBufferMemoryBarrier2> buffer_barriers;
+    buffer_barriers.reserve(buffers.size());
+    for (const auto& b : buffers)
+    {
+        buffer_barriers.push_back(VkBufferMemoryBarrier2 {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+            .pNext = nullptr,
+            .srcStageMask = static_cast<VkPipelineStageFlags2>(b.src_stages),
+            .srcAccessMask = static_cast<VkAccessFlags2>(b.src_access),
+            .dstStageMask = static_cast<VkPipelineStageFlags2>(b.dst_stages),
+            .dstAccessMask = static_cast<VkAccessFlags2>(b.dst_access),
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = static_cast<VkBuffer>(b.buffer),
+            .offset = b.offset,
+            .size = b.size
+        });
+    }
+    buffers.clear();
+
+    const VkDependencyInfo dep_info = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .pNext = nullptr,
+        .bufferMemoryBarrierCount = static_cast<uint32_t>(buffer_barriers.size()),
+        .pBufferMemoryBarriers = buffer_barriers.data(),
+        .imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size()),
+        .pImageMemoryBarriers = barriers.data()
+    };
+
+    vk.vkCmdPipelineBarrier2KHR(cmd.getHandle().as<VkCommandBuffer>(), &dep_info);
+    dependencies++;
+}
+
+}
@@ -1,6 +1,8 @@
 #include <Graphics/Backend/Command.hpp>
 #include <Graphics/Backend/Sync.hpp>
 #include <Graphics/Backend/Instance.hpp>
+#include <Graphics/Backend/Dispatch.hpp>
+#include <Graphics/Backend/Barrier.hpp>
 #include <Graphics/Image.hpp>
 #include <Graphics/Buffer.hpp>
 
@@ -9,35 +11,46 @@
 namespace mn::Graphics::Backend
 {
 
-CommandPool::CommandPool()
+CommandPool::CommandPool(QueueType type)
 {
-    auto instance = Instance::get();
-    handle = instance->getDevice()->createCommandPool();
+    handle = Instance::ref().getDevice()->createCommandPool(type);
 }
 
 CommandPool::~CommandPool()
 {
     if (handle)
     {
-        auto instance = Instance::get();
-        instance->getDevice()->destroyCommandPool(handle);
+        Instance::ref().getDevice()->destroyCommandPool(handle);
         handle = nullptr;
     }
 }
 
-void CommandPool::reset() const
+void CommandPool::reset()
 {
-    auto& device = Instance::get()->getDevice();
-    vkResetCommandPool(device->getHandle().as<VkDevice>(), static_cast<VkCommandPool>(handle), VkCommandPoolResetFlagBits::VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT);
+    // Resources are kept, the buffers get recorded again next frame
+    auto& device = Instance::ref().getDevice();
+    const auto err = vkResetCommandPool(device->getHandle().as<VkDevice>(), static_cast<VkCommandPool>(handle), 0);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error resetting command pool: " << err);
+
+    used[0] = used[1] = 0;
+}
+
+CommandBuffer& CommandPool::next(bool secondary)
+{
+    auto& level = buffers[secondary];
+    auto& count = used[secondary];
+    if (count == level.size())
+        level.push_back(allocateBuffer(secondary));
+    return *level[count++];
 }
 
-std::unique_ptr<CommandBuffer> CommandPool::allocateBuffer() const
+std::unique_ptr<CommandBuffer> CommandPool::allocateBuffer(bool secondary) const
 {
-    return std::make_unique<CommandBuffer>(CommandBuffer(handle));
+    return std::make_unique<CommandBuffer>(CommandBuffer(handle, secondary));
 }
 
-CommandBuffer::CommandBuffer(Handle<CommandPool> pool) :
-    handle(Instance::get()->getDevice()->createCommandBuffer(pool))
+CommandBuffer::CommandBuffer(Handle<CommandPool> pool, bool secondary) :
+    handle(Instance::ref().getDevice()->createCommandBuffer(pool, secondary))
 {   }
 
 void CommandBuffer::begin(bool one_time) const
@@ -53,82 +66,67 @@ void CommandBuffer::begin(bool one_time) const
     MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error beginning command buffer: " << err);
 }
 
+void CommandBuffer::beginSecondary(const std::vector<u32>& color_formats, u32 depth_format) const
+{
+    // The formats only have to match the rendering instance, nothing else is inherited.
+    // Renders only ever attach depth, even for depth/stencil formats, so there's no stencil.
+    VkCommandBufferInheritanceRenderingInfoKHR rendering_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR,
+        .pNext = nullptr,
+        .flags = 0,
+        .viewMask = 0,
+        .colorAttachmentCount = static_cast<uint32_t>(color_formats.size()),
+        .pColorAttachmentFormats = reinterpret_cast<const VkFormat*>(color_formats.data()),
+        .depthAttachmentFormat = static_cast<VkFormat>(depth_format),
+        .stencilAttachmentFormat = VK_FORMAT_UNDEFINED,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
+    };
+
+    VkCommandBufferInheritanceInfo inheritance_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext = &rendering_info
+    };
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = nullptr,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritance_info,
+    };
+
+    const auto err = vkBeginCommandBuffer(handle.as<VkCommandBuffer>(), &begin_info);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error beginning secondary command buffer: " << err);
+}
+
 void CommandBuffer::end() const
 {
     const auto err = vkEndCommandBuffer(handle.as<VkCommandBuffer>());
     MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error ending command buffer: " << err);
 }
 
-void CommandBuffer::reset() const
+GpuTimeline::Ticket CommandBuffer::submit() const
 {
-    const auto err = vkResetCommandBuffer(handle.as<VkCommandBuffer>(), 0);
-    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error reseting command buffer: " << err);
+    return Instance::ref().getDevice()->submit(*this);
 }
 
-void CommandBuffer::submit(std::shared_ptr<Fence> fence) const
+CommandBuffer CommandBuffer::adopt(Handle<CommandBuffer> buffer)
 {
-    auto& device = Instance::get()->getDevice();
-
-    const auto buffer = handle.as<VkCommandBuffer>();
-    VkSubmitInfo submit{};
-    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit.pNext = nullptr;
-    submit.commandBufferCount = 1;
-    submit.pCommandBuffers = &buffer;
-
-    const auto err = vkQueueSubmit(
-        static_cast<VkQueue>(device->getGraphicsQueue().handle),
-        1, 
-        &submit, 
-        fence->getHandle().as<VkFence>()
-    );
-    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error immediately submitting command buffer");
+    CommandBuffer cmd;
+    cmd.handle = buffer;
+    return cmd;
 }
 
-// Should make this a function in Backend::Device, it's copied from RenderFrame.cpp
-void __transition_image(VkCommandBuffer cmd, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout)
-{
-    VkImageAspectFlags aspectMask = (new_layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) ? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
-    VkImageMemoryBarrier2 image_barrier = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-        .pNext = nullptr,
-        .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-        .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
-        .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-        .dstAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_MEMORY_READ_BIT,
-        .oldLayout = old_layout,
-        .newLayout = new_layout,
-        .image = image,
-        .subresourceRange = [](VkImageAspectFlags aspectMask)
-            {
-                return VkImageSubresourceRange {
-                    .aspectMask = aspectMask,
-                    .baseMipLevel = 0,
-                    .levelCount = VK_REMAINING_MIP_LEVELS,
-                    .baseArrayLayer = 0,
-                    .layerCount = VK_REMAINING_ARRAY_LAYERS
-                };
-            }(aspectMask)
-    };
-
-    VkDependencyInfo dep_info = {
-        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-        .pNext = nullptr,
-        .imageMemoryBarrierCount = 1,
-        .pImageMemoryBarriers = &image_barrier
-    };
-    
-    auto& device = Backend::Instance::get()->getDevice();
-    PFN_vkVoidFunction pVkCmdPipelineBarrier2KHR = vkGetDeviceProcAddr(device->getHandle().as<VkDevice>(), "vkCmdPipelineBarrier2KHR");
-    ((PFN_vkCmdPipelineBarrier2KHR)(pVkCmdPipelineBarrier2KHR ))(cmd, &dep_info);
-};
-
 void CommandBuffer::bufferToImage(std::shared_ptr<Buffer> buffer, const Image::Attachment& image) const
 {
-    __transition_image(static_cast<VkCommandBuffer>(handle), static_cast<VkImage>(image.handle), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    const auto& vk = Instance::ref().getDevice()->getDispatch();
+
+    // The whole attachment is overwritten
+    BarrierBatch batch;
+    batch.use(image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, true);
+    batch.record(vk, *this);
 
     VkBufferImageCopy copyRegion = {};
-    copyRegion.bufferOffset = 0;
+    copyRegion.bufferOffset = buffer->getOffset();
     copyRegion.bufferRowLength = 0;
     copyRegion.bufferImageHeight = 0;
 
@@ -138,7 +136,7 @@ void CommandBuffer::bufferToImage(std::shared_ptr<Buffer> buffer, const Image::A
     copyRegion.imageSubresource.layerCount = 1;
     copyRegion.imageExtent = { .width = Math::x(image.size), .height = Math::y(image.size), .depth = 1 };
 
-    vkCmdCopyBufferToImage(
+    vk.vkCmdCopyBufferToImage(
         handle.as<VkCommandBuffer>(), 
         buffer->getHandle().as<VkBuffer>(), 
         static_cast<VkImage>(image.handle), 
@@ -147,7 +145,12 @@ void CommandBuffer::bufferToImage(std::shared_ptr<Buffer> buffer, const Image::A
 		&copyRegion
     );
 
-    __transition_image(static_cast<VkCommandBuffer>(handle), static_cast<VkImage>(image.handle), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    batch.use(
+        image,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT_KHR | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR,
+        VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR);
+    batch.record(vk, *this);
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include <Graphics/Backend/Deletion.hpp>
+
+#include <iterator>
+
+namespace mn::Graphics::Backend
+{
+
+DeletionQueue::DeletionQueue(const GpuTimeline& t) :
+    timeline(t)
+{   }
+
+DeletionQueue::~DeletionQueue()
+{
+    flush();
+}
+
+void DeletionQueue::push(std::function<void()> release)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    open.push_back(std::move(release));
+}
+
+void DeletionQueue::seal(GpuTimeline::Ticket ticket)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (open.empty()) return;
+
+    sealed.push_back(Entry{ ticket, std::move(open) });
+    open.clear();
+}
+
+void DeletionQueue::collect()
+{
+    std::vector<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (!sealed.empty() && timeline.reached(sealed.front().ticket))
+        {
+            auto& releases = sealed.front().releases;
+            std::move(releases.begin(), releases.end(), std::back_inserter(ready));
+            sealed.pop_front();
+        }
+    }
+
+    // Outside the lock, a release can drop the last reference to something that pushes again
+    for (const auto& release : ready)
+        release();
+}
+
+void DeletionQueue::flush()
+{
+    // Releases can push more releases (a pool freeing the buffers it owned), keep going until it's empty
+    while (true)
+    {
+        std::vector<std::function<void()>> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& entry : sealed)
+                std::move(entry.releases.begin(), entry.releases.end(), std::back_inserter(ready));
+            sealed.clear();
+
+            std::move(open.begin(), open.end(), std::back_inserter(ready));
+            open.clear();
+        }
+
+        if (ready.empty()) break;
+        for (const auto& release : ready)
+            release();
+    }
+}
+
+}
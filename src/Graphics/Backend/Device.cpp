@@ -1,9 +1,19 @@
 #include <Graphics/Backend/Device.hpp>
 #include <Graphics/Backend/Instance.hpp>
 #include <Graphics/Backend/Sync.hpp>
+#include <Graphics/Backend/Command.hpp>
+#include <Graphics/Backend/Staging.hpp>
+#include <Graphics/Backend/Pool.hpp>
+#include <Graphics/Backend/Dispatch.hpp>
+#include <Graphics/Backend/Relocatable.hpp>
+#include <Graphics/Backend/Deletion.hpp>
+#include <Graphics/Backend/Readback.hpp>
+#include <Graphics/Backend/Upload.hpp>
 
 #include <Graphics/Window.hpp>
 #include <Graphics/Image.hpp>
+#include <Graphics/Buffer.hpp>
+#include <Graphics/Descriptor.hpp>
 
 #include <vulkan/vulkan.h>
 #include <vk_mem_alloc.h>
@@ -11,49 +21,148 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_vulkan.h>
 
+#include <optional>
+#include <algorithm>
+
 namespace mn::Graphics::Backend
 {
 
+void Dispatch::load(VkDevice device)
+{
+    const auto load = [device]<typename F>(F& function, const char* name)
+    {
+        function = reinterpret_cast<F>(vkGetDeviceProcAddr(device, name));
+        MIDNIGHT_ASSERT(function, "Error loading device function " << name);
+    };
+
+    load(vkCmdPipelineBarrier2KHR, "vkCmdPipelineBarrier2KHR");
+    load(vkQueueSubmit2KHR,        "vkQueueSubmit2KHR");
+
+    load(vkGetSemaphoreCounterValueKHR, "vkGetSemaphoreCounterValueKHR");
+    load(vkWaitSemaphoresKHR,           "vkWaitSemaphoresKHR");
+
+    load(vkCmdBeginRenderingKHR, "vkCmdBeginRenderingKHR");
+    load(vkCmdEndRenderingKHR,   "vkCmdEndRenderingKHR");
+
+    load(vkGetBufferDeviceAddressKHR, "vkGetBufferDeviceAddressKHR");
+
+    // Optional, stays null unless the device was created with it
+    vkWaitForPresentKHR = reinterpret_cast<PFN_vkWaitForPresentKHR>(vkGetDeviceProcAddr(device, "vkWaitForPresentKHR"));
+
+    load(vkCmdBindPipeline,       "vkCmdBindPipeline");
+    load(vkCmdBindDescriptorSets, "vkCmdBindDescriptorSets");
+    load(vkCmdBindVertexBuffers,  "vkCmdBindVertexBuffers");
+    load(vkCmdBindIndexBuffer,    "vkCmdBindIndexBuffer");
+    load(vkCmdPushConstants,      "vkCmdPushConstants");
+    load(vkCmdSetViewport,        "vkCmdSetViewport");
+    load(vkCmdSetScissor,         "vkCmdSetScissor");
+    load(vkCmdDraw,               "vkCmdDraw");
+    load(vkCmdDrawIndexed,        "vkCmdDrawIndexed");
+    load(vkCmdDispatch,           "vkCmdDispatch");
+    load(vkCmdDispatchIndirect,   "vkCmdDispatchIndirect");
+    load(vkCmdCopyBuffer,         "vkCmdCopyBuffer");
+    load(vkCmdCopyImage,          "vkCmdCopyImage");
+    load(vkCmdCopyImageToBuffer,  "vkCmdCopyImageToBuffer");
+    load(vkCmdCopyBufferToImage,  "vkCmdCopyBufferToImage");
+    load(vkCmdClearColorImage,    "vkCmdClearColorImage");
+    load(vkCmdBlitImage,          "vkCmdBlitImage");
+    load(vkCmdPipelineBarrier,    "vkCmdPipelineBarrier");
+    load(vkCmdExecuteCommands,    "vkCmdExecuteCommands");
+}
+
+constexpr std::size_t STAGING_RING_SIZE = 32 * 1024 * 1024;
+constexpr std::size_t POOL_BLOCK_SIZE = 32 * 1024 * 1024;
+constexpr std::size_t POOL_MAX_ALLOCATION = 4 * 1024 * 1024;
+
 Device::Device(Handle<Instance> _instance, handle_t p_device) :
+    imgui_pool{nullptr},
     physical_device(p_device),
-    imgui_pool{nullptr}
+    graphics_submitted(0),
+    immediate_pool(nullptr),
+    defragmentation(nullptr),
+    defragmentation_allocator(nullptr),
+    memory_budget(false),
+    swapchain_support(false),
+    present_wait(false),
+    frame_index(0)
 {
     const auto instance = _instance.as<VkInstance>();
     MIDNIGHT_ASSERT(instance, "Device requires a valid instance");
 
-    const auto graphics_index = [](const VkPhysicalDevice& device)
+    const auto queue_families = [](const VkPhysicalDevice& device)
     {
-        const auto queue_families = [](const VkPhysicalDevice& device)
+        uint32_t count;
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &count, nullptr);
+        std::vector<VkQueueFamilyProperties> props(count);
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &count, props.data());
+        return props;
+    }(static_cast<VkPhysicalDevice>(p_device));
+
+    uint32_t graphics_index = 9999;
+    for (uint32_t i = 0; i < queue_families.size(); i++)
+        if (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+        {
+            graphics_index = i;
+            break;
+        }
+
+    // Prefer a transfer only family (the DMA engine), then any without graphics
+    const auto transfer_index = [&]()
+    {
+        std::optional<uint32_t> fallback;
+        for (uint32_t i = 0; i < queue_families.size(); i++)
         {
-            uint32_t count;
-            vkGetPhysicalDeviceQueueFamilyProperties(device, &count, nullptr);
-            std::vector<VkQueueFamilyProperties> props(count);
-            vkGetPhysicalDeviceQueueFamilyProperties(device, &count, props.data());
-            return props;
-        }(device);
-
-        uint32_t graphics_index = 9999;
+            const auto flags = queue_families[i].queueFlags;
+            if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT)) continue;
+            if (!(flags & VK_QUEUE_COMPUTE_BIT)) return i;
+            if (!fallback) fallback = i;
+        }
+        return fallback.value_or(graphics_index);
+    }();
+
+    // Async compute wants a compute family without graphics, preferably not the one transfers went to
+    const auto compute_index = [&]()
+    {
+        std::optional<uint32_t> fallback;
         for (uint32_t i = 0; i < queue_families.size(); i++)
-            if (queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+        {
+            const auto flags = queue_families[i].queueFlags;
+            if (!(flags & VK_QUEUE_COMPUTE_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT)) continue;
+            if (i != transfer_index) return i;
+            if (!fallback) fallback = i;
+        }
+        return fallback.value_or(graphics_index);
+    }();
+
+    // One create info per family. A family asked for twice gets a second queue if it has one,
+    // otherwise both share its first queue. Returns the queue index within the family.
+    const float priorities[] = { 1.f, 1.f };
+    std::vector<VkDeviceQueueCreateInfo> queue_creates;
+    const auto request_queue = [&](uint32_t family) -> uint32_t
+    {
+        for (auto& create : queue_creates)
+            if (create.queueFamilyIndex == family)
             {
-                graphics_index = i;
-                break;
+                if (create.queueCount < std::min(queue_families[family].queueCount, 2u))
+                    create.queueCount++;
+                return create.queueCount - 1;
             }
-        
-        return graphics_index;
-    }(static_cast<VkPhysicalDevice>(p_device));
 
-    float priority = 1.f;
-    VkDeviceQueueCreateInfo queue_create = {
-        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-        .pNext = nullptr,
-        .queueFamilyIndex = graphics_index,
-        .queueCount = 1,
-        .pQueuePriorities = &priority
+        queue_creates.push_back(VkDeviceQueueCreateInfo {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .pNext = nullptr,
+            .queueFamilyIndex = family,
+            .queueCount = 1,
+            .pQueuePriorities = priorities
+        });
+        return 0;
     };
+    request_queue(graphics_index);
+    const auto transfer_queue = ( transfer_index != graphics_index ? request_queue(transfer_index) : 0 );
+    const auto compute_queue  = ( compute_index  != graphics_index ? request_queue(compute_index)  : 0 );
 
     // Get the necessary device extension names
-    const auto extensions = [](const VkPhysicalDevice& p_device)
+    const auto extensions = [this, instance](const VkPhysicalDevice& p_device)
     {
         std::vector<const char*> enabledExtensions;
         std::vector<const char*> requiredExtensions = { 
@@ -63,7 +172,7 @@ Device::Device(Handle<Instance> _instance, handle_t p_device) :
             VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME, 
             VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME, 
             VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME, 
-            VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+            VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
             VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
             VK_KHR_DEVICE_GROUP_EXTENSION_NAME,
             VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
@@ -93,12 +202,75 @@ Device::Device(Handle<Instance> _instance, handle_t p_device) :
             enabledExtensions.push_back(required);
         }
 
+        // Nice to have, but we can do without
+        for (const auto& ext : extensions)
+            if (!strcmp(ext.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+            {
+                enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+                memory_budget = true;
+            }
+
+        // Only a Window needs it, rendering headless works without
+        for (const auto& ext : extensions)
+            if (!strcmp(ext.extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME))
+            {
+                enabledExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+                swapchain_support = true;
+            }
+
+        // Lets the Window bound its latency by waiting for presents to reach the screen.
+        // Both extensions and both features have to be there.
+        bool present_id = false, present_wait_ext = false;
+        for (const auto& ext : extensions)
+        {
+            if (!strcmp(ext.extensionName, VK_KHR_PRESENT_ID_EXTENSION_NAME))   present_id = true;
+            if (!strcmp(ext.extensionName, VK_KHR_PRESENT_WAIT_EXTENSION_NAME)) present_wait_ext = true;
+        }
+
+        const auto get_features = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(
+            vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR"));
+        if (swapchain_support && present_id && present_wait_ext && get_features)
+        {
+            VkPhysicalDevicePresentWaitFeaturesKHR wait_features = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+                .pNext = nullptr
+            };
+            VkPhysicalDevicePresentIdFeaturesKHR id_features = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+                .pNext = &wait_features
+            };
+            VkPhysicalDeviceFeatures2KHR features = {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR,
+                .pNext = &id_features
+            };
+            get_features(p_device, &features);
+
+            present_wait = id_features.presentId && wait_features.presentWait;
+            if (present_wait)
+            {
+                enabledExtensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+                enabledExtensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+            }
+        }
+
         return enabledExtensions;
     }(static_cast<VkPhysicalDevice>(p_device));
 
+    VkPhysicalDevicePresentWaitFeaturesKHR present_wait_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+        .pNext = nullptr,
+        .presentWait = VK_TRUE
+    };
+
+    VkPhysicalDevicePresentIdFeaturesKHR present_id_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+        .pNext = &present_wait_features,
+        .presentId = VK_TRUE
+    };
+
     VkPhysicalDeviceDescriptorIndexingFeatures indexing_features = 
     {
-        .pNext = nullptr,
+        .pNext = ( present_wait ? &present_id_features : nullptr ),
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
         .descriptorBindingSampledImageUpdateAfterBind = true,
         .descriptorBindingUpdateUnusedWhilePending = true,
@@ -112,9 +284,15 @@ Device::Device(Handle<Instance> _instance, handle_t p_device) :
         .dynamicRendering = VK_TRUE
     };
 
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+        .pNext = &dynamic_render,
+        .timelineSemaphore = VK_TRUE
+    };
+
     VkPhysicalDeviceSynchronization2Features sync = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES,
-        .pNext = &dynamic_render,
+        .pNext = &timeline_features,
         .synchronization2 = VK_TRUE
     };
 
@@ -134,8 +312,8 @@ Device::Device(Handle<Instance> _instance, handle_t p_device) :
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .pNext = &buffer_device,
         .flags = 0,
-        .queueCreateInfoCount = 1,
-        .pQueueCreateInfos = &queue_create,
+        .queueCreateInfoCount = static_cast<uint32_t>(queue_creates.size()),
+        .pQueueCreateInfos = queue_creates.data(),
         .enabledLayerCount = 0,
         .ppEnabledLayerNames = nullptr,
         .enabledExtensionCount   = static_cast<uint32_t>(extensions.size()),
@@ -150,6 +328,14 @@ Device::Device(Handle<Instance> _instance, handle_t p_device) :
     std::cout << "Successfully created device\n";
     handle = _device;
 
+    dispatch = std::make_unique<Dispatch>();
+    dispatch->load(_device);
+
+    timeline = std::make_unique<GpuTimeline>(*this);
+    transfer_timeline = std::make_unique<GpuTimeline>(*this);
+    compute_timeline = std::make_unique<GpuTimeline>(*this);
+    deletion = std::make_unique<DeletionQueue>(*timeline);
+
     VkQueue _gq;
     vkGetDeviceQueue(_device, graphics_index, 0, &_gq);
     graphics = Queue {
@@ -157,6 +343,36 @@ Device::Device(Handle<Instance> _instance, handle_t p_device) :
         .index  = graphics_index
     };
 
+    transfer = graphics;
+    if (transfer_index != graphics_index)
+    {
+        VkQueue _tq;
+        vkGetDeviceQueue(_device, transfer_index, transfer_queue, &_tq);
+        transfer = Queue {
+            .handle = _tq,
+            .index  = transfer_index
+        };
+        std::cout << "Using transfer queue family " << transfer_index << "\n";
+    }
+
+    compute = graphics;
+    if (compute_index != graphics_index)
+    {
+        VkQueue _cq;
+        vkGetDeviceQueue(_device, compute_index, compute_queue, &_cq);
+        compute = Queue {
+            .handle = _cq,
+            .index  = compute_index
+        };
+        std::cout << "Using async compute queue family " << compute_index << "\n";
+
+        // Compute results are read by graphics (and uploads land in them), so rather than
+        // an ownership transfer per resource and per frame everything is shared concurrently
+        for (const auto family : { graphics_index, transfer_index, compute_index })
+            if (std::find(shared_families.begin(), shared_families.end(), family) == shared_families.end())
+                shared_families.push_back(family);
+    }
+
     // Create Samplers
     VkSampler sample;
     VkSamplerCreateInfo sampler_create_info{};
@@ -178,12 +394,19 @@ Device::Device(Handle<Instance> _instance, handle_t p_device) :
 
 Device::~Device()
 {
+    releaseMemory();
+
     for (const auto& [ type, sampler ] : samplers)
         vkDestroySampler(handle.as<VkDevice>(), static_cast<VkSampler>(sampler->handle), nullptr);
 
     if (imgui_pool)
         vkDestroyDescriptorPool(handle.as<VkDevice>(), static_cast<VkDescriptorPool>(imgui_pool), nullptr);
 
+    deletion.reset();
+    compute_timeline.reset();
+    transfer_timeline.reset();
+    timeline.reset();
+
     if (handle)
     {
         vkDestroyDevice(handle.as<VkDevice>(), nullptr);
@@ -191,10 +414,26 @@ Device::~Device()
     }
 }
 
+Math::Vec2u Device::getSurfaceExtent(Handle<Window> window, handle_t surface) const
+{
+    VkSurfaceCapabilitiesKHR capabilities;
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(static_cast<VkPhysicalDevice>(physical_device), static_cast<VkSurfaceKHR>(surface), &capabilities);
+
+    // The surface leaves it to the swapchain, which goes by the window
+    if (capabilities.currentExtent.width == 0xFFFFFFFF)
+    {
+        int w, h;
+        SDL_GetWindowSize(window.as<SDL_Window*>(), &w, &h);
+        return Math::Vec2u{ static_cast<uint32_t>(std::max(w, 0)), static_cast<uint32_t>(std::max(h, 0)) };
+    }
+    return Math::Vec2u{ capabilities.currentExtent.width, capabilities.currentExtent.height };
+}
+
 std::tuple<handle_t, std::vector<handle_t>, uint32_t, Math::Vec2u> 
-Device::createSwapchain(Handle<Window> window, handle_t surface) const
+Device::createSwapchain(Handle<Window> window, handle_t surface, PresentMode mode, uint32_t requested_count, handle_t old_swapchain) const
 {
     MIDNIGHT_ASSERT(handle, "Device invalid");
+    MIDNIGHT_ASSERT(swapchain_support, "Device doesn't support swapchains, only headless rendering");
     auto* win = window.as<SDL_Window*>();
     const auto  p_device   = static_cast<VkPhysicalDevice>(physical_device);
     const auto  vk_surface = static_cast<VkSurfaceKHR>(surface); 
@@ -223,29 +462,60 @@ Device::createSwapchain(Handle<Window> window, handle_t surface) const
             std::clamp(static_cast<uint32_t>(h), c.minImageExtent.height, c.maxImageExtent.height)
         );
     }();
+    MIDNIGHT_ASSERT(w > 0 && h > 0, "Can't create a swapchain for a zero sized surface");
 
-    uint32_t image_count = capabilities.minImageCount + 1;
+    uint32_t image_count = ( requested_count ? requested_count : capabilities.minImageCount + 1 );
+    image_count = std::max(image_count, capabilities.minImageCount);
     if (capabilities.maxImageCount > 0 && image_count > capabilities.maxImageCount)
         image_count = capabilities.maxImageCount;
 
+    const auto present_mode = [p_device, vk_surface, mode]()
+    {
+        uint32_t count;
+        vkGetPhysicalDeviceSurfacePresentModesKHR(p_device, vk_surface, &count, nullptr);
+        std::vector<VkPresentModeKHR> modes(count);
+        vkGetPhysicalDeviceSurfacePresentModesKHR(p_device, vk_surface, &count, modes.data());
+
+        const auto wanted = [mode]()
+        {
+            switch (mode)
+            {
+            case PresentMode::FifoRelaxed: return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+            case PresentMode::Mailbox:     return VK_PRESENT_MODE_MAILBOX_KHR;
+            case PresentMode::Immediate:   return VK_PRESENT_MODE_IMMEDIATE_KHR;
+            default:                       return VK_PRESENT_MODE_FIFO_KHR;
+            }
+        }();
+
+        if (std::find(modes.begin(), modes.end(), wanted) != modes.end())
+            return wanted;
+
+        std::cout << "Present mode " << wanted << " not supported by the surface, falling back to FIFO\n";
+        return VK_PRESENT_MODE_FIFO_KHR;
+    }();
+
+    // Reading the swapchain back copies out of it, which not every surface allows
+    const VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+        (capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+
     VkSwapchainCreateInfoKHR create_info = {
         .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
         .pNext = nullptr,
         .flags = 0,
         .surface = vk_surface,
-        .minImageCount = capabilities.minImageCount,
+        .minImageCount = image_count,
         .imageFormat = surfaceFormats[0].format,
         .imageColorSpace = surfaceFormats[0].colorSpace,
         .imageExtent = VkExtent2D{ .width = w, .height = h },
         .imageArrayLayers = 1,
-        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        .imageUsage = usage,
         .queueFamilyIndexCount = 1,
         .pQueueFamilyIndices = &graphics.index,
         .preTransform = capabilities.currentTransform,
         .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-        .presentMode = VK_PRESENT_MODE_FIFO_KHR,
+        .presentMode = present_mode,
         .clipped = VK_TRUE,
-        .oldSwapchain = nullptr
+        .oldSwapchain = static_cast<VkSwapchainKHR>(old_swapchain)
     };
 
     VkSwapchainKHR swapchain;
@@ -256,7 +526,8 @@ Device::createSwapchain(Handle<Window> window, handle_t surface) const
         static_cast<handle_t>(swapchain), 
         getSwapchainImages(swapchain), 
         static_cast<uint32_t>(surfaceFormats[0].format), 
-        Math::Vec2u{ w, h });
+        Math::Vec2u{ w, h },
+        static_cast<uint32_t>(usage));
 }
 
 std::vector<handle_t> Device::getSwapchainImages(handle_t swapchain) const
@@ -277,9 +548,23 @@ void Device::destroySwapchain(handle_t swapchain) const
     vkDestroySwapchainKHR(handle.as<VkDevice>(), static_cast<VkSwapchainKHR>(swapchain), nullptr);
 }
 
-std::pair<Handle<Image>, mn::handle_t> Device::createImage(const Math::Vec2u& size, uint32_t format, bool depth) const
+static VkImageUsageFlags image_usage(VkPhysicalDevice physical_device, uint32_t format, bool depth, bool storage)
+{
+    // Only asked for by what compute writes into, storage keeps drivers from compressing the image
+    if (storage)
+    {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physical_device, static_cast<VkFormat>(format), &properties);
+        MIDNIGHT_ASSERT(!depth && (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT), "Format " << format << " can't be used as a storage image");
+    }
+
+    return VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | static_cast<VkImageUsageFlags>(depth ? (VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) : VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT) |
+        static_cast<VkImageUsageFlags>(storage ? VK_IMAGE_USAGE_STORAGE_BIT : 0);
+}
+
+static VkImageCreateInfo image_create_info(VkPhysicalDevice physical_device, const std::vector<uint32_t>& families, const Math::Vec2u& size, uint32_t format, bool depth, bool storage)
 {
-    VkImageCreateInfo create_info = {
+    return VkImageCreateInfo {
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
         .pNext = nullptr,
         .flags = 0,
@@ -290,15 +575,28 @@ std::pair<Handle<Image>, mn::handle_t> Device::createImage(const Math::Vec2u& si
         .arrayLayers = 1,
         .samples = VK_SAMPLE_COUNT_1_BIT,
         .tiling = VK_IMAGE_TILING_OPTIMAL,
-        .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | static_cast<VkImageUsageFlags>(depth ? (VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) : VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT),
+        .usage = image_usage(physical_device, format, depth, storage),
+        .sharingMode = ( families.empty() ? VK_SHARING_MODE_EXCLUSIVE : VK_SHARING_MODE_CONCURRENT ),
+        .queueFamilyIndexCount = static_cast<uint32_t>(families.size()),
+        .pQueueFamilyIndices = families.data()
     };
+}
+
+uint32_t Device::getImageUsage(uint32_t format, bool depth, bool storage) const
+{
+    return image_usage(static_cast<VkPhysicalDevice>(physical_device), format, depth, storage);
+}
+
+std::pair<Handle<Image>, mn::handle_t> Device::createImage(const Math::Vec2u& size, uint32_t format, bool depth, bool storage) const
+{
+    const auto create_info = image_create_info(static_cast<VkPhysicalDevice>(physical_device), shared_families, size, format, depth, storage);
 
     VmaAllocationCreateInfo alloc_create_info = {
         .usage = VMA_MEMORY_USAGE_GPU_ONLY,
         .requiredFlags = static_cast<VkMemoryPropertyFlags>(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
     }; 
 
-    const auto allocator = static_cast<VmaAllocator>(Instance::get()->getAllocator());
+    const auto allocator = static_cast<VmaAllocator>(Instance::ref().getAllocator());
 
     VkImage _image;
     VmaAllocation _alloc;
@@ -308,9 +606,28 @@ std::pair<Handle<Image>, mn::handle_t> Device::createImage(const Math::Vec2u& si
     return std::pair(Handle<Image>(_image), static_cast<mn::handle_t>(_alloc));
 }
 
+Handle<Image> Device::createUnboundImage(const Math::Vec2u& size, uint32_t format, bool depth, bool storage) const
+{
+    const auto create_info = image_create_info(static_cast<VkPhysicalDevice>(physical_device), shared_families, size, format, depth, storage);
+
+    VkImage _image;
+    const auto err = vkCreateImage(handle.as<VkDevice>(), &create_info, nullptr, &_image);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error creating image: " << err);
+    return Handle<Image>(_image);
+}
+
+Handle<Image> Device::bindImage(const Math::Vec2u& size, uint32_t format, bool depth, bool storage, mn::handle_t alloc) const
+{
+    const auto image = createUnboundImage(size, format, depth, storage);
+
+    const auto err = vmaBindImageMemory(static_cast<VmaAllocator>(Instance::ref().getAllocator()), static_cast<VmaAllocation>(alloc), image.as<VkImage>());
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error binding image memory: " << err);
+    return image;
+}
+
 void Device::destroyImage(Handle<Image> image, mn::handle_t alloc) const
 {
-    const auto allocator = static_cast<VmaAllocator>(Instance::get()->getAllocator());
+    const auto allocator = static_cast<VmaAllocator>(Instance::ref().getAllocator());
     vmaDestroyImage(allocator, image.as<VkImage>(), static_cast<VmaAllocation>(alloc));
 }
 
@@ -350,15 +667,26 @@ void Device::destroyImageView(handle_t image_view) const
     vkDestroyImageView(handle.as<VkDevice>(), static_cast<VkImageView>(image_view), nullptr);
 }
 
-Handle<CommandPool> Device::createCommandPool() const
+Handle<CommandPool> Device::createCommandPool(QueueType type) const
 {
     MIDNIGHT_ASSERT(handle, "Invalid device");
 
+    const auto family = [&]()
+    {
+        switch (type)
+        {
+        case QueueType::Transfer: return transfer.index;
+        case QueueType::Compute:  return compute.index;
+        default:                  return graphics.index;
+        }
+    }();
+
     VkCommandPoolCreateInfo create_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
         .pNext = nullptr,
-        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-        .queueFamilyIndex = graphics.index
+        // No per buffer reset, pools are always reset as a whole
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = family
     };
 
     VkCommandPool pool;
@@ -374,35 +702,263 @@ void Device::destroyCommandPool(Handle<CommandPool> pool) const
     vkDestroyCommandPool(handle.as<VkDevice>(), pool.as<VkCommandPool>(), nullptr);
 }
 
-void Device::immediateSubmit(std::function<void(Backend::CommandBuffer&)> func) const
+GpuTimeline::Ticket Device::immediateSubmit(std::function<void(Backend::CommandBuffer&)> func, GpuTimeline::Ticket transfer_ticket) const
 {
-    Backend::Fence f;
-    f.reset();
-    Backend::CommandPool pool;
+    // The pool isn't thread safe, so recording is serialized along with the submit
+    std::lock_guard<std::mutex> lock(immediate_mutex);
+    if (!immediate_pool)
+    {
+        immediate_pool = createCommandPool();
+        immediate_buffer = std::make_unique<CommandBuffer>(CommandBuffer::adopt(createCommandBuffer(immediate_pool)));
+    }
 
-    auto cmd = pool.allocateBuffer();
-    cmd->begin();
-    func(*cmd);
-    cmd->end();
+    // The last submit was waited on, so the buffer is free to record again
+    vkResetCommandPool(handle.as<VkDevice>(), immediate_pool.as<VkCommandPool>(), 0);
 
-    const auto buffer = cmd->getHandle().as<VkCommandBuffer>();
-    VkSubmitInfo submit{};
-    submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submit.pNext = nullptr;
-    submit.commandBufferCount = 1;
-    submit.pCommandBuffers = &buffer;
+    immediate_buffer->begin();
+    func(*immediate_buffer);
+    immediate_buffer->end();
 
-    const auto err = vkQueueSubmit(
-        static_cast<VkQueue>(graphics.handle),
-        1, 
-        &submit, 
-        f.getHandle().as<VkFence>()
-    );
-    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error immediately submitting command buffer");
-    f.wait();
+    const auto ticket = submit(*immediate_buffer, nullptr, nullptr, 0, 0, transfer_ticket);
+    timeline->wait(ticket);
+    return ticket;
+}
+
+std::mutex& Device::queue_lock(const Queue& queue) const
+{
+    if (queue.handle == graphics.handle) return queue_mutex;
+    if (queue.handle == transfer.handle) return transfer_mutex;
+    return compute_mutex;
 }
 
-Handle<CommandBuffer> Device::createCommandBuffer(Handle<CommandPool> command_pool) const
+GpuTimeline::Ticket Device::submit(const CommandBuffer& cmd, Handle<Semaphore> image_acquired, Handle<Semaphore> render_finished,
+    GpuTimeline::Ticket compute_ticket, uint64_t compute_stages, GpuTimeline::Ticket transfer_ticket) const
+{
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    const auto ticket = timeline->advance();
+
+    VkCommandBufferSubmitInfo cmd_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+        .pNext = nullptr,
+        .commandBuffer = cmd.getHandle().as<VkCommandBuffer>(),
+        .deviceMask = 0
+    };
+
+    VkSemaphoreSubmitInfo wait_infos[3];
+    uint32_t wait_count = 0;
+    if (image_acquired)
+    {
+        wait_infos[wait_count++] = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .pNext = nullptr,
+            .semaphore = image_acquired.as<VkSemaphore>(),
+            .value = 0,
+            .stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
+            .deviceIndex = 0
+        };
+    }
+
+    if (transfer_ticket)
+    {
+        wait_infos[wait_count++] = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .pNext = nullptr,
+            .semaphore = transfer_timeline->getHandle().as<VkSemaphore>(),
+            .value = transfer_ticket,
+            .stageMask = static_cast<VkPipelineStageFlags2>(UploadEngine::consumerStages()),
+            .deviceIndex = 0
+        };
+    }
+
+    if (compute_ticket)
+    {
+        wait_infos[wait_count++] = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .pNext = nullptr,
+            .semaphore = compute_timeline->getHandle().as<VkSemaphore>(),
+            .value = compute_ticket,
+            .stageMask = static_cast<VkPipelineStageFlags2>(compute_stages),
+            .deviceIndex = 0
+        };
+    }
+
+    VkSemaphoreSubmitInfo signal_infos[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .pNext = nullptr,
+            .semaphore = timeline->getHandle().as<VkSemaphore>(),
+            .value = ticket,
+            .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .deviceIndex = 0
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .pNext = nullptr,
+            .semaphore = render_finished.as<VkSemaphore>(),
+            .value = 0,
+            .stageMask = VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT,
+            .deviceIndex = 0
+        }
+    };
+
+    VkSubmitInfo2 submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .pNext = nullptr,
+        .flags = 0,
+        .waitSemaphoreInfoCount = wait_count,
+        .pWaitSemaphoreInfos = wait_infos,
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = &cmd_info,
+        .signalSemaphoreInfoCount = ( render_finished ? 2u : 1u ),
+        .pSignalSemaphoreInfos = signal_infos
+    };
+
+    const auto err = dispatch->vkQueueSubmit2KHR(static_cast<VkQueue>(graphics.handle), 1, &submit_info, VK_NULL_HANDLE);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error submitting command buffer: " << err);
+
+    // Stored only once it's submitted. A transfer waiting on a ticket that's merely reserved
+    // could be waited on by the very submission that signals it.
+    graphics_submitted.store(ticket);
+    return ticket;
+}
+
+GpuTimeline::Ticket Device::submitTransfer(const CommandBuffer& cmd, GpuTimeline::Ticket graphics_ticket) const
+{
+    std::lock_guard<std::mutex> lock(queue_lock(transfer));
+    const auto ticket = transfer_timeline->advance();
+
+    VkCommandBufferSubmitInfo cmd_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+        .pNext = nullptr,
+        .commandBuffer = cmd.getHandle().as<VkCommandBuffer>(),
+        .deviceMask = 0
+    };
+
+    // Once the timeline is past it there's nothing to wait for
+    const bool wait = ( graphics_ticket && !timeline->reached(graphics_ticket) );
+    VkSemaphoreSubmitInfo wait_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .pNext = nullptr,
+        .semaphore = timeline->getHandle().as<VkSemaphore>(),
+        .value = graphics_ticket,
+        .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        .deviceIndex = 0
+    };
+
+    VkSemaphoreSubmitInfo signal_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .pNext = nullptr,
+        .semaphore = transfer_timeline->getHandle().as<VkSemaphore>(),
+        .value = ticket,
+        .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        .deviceIndex = 0
+    };
+
+    VkSubmitInfo2 submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .pNext = nullptr,
+        .flags = 0,
+        .waitSemaphoreInfoCount = ( wait ? 1u : 0u ),
+        .pWaitSemaphoreInfos = &wait_info,
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = &cmd_info,
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos = &signal_info
+    };
+
+    const auto err = dispatch->vkQueueSubmit2KHR(static_cast<VkQueue>(transfer.handle), 1, &submit_info, VK_NULL_HANDLE);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error submitting transfer command buffer: " << err);
+    return ticket;
+}
+
+GpuTimeline::Ticket Device::submitCompute(const CommandBuffer& cmd, GpuTimeline::Ticket graphics_ticket) const
+{
+    MIDNIGHT_ASSERT(hasComputeQueue(), "No async compute queue, compute has to be recorded with the graphics work");
+
+    std::lock_guard<std::mutex> lock(queue_lock(compute));
+    const auto ticket = compute_timeline->advance();
+
+    VkCommandBufferSubmitInfo cmd_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+        .pNext = nullptr,
+        .commandBuffer = cmd.getHandle().as<VkCommandBuffer>(),
+        .deviceMask = 0
+    };
+
+    // A timeline value can be waited on as soon as its signal has been submitted,
+    // so this never has to wait on the CPU for the graphics queue
+    VkSemaphoreSubmitInfo wait_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .pNext = nullptr,
+        .semaphore = timeline->getHandle().as<VkSemaphore>(),
+        .value = graphics_ticket,
+        .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        .deviceIndex = 0
+    };
+
+    VkSemaphoreSubmitInfo signal_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .pNext = nullptr,
+        .semaphore = compute_timeline->getHandle().as<VkSemaphore>(),
+        .value = ticket,
+        .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        .deviceIndex = 0
+    };
+
+    VkSubmitInfo2 submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .pNext = nullptr,
+        .flags = 0,
+        .waitSemaphoreInfoCount = ( graphics_ticket ? 1u : 0u ),
+        .pWaitSemaphoreInfos = &wait_info,
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = &cmd_info,
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos = &signal_info
+    };
+
+    const auto err = dispatch->vkQueueSubmit2KHR(static_cast<VkQueue>(compute.handle), 1, &submit_info, VK_NULL_HANDLE);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error submitting compute command buffer: " << err);
+    return ticket;
+}
+
+int32_t Device::present(mn::handle_t swapchain, uint32_t image_index, Handle<Semaphore> wait, uint64_t present_id) const
+{
+    const auto _swapchain = static_cast<VkSwapchainKHR>(swapchain);
+    const auto _semaphore = wait.as<VkSemaphore>();
+
+    VkPresentIdKHR id_info = {
+        .sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR,
+        .pNext = nullptr,
+        .swapchainCount = 1,
+        .pPresentIds = &present_id
+    };
+
+    VkPresentInfoKHR present_info = {
+        .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+        .pNext = ( present_wait && present_id ? &id_info : nullptr ),
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &_semaphore,
+        .swapchainCount = 1,
+        .pSwapchains = &_swapchain,
+        .pImageIndices = &image_index,
+        .pResults = nullptr
+    };
+
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return vkQueuePresentKHR(static_cast<VkQueue>(graphics.handle), &present_info);
+}
+
+bool Device::waitForPresent(mn::handle_t swapchain, uint64_t present_id, uint64_t timeout) const
+{
+    if (!present_wait || !present_id) return true;
+
+    const auto err = dispatch->vkWaitForPresentKHR(handle.as<VkDevice>(), static_cast<VkSwapchainKHR>(swapchain), present_id, timeout);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS || err == VK_TIMEOUT || err == VK_ERROR_OUT_OF_DATE_KHR || err == VK_SUBOPTIMAL_KHR, "Error waiting for present: " << err);
+    return err != VK_TIMEOUT;
+}
+
+Handle<CommandBuffer> Device::createCommandBuffer(Handle<CommandPool> command_pool, bool secondary) const
 {
     MIDNIGHT_ASSERT(handle, "Invalid device");
 
@@ -410,7 +966,7 @@ Handle<CommandBuffer> Device::createCommandBuffer(Handle<CommandPool> command_po
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
         .pNext = nullptr,
         .commandPool = static_cast<VkCommandPool>(command_pool),
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .level = ( secondary ? VK_COMMAND_BUFFER_LEVEL_SECONDARY : VK_COMMAND_BUFFER_LEVEL_PRIMARY ),
         .commandBufferCount = 1
     };
 
@@ -498,6 +1054,250 @@ std::shared_ptr<Sampler> Device::getSampler(Sampler::Type type)
     return samplers[type];
 }
 
+StagingRing& Device::getStagingRing()
+{
+    if (!staging)
+        staging = std::make_unique<StagingRing>(*this, Instance::ref().getAllocator(), STAGING_RING_SIZE);
+    return *staging;
+}
+
+BufferPool& Device::getBufferPool()
+{
+    if (!pool)
+        pool = std::make_unique<BufferPool>(*this, Instance::ref().getAllocator(), POOL_BLOCK_SIZE, POOL_MAX_ALLOCATION);
+    return *pool;
+}
+
+ReadbackQueue& Device::getReadbackQueue()
+{
+    if (!readback)
+        readback = std::make_unique<ReadbackQueue>(*this, Instance::ref().getAllocator());
+    return *readback;
+}
+
+UploadEngine& Device::getUploadEngine()
+{
+    if (!uploads)
+        uploads = std::make_unique<UploadEngine>(*this, Instance::ref().getAllocator());
+    return *uploads;
+}
+
+MemoryStats Device::memoryStats() const
+{
+    const auto allocator = static_cast<VmaAllocator>(Instance::ref().getAllocator());
+
+    VmaTotalStatistics total;
+    vmaCalculateStatistics(allocator, &total);
+
+    const VkPhysicalDeviceMemoryProperties* properties;
+    vmaGetMemoryProperties(allocator, &properties);
+
+    std::vector<VmaBudget> budgets(properties->memoryHeapCount);
+    vmaGetHeapBudgets(allocator, budgets.data());
+
+    MemoryStats stats = {
+        .block_bytes = total.total.statistics.blockBytes,
+        .allocation_bytes = total.total.statistics.allocationBytes,
+        .block_count = total.total.statistics.blockCount,
+        .allocation_count = total.total.statistics.allocationCount,
+        .unused_range_count = total.total.unusedRangeCount,
+        .largest_unused_range = ( total.total.unusedRangeCount ? total.total.unusedRangeSizeMax : 0 ),
+        .buffers = Graphics::Buffer::live(),
+        .images = Graphics::Image::live(),
+        .descriptors = Graphics::Descriptor::live(),
+        .driver_budget = memory_budget
+    };
+
+    for (uint32_t i = 0; i < properties->memoryHeapCount; i++)
+        stats.heaps.push_back(MemoryStats::Heap {
+            .size = properties->memoryHeaps[i].size,
+            .budget = budgets[i].budget,
+            .usage = budgets[i].usage,
+            .block_bytes = budgets[i].statistics.blockBytes,
+            .allocation_bytes = budgets[i].statistics.allocationBytes,
+            .block_count = budgets[i].statistics.blockCount,
+            .allocation_count = budgets[i].statistics.allocationCount,
+            .device_local = static_cast<bool>(properties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+        });
+
+    return stats;
+}
+
+void Device::nextFrame()
+{
+    vmaSetCurrentFrameIndex(static_cast<VmaAllocator>(Instance::ref().getAllocator()), ++frame_index);
+}
+
+void Device::beginDefragmentation(std::size_t max_bytes_per_pass, uint32_t max_allocations_per_pass)
+{
+    if (defragmentation) return;
+
+    VmaDefragmentationInfo info = {
+        .flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT,
+        .pool = nullptr,
+        .maxBytesPerPass = max_bytes_per_pass,
+        .maxAllocationsPerPass = max_allocations_per_pass
+    };
+
+    const auto allocator = Instance::ref().getAllocator();
+
+    VmaDefragmentationContext context;
+    const auto err = vmaBeginDefragmentation(static_cast<VmaAllocator>(allocator), &info, &context);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error starting defragmentation: " << err);
+    defragmentation = static_cast<mn::handle_t>(context);
+    defragmentation_allocator = allocator;
+}
+
+void Device::end_defragmentation()
+{
+    if (!defragmentation) return;
+
+    vmaEndDefragmentation(static_cast<VmaAllocator>(defragmentation_allocator), static_cast<VmaDefragmentationContext>(defragmentation), nullptr);
+    defragmentation = nullptr;
+    defragmentation_allocator = nullptr;
+}
+
+static std::size_t block_bytes(VmaAllocator allocator)
+{
+    const VkPhysicalDeviceMemoryProperties* properties;
+    vmaGetMemoryProperties(allocator, &properties);
+
+    std::vector<VmaBudget> budgets(properties->memoryHeapCount);
+    vmaGetHeapBudgets(allocator, budgets.data());
+
+    std::size_t total = 0;
+    for (const auto& budget : budgets)
+        total += budget.statistics.blockBytes;
+    return total;
+}
+
+DefragmentationPass Device::defragmentStep()
+{
+    MIDNIGHT_ASSERT(defragmentation, "No defragmentation in progress, call beginDefragmentation() first");
+
+    const auto allocator = static_cast<VmaAllocator>(Instance::ref().getAllocator());
+    const auto context = static_cast<VmaDefragmentationContext>(defragmentation);
+
+    // Queued staging copies and frames still in flight can reference anything we're about to move
+    if (staging) staging->flush();
+    if (uploads) uploads->flush();
+    waitForIdle();
+
+    DefragmentationPass result = {
+        .bytes_moved = 0,
+        .bytes_reclaimed = 0,
+        .allocations_moved = 0,
+        .allocations_skipped = 0,
+        .finished = false
+    };
+
+    const auto before = block_bytes(allocator);
+
+    VmaDefragmentationPassMoveInfo pass;
+    auto err = vmaBeginDefragmentationPass(allocator, context, &pass);
+    if (err == VK_SUCCESS)
+    {
+        // Nothing left to move
+        end_defragmentation();
+        result.finished = true;
+        return result;
+    }
+    MIDNIGHT_ASSERT(err == VK_INCOMPLETE, "Error starting defragmentation pass: " << err);
+
+    struct Moved
+    {
+        Relocatable* owner;
+        mn::handle_t allocation, resource;
+    };
+    std::vector<Moved> moved;
+
+    immediateSubmit([&](CommandBuffer& cmd)
+    {
+        const auto command_buffer = cmd.getHandle().as<VkCommandBuffer>();
+        const auto barrier = [&](VkPipelineStageFlags src_stage, VkAccessFlags src_access, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access)
+        {
+            VkMemoryBarrier memory_barrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .pNext = nullptr,
+                .srcAccessMask = src_access,
+                .dstAccessMask = dst_access
+            };
+            dispatch->vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+        };
+
+        barrier(
+            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_WRITE_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,     VK_ACCESS_TRANSFER_READ_BIT);
+
+        for (uint32_t i = 0; i < pass.moveCount; i++)
+        {
+            auto& move = pass.pMoves[i];
+
+            VmaAllocationInfo info;
+            vmaGetAllocationInfo(allocator, move.srcAllocation, &info);
+
+            auto* owner = static_cast<Relocatable*>(info.pUserData);
+            if (!owner)
+            {
+                move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+                result.allocations_skipped++;
+                continue;
+            }
+
+            const auto allocation = static_cast<mn::handle_t>(move.srcAllocation);
+            const auto resource = owner->relocate(allocation, static_cast<mn::handle_t>(move.dstTmpAllocation), cmd);
+            moved.push_back(Moved{ owner, allocation, resource });
+
+            result.bytes_moved += info.size;
+            result.allocations_moved++;
+        }
+
+        barrier(
+            VK_PIPELINE_STAGE_TRANSFER_BIT,     VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT);
+    });
+
+    // The copies have finished, after this the source allocations refer to the new memory
+    err = vmaEndDefragmentationPass(allocator, context, &pass);
+    for (const auto& m : moved)
+        m.owner->relocated(m.allocation, m.resource);
+
+    const auto after = block_bytes(allocator);
+    result.bytes_reclaimed = ( before > after ? before - after : 0 );
+
+    // If everything VMA asked for was ignored it would keep asking for the same moves
+    if (err == VK_SUCCESS || moved.empty())
+    {
+        end_defragmentation();
+        result.finished = true;
+    }
+
+    return result;
+}
+
+void Device::releaseMemory()
+{
+    end_defragmentation();
+
+    // Uploads can hold the last reference to their destinations, whose releases are queued
+    uploads.reset();
+
+    // Queued releases free buffers into the pool, so they have to run before it goes
+    if (deletion) deletion->flush();
+
+    if (immediate_pool)
+    {
+        immediate_buffer.reset();
+        destroyCommandPool(immediate_pool);
+        immediate_pool = nullptr;
+    }
+
+    // Resolves whatever readbacks were still in flight
+    readback.reset();
+    staging.reset();
+    pool.reset();
+}
+
 void Device::waitForIdle() const
 {
     vkDeviceWaitIdle(handle.as<VkDevice>());
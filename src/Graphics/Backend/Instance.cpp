@@ -69,6 +69,31 @@ Instance::Instance()
         VK_KHR_DEVICE_GROUP_CREATION_EXTENSION_NAME
     };
 
+    // Presentation is nice to have, a HeadlessTarget (e.g. on a software driver in CI)
+    // doesn't need any of it. Only what the loader actually offers gets enabled.
+    const auto available_extensions = []()
+    {
+        uint32_t count;
+        vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
+        std::vector<VkExtensionProperties> props(count);
+        vkEnumerateInstanceExtensionProperties(nullptr, &count, props.data());
+        return props;
+    }();
+
+    std::erase_if(enabled_extensions, [&](const char* name)
+    {
+        for (const auto& ext : available_extensions)
+            if (!strcmp(ext.extensionName, name))
+                return false;
+
+        std::cout << "Instance extension " << name << " not supported\n";
+        return true;
+    });
+
+    // The flag is only valid alongside the extension
+    if (std::find_if(enabled_extensions.begin(), enabled_extensions.end(), [](const char* name){ return !strcmp(name, VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME); }) == enabled_extensions.end())
+        create_info.flags = 0;
+
     create_info.enabledExtensionCount   = static_cast<uint32_t>(enabled_extensions.size());
     create_info.ppEnabledExtensionNames = enabled_extensions.data();
 
@@ -148,7 +173,8 @@ Instance::Instance()
     device = std::make_unique<Device>(handle, physical_devices[0]);
 
     VmaAllocatorCreateInfo alloc_create_info = {
-        .flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT,
+        .flags = static_cast<VmaAllocatorCreateFlags>(VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT | 
+            ( device->hasMemoryBudget() ? VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT : 0 )),
         .physicalDevice = physical_devices[0],
         .device = device->getHandle().as<VkDevice>(),
         .instance = instance
@@ -169,6 +195,8 @@ Instance::~Instance()
 {
     if (handle)
     {
+        device->waitForIdle();
+        device->releaseMemory();
         vmaDestroyAllocator(static_cast<VmaAllocator>(allocator));
         allocator = nullptr;
         device.reset();
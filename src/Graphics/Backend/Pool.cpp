@@ -0,0 +1,164 @@
+#include <Graphics/Backend/Pool.hpp>
+#include <Graphics/Backend/Device.hpp>
+
+#include <vulkan/vulkan.h>
+#include <vk_mem_alloc.h>
+
+namespace mn::Graphics::Backend
+{
+
+BufferPool::BufferPool(const Device& device, mn::handle_t alloc, std::size_t size, std::size_t max) :
+    allocator(alloc),
+    block_size(size),
+    max_allocation(max),
+    families(device.getSharedFamilies())
+{
+    MIDNIGHT_ASSERT(max_allocation <= block_size, "Pooled allocations must fit inside a block");
+
+    // Simpler to satisfy all the offset limits than to work out which ones a block's usage needs
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(static_cast<VkPhysicalDevice>(device.getPhysicalDevice()), &properties);
+    alignment = std::max<std::size_t>({
+        16,
+        properties.limits.minUniformBufferOffsetAlignment,
+        properties.limits.minStorageBufferOffsetAlignment
+    });
+}
+
+BufferPool::~BufferPool()
+{
+    for (auto& block : blocks)
+        destroy(block);
+    blocks.clear();
+}
+
+uint32_t BufferPool::create(Graphics::Buffer::Memory memory, u32 usage)
+{
+    VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = nullptr,
+        .size = block_size,
+        .usage = static_cast<VkBufferUsageFlags>(usage),
+        .sharingMode = ( families.empty() ? VK_SHARING_MODE_EXCLUSIVE : VK_SHARING_MODE_CONCURRENT ),
+        .queueFamilyIndexCount = static_cast<uint32_t>(families.size()),
+        .pQueueFamilyIndices = families.data()
+    };
+
+    const auto alloc_create_info = ( memory == Graphics::Buffer::Memory::HostVisible ?
+        VmaAllocationCreateInfo {
+            .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+            .usage = VMA_MEMORY_USAGE_AUTO
+        } :
+        VmaAllocationCreateInfo {
+            .flags = 0,
+            .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+        }
+    );
+
+    VkBuffer buff;
+    VmaAllocation alloc;
+    VmaAllocationInfo info;
+    auto err = vmaCreateBuffer(static_cast<VmaAllocator>(allocator), &buffer_create_info, &alloc_create_info, &buff, &alloc, &info);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error creating pool block: " << err);
+
+    VmaVirtualBlockCreateInfo virtual_create_info = {
+        .size = block_size
+    };
+
+    VmaVirtualBlock virtual_block;
+    err = vmaCreateVirtualBlock(&virtual_create_info, &virtual_block);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error creating virtual block: " << err);
+
+    const auto block = Block {
+        .buffer = static_cast<mn::handle_t>(buff),
+        .allocation = static_cast<mn::handle_t>(alloc),
+        .virtual_block = static_cast<mn::handle_t>(virtual_block),
+        .mapped = reinterpret_cast<std::byte*>(info.pMappedData),
+        .memory = memory,
+        .usage = usage,
+        .live = 0
+    };
+
+    // Reuse the slot of a block that was given back, so indices stay stable
+    for (uint32_t i = 0; i < blocks.size(); i++)
+        if (!blocks[i].buffer)
+        {
+            blocks[i] = block;
+            return i;
+        }
+
+    blocks.push_back(block);
+    return static_cast<uint32_t>(blocks.size() - 1);
+}
+
+void BufferPool::destroy(Block& block) const
+{
+    if (!block.buffer) return;
+
+    // Anything still allocated out of the block is leaked by its Buffer, VMA would assert on it
+    vmaClearVirtualBlock(static_cast<VmaVirtualBlock>(block.virtual_block));
+    vmaDestroyVirtualBlock(static_cast<VmaVirtualBlock>(block.virtual_block));
+    vmaDestroyBuffer(static_cast<VmaAllocator>(allocator), static_cast<VkBuffer>(block.buffer), static_cast<VmaAllocation>(block.allocation));
+    block = Block{ nullptr, nullptr, nullptr, nullptr, block.memory, block.usage, 0 };
+}
+
+std::optional<BufferPool::Range> BufferPool::allocate_from(uint32_t index, std::size_t size)
+{
+    auto& block = blocks[index];
+
+    VmaVirtualAllocationCreateInfo create_info = {
+        .size = size,
+        .alignment = alignment
+    };
+
+    VmaVirtualAllocation allocation;
+    VkDeviceSize offset;
+    if (vmaVirtualAllocate(static_cast<VmaVirtualBlock>(block.virtual_block), &create_info, &allocation, &offset) != VK_SUCCESS)
+        return std::nullopt;
+
+    block.live++;
+    return Range {
+        .buffer = block.buffer,
+        .allocation = static_cast<mn::handle_t>(allocation),
+        .mapped = ( block.mapped ? block.mapped + offset : nullptr ),
+        .offset = static_cast<std::size_t>(offset),
+        .block = index
+    };
+}
+
+std::optional<BufferPool::Range> BufferPool::allocate(Graphics::Buffer::Memory memory, u32 usage, std::size_t size)
+{
+    if (!size || size > max_allocation) return std::nullopt;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t i = 0; i < blocks.size(); i++)
+        if (blocks[i].buffer && blocks[i].memory == memory && blocks[i].usage == usage)
+            if (auto range = allocate_from(i, size))
+                return range;
+
+    auto range = allocate_from(create(memory, usage), size);
+    MIDNIGHT_ASSERT(range, "Pooled allocation doesn't fit in an empty block");
+    return range;
+}
+
+void BufferPool::free(const Range& range)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    MIDNIGHT_ASSERT(range.block < blocks.size() && blocks[range.block].buffer == range.buffer, "Freeing a range that isn't from this pool");
+
+    auto& block = blocks[range.block];
+    vmaVirtualFree(static_cast<VmaVirtualBlock>(block.virtual_block), static_cast<VmaVirtualAllocation>(range.allocation));
+    block.live--;
+
+    // Keep one block of each kind around, give the rest back once they empty out
+    if (!block.live)
+    {
+        const auto spare = std::any_of(blocks.begin(), blocks.end(), [&](const Block& b)
+        {
+            return &b != &block && b.buffer && b.memory == block.memory && b.usage == block.usage;
+        });
+        if (spare) destroy(block);
+    }
+}
+
+}
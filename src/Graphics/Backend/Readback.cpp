@@ -0,0 +1,229 @@
+#include <Graphics/Backend/Readback.hpp>
+#include <Graphics/Backend/Device.hpp>
+#include <Graphics/Backend/Command.hpp>
+#include <Graphics/Backend/Dispatch.hpp>
+#include <Graphics/Backend/Barrier.hpp>
+
+#include <vulkan/vulkan.h>
+#include <vk_mem_alloc.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+namespace mn::Graphics::Backend
+{
+
+static std::size_t pixel_size(u32 format)
+{
+    switch (static_cast<VkFormat>(format))
+    {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_UNORM:      return 4;
+    case VK_FORMAT_R16G16B16A16_SFLOAT: return 8;
+    default:
+        MIDNIGHT_ASSERT(false, "Readback of format " << format << " isn't supported");
+        return 0;
+    }
+}
+
+ReadbackQueue::ReadbackQueue(const Device& d, mn::handle_t alloc) :
+    device(d),
+    allocator(alloc),
+    stop(false)
+{   }
+
+ReadbackQueue::~ReadbackQueue()
+{
+    // Sealed readbacks are still resolved (the device is idle by now, so that's quick),
+    // unsealed ones were never submitted and their futures are left broken
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    if (worker.joinable()) worker.join();
+
+    for (const auto& request : open)
+        destroy(request.staging);
+    open.clear();
+
+    for (const auto& staging : free)
+        destroy(staging);
+    free.clear();
+}
+
+ReadbackQueue::Staging ReadbackQueue::acquire(std::size_t size)
+{
+    // Smallest free buffer that's big enough
+    auto best = free.end();
+    for (auto it = free.begin(); it != free.end(); it++)
+        if (it->size >= size && (best == free.end() || it->size < best->size))
+            best = it;
+
+    if (best != free.end())
+    {
+        const auto staging = *best;
+        free.erase(best);
+        return staging;
+    }
+
+    VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = nullptr,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT
+    };
+
+    // Cached memory, the CPU reads every byte of it
+    VmaAllocationCreateInfo alloc_create_info = {
+        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = VMA_MEMORY_USAGE_AUTO
+    };
+
+    VkBuffer buff;
+    VmaAllocation alloc;
+    VmaAllocationInfo info;
+    const auto err = vmaCreateBuffer(static_cast<VmaAllocator>(allocator), &buffer_create_info, &alloc_create_info, &buff, &alloc, &info);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error creating readback buffer: " << err);
+
+    return Staging {
+        .buffer = static_cast<mn::handle_t>(buff),
+        .allocation = static_cast<mn::handle_t>(alloc),
+        .mapped = reinterpret_cast<std::byte*>(info.pMappedData),
+        .size = size
+    };
+}
+
+void ReadbackQueue::destroy(const Staging& staging) const
+{
+    vmaDestroyBuffer(static_cast<VmaAllocator>(allocator), static_cast<VkBuffer>(staging.buffer), static_cast<VmaAllocation>(staging.allocation));
+}
+
+std::future<ReadbackResult> ReadbackQueue::record(const CommandBuffer& cmd, const Image::Attachment& attachment, const std::filesystem::path& png)
+{
+    // Anything the worker can't handle is turned down here, on the thread asking for it
+    MIDNIGHT_ASSERT(attachment.layout != VK_IMAGE_LAYOUT_UNDEFINED, "Reading back an attachment that hasn't been rendered to");
+    MIDNIGHT_ASSERT(attachment.usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT, "Attachment can't be copied from (a swapchain on a surface that doesn't allow it)");
+    const auto bytes = pixel_size(attachment.format);
+    MIDNIGHT_ASSERT(png.empty() || bytes == 4, "Only 8 bit formats can be written to a PNG");
+
+    const auto& size = attachment.size;
+    const auto data_size = Math::x(size) * Math::y(size) * bytes;
+
+    Request request;
+    request.size = size;
+    request.format = attachment.format;
+    request.pixel_size = bytes;
+    request.png = png;
+    auto future = request.promise.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        request.staging = acquire(data_size);
+        if (!worker.joinable())
+            worker = std::thread([this]() { run(); });
+    }
+
+    const auto& vk = device.getDispatch();
+
+    // The attachment stays in the transfer layout, its next use moves it on from there
+    BarrierBatch before;
+    before.use(attachment, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_READ_BIT_KHR);
+    before.record(vk, cmd);
+
+    const VkBufferImageCopy region = {
+        .bufferOffset = 0,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        },
+        .imageOffset = { 0, 0, 0 },
+        .imageExtent = { Math::x(size), Math::y(size), 1 }
+    };
+    vk.vkCmdCopyImageToBuffer(cmd.getHandle().as<VkCommandBuffer>(), static_cast<VkImage>(attachment.handle), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, static_cast<VkBuffer>(request.staging.buffer), 1, &region);
+
+    // Make the copy visible to the host
+    BufferUsage copied = {
+        .write_stages = VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
+        .write_access = VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR
+    };
+    BarrierBatch after;
+    after.use(copied, request.staging.buffer, 0, data_size, VK_PIPELINE_STAGE_2_HOST_BIT_KHR, VK_ACCESS_2_HOST_READ_BIT_KHR);
+    after.record(vk, cmd);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    open.push_back(std::move(request));
+    return future;
+}
+
+void ReadbackQueue::seal(GpuTimeline::Ticket ticket)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (open.empty()) return;
+
+        for (auto& request : open)
+        {
+            request.ticket = ticket;
+            sealed.push_back(std::move(request));
+        }
+        open.clear();
+    }
+    wake.notify_one();
+}
+
+void ReadbackQueue::run()
+{
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this]() { return stop || !sealed.empty(); });
+        if (sealed.empty()) return;
+
+        auto request = std::move(sealed.front());
+        sealed.pop_front();
+        lock.unlock();
+
+        // Tickets complete in order, so waiting on the oldest first never holds up a later one
+        device.getTimeline().wait(request.ticket);
+        resolve(request);
+
+        lock.lock();
+        free.push_back(request.staging);
+    }
+}
+
+void ReadbackQueue::resolve(Request& request) const
+{
+    const auto bytes = Math::x(request.size) * Math::y(request.size) * request.pixel_size;
+    vmaInvalidateAllocation(static_cast<VmaAllocator>(allocator), static_cast<VmaAllocation>(request.staging.allocation), 0, bytes);
+
+    ReadbackResult result = {
+        .size = request.size,
+        .format = request.format,
+        .pixel_size = request.pixel_size,
+        .pixels = std::vector<std::byte>(request.staging.mapped, request.staging.mapped + bytes)
+    };
+
+    if (!request.png.empty())
+    {
+        // stb wants RGBA
+        auto rgba = result.pixels;
+        if (request.format == VK_FORMAT_B8G8R8A8_UNORM)
+            for (std::size_t i = 0; i < rgba.size(); i += 4)
+                std::swap(rgba[i], rgba[i + 2]);
+
+        const auto w = static_cast<int>(Math::x(request.size));
+        const auto h = static_cast<int>(Math::y(request.size));
+        if (!stbi_write_png(request.png.string().c_str(), w, h, 4, rgba.data(), w * 4))
+            std::cout << "Error writing readback to " << request.png << "\n";
+    }
+
+    request.promise.set_value(std::move(result));
+}
+
+}
@@ -0,0 +1,362 @@
+#include <Graphics/Backend/Staging.hpp>
+#include <Graphics/Backend/Device.hpp>
+#include <Graphics/Backend/Command.hpp>
+#include <Graphics/Backend/Sync.hpp>
+#include <Graphics/Backend/Dispatch.hpp>
+
+#include <vulkan/vulkan.h>
+#include <vk_mem_alloc.h>
+
+namespace mn::Graphics::Backend
+{
+
+constexpr std::size_t STAGING_ALIGNMENT = 16;
+
+static std::size_t align_up(std::size_t value, std::size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+StagingRing::StagingRing(const Device& d, mn::handle_t alloc, std::size_t capacity) :
+    device(d),
+    allocator(alloc),
+    ring{ nullptr, nullptr },
+    mapped(nullptr),
+    _capacity(capacity),
+    head(0)
+{   }
+
+StagingRing::~StagingRing()
+{
+    for (const auto& batch : batches)
+    {
+        for (const auto& a : batch.garbage)
+            destroy(a);
+        for (const auto& release : batch.deferred)
+            release();
+    }
+    batches.clear();
+
+    if (ring.buffer) destroy(ring);
+    ring = { nullptr, nullptr };
+    mapped = nullptr;
+}
+
+void StagingRing::create()
+{
+    VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = nullptr,
+        .size = _capacity,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+    };
+
+    VmaAllocationCreateInfo alloc_create_info = {
+        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = VMA_MEMORY_USAGE_AUTO
+    };
+
+    VkBuffer buff;
+    VmaAllocation alloc;
+    VmaAllocationInfo info;
+    const auto err = vmaCreateBuffer(static_cast<VmaAllocator>(allocator), &buffer_create_info, &alloc_create_info, &buff, &alloc, &info);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error creating staging ring: " << err);
+
+    ring   = { static_cast<mn::handle_t>(buff), static_cast<mn::handle_t>(alloc) };
+    mapped = reinterpret_cast<std::byte*>(info.pMappedData);
+    head   = 0;
+}
+
+void StagingRing::destroy(const Allocation& a) const
+{
+    vmaDestroyBuffer(static_cast<VmaAllocator>(allocator), static_cast<VkBuffer>(a.buffer), static_cast<VmaAllocation>(a.allocation));
+}
+
+StagingRing::Batch& StagingRing::open_batch()
+{
+    if (batches.empty() || batches.back().recorded)
+        batches.emplace_back();
+    return batches.back();
+}
+
+std::optional<std::size_t> StagingRing::try_fit(std::size_t size)
+{
+    const auto oldest = [&]() -> std::optional<std::size_t>
+    {
+        for (const auto& batch : batches)
+            if (batch.begin) return batch.begin;
+        return std::nullopt;
+    }();
+
+    // Nothing in the ring is live, start over from the beginning
+    if (!oldest)
+    {
+        head = size;
+        return 0;
+    }
+
+    const auto aligned = align_up(head, STAGING_ALIGNMENT);
+
+    // Live region is [oldest, head), so we can use [head, capacity) or wrap into [0, oldest)
+    // The comparisons against oldest are strict so that head == oldest always means "empty"
+    if (*oldest <= head)
+    {
+        if (aligned + size <= _capacity)
+        {
+            head = aligned + size;
+            return aligned;
+        }
+
+        if (size < *oldest)
+        {
+            head = size;
+            return 0;
+        }
+
+        return std::nullopt;
+    }
+
+    // Live region wraps, so the only free space is [head, oldest)
+    if (aligned + size < *oldest)
+    {
+        head = aligned + size;
+        return aligned;
+    }
+
+    return std::nullopt;
+}
+
+std::optional<std::size_t> StagingRing::reserve(std::size_t size)
+{
+    collect();
+    if (auto offset = try_fit(size)) return offset;
+
+    // Block on the oldest batches still in flight until there's room
+    const auto& timeline = device.getTimeline();
+    while (!batches.empty() && batches.front().ticket)
+    {
+        timeline.wait(batches.front().ticket);
+
+        collect();
+        if (auto offset = try_fit(size)) return offset;
+    }
+
+    // Whatever is left is recorded into a command buffer that hasn't been submitted yet
+    return std::nullopt;
+}
+
+void StagingRing::collect()
+{
+    const auto& timeline = device.getTimeline();
+    while (!batches.empty() && batches.front().ticket && timeline.reached(batches.front().ticket))
+    {
+        for (const auto& a : batches.front().garbage)
+            destroy(a);
+        for (const auto& release : batches.front().deferred)
+            release();
+        batches.pop_front();
+    }
+}
+
+void StagingRing::upload(Handle<Graphics::Buffer> destination, std::size_t offset, const void* data, std::size_t size)
+{
+    if (!size) return;
+    MIDNIGHT_ASSERT(destination, "Uploading into an invalid buffer");
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!ring.buffer) create();
+
+    const auto alloc = static_cast<VmaAllocator>(allocator);
+
+    // Large uploads would starve the ring, so they get their own staging buffer
+    const auto ring_offset = ( size <= _capacity / 2 ? reserve(size) : std::nullopt );
+    auto& batch = open_batch();
+
+    if (ring_offset)
+    {
+        std::memcpy(mapped + *ring_offset, data, size);
+        vmaFlushAllocation(alloc, static_cast<VmaAllocation>(ring.allocation), *ring_offset, size);
+
+        if (!batch.begin) batch.begin = ring_offset;
+        copies.push_back(Copy {
+            .source = ring.buffer,
+            .destination = destination.get(),
+            .source_offset = *ring_offset,
+            .destination_offset = offset,
+            .size = size
+        });
+        return;
+    }
+
+    VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = nullptr,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+    };
+
+    VmaAllocationCreateInfo alloc_create_info = {
+        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = VMA_MEMORY_USAGE_AUTO
+    };
+
+    VkBuffer buff;
+    VmaAllocation allocation;
+    VmaAllocationInfo info;
+    const auto err = vmaCreateBuffer(alloc, &buffer_create_info, &alloc_create_info, &buff, &allocation, &info);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error creating overflow staging buffer: " << err);
+
+    std::memcpy(info.pMappedData, data, size);
+    vmaFlushAllocation(alloc, allocation, 0, size);
+
+    batch.garbage.push_back(Allocation{ static_cast<mn::handle_t>(buff), static_cast<mn::handle_t>(allocation) });
+    copies.push_back(Copy {
+        .source = static_cast<mn::handle_t>(buff),
+        .destination = destination.get(),
+        .source_offset = 0,
+        .destination_offset = offset,
+        .size = size
+    });
+}
+
+void StagingRing::copy(Handle<Graphics::Buffer> source, std::size_t source_offset, Handle<Graphics::Buffer> destination, std::size_t destination_offset, std::size_t size)
+{
+    if (!size) return;
+    MIDNIGHT_ASSERT(source && destination, "Copying between invalid buffers");
+
+    std::lock_guard<std::mutex> lock(mutex);
+    open_batch();
+    copies.push_back(Copy {
+        .source = source.get(),
+        .destination = destination.get(),
+        .source_offset = source_offset,
+        .destination_offset = destination_offset,
+        .size = size
+    });
+}
+
+void StagingRing::defer(std::function<void()> release)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    open_batch().deferred.push_back(std::move(release));
+}
+
+void StagingRing::cancel(Handle<Graphics::Buffer> destination, std::size_t offset, std::size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::erase_if(copies, [&](const Copy& c)
+    {
+        return c.destination == destination.get() && c.destination_offset < offset + size && offset < c.destination_offset + c.size;
+    });
+}
+
+void StagingRing::record_copies(mn::handle_t command_buffer)
+{
+    if (copies.empty()) return;
+
+    const auto cmd = static_cast<VkCommandBuffer>(command_buffer);
+    const auto& vk = device.getDispatch();
+
+    const auto barrier = [cmd, &vk](VkPipelineStageFlags src_stage, VkAccessFlags src_access, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access)
+    {
+        VkMemoryBarrier memory_barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .pNext = nullptr,
+            .srcAccessMask = src_access,
+            .dstAccessMask = dst_access
+        };
+        vk.vkCmdPipelineBarrier(cmd, src_stage, dst_stage, 0, 1, &memory_barrier, 0, nullptr, 0, nullptr);
+    };
+
+    // Earlier work may still be reading (or writing) the regions we're about to overwrite
+    barrier(
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,     VK_ACCESS_TRANSFER_WRITE_BIT);
+
+    // Copies into overlapping ranges need to stay ordered
+    struct Range { mn::handle_t buffer; std::size_t begin, end; };
+    std::vector<Range> written;
+    const auto overlaps = [&written](mn::handle_t buffer, std::size_t begin, std::size_t end)
+    {
+        return std::any_of(written.begin(), written.end(), [&](const Range& r)
+        {
+            return r.buffer == buffer && begin < r.end && r.begin < end;
+        });
+    };
+
+    for (const auto& copy : copies)
+    {
+        if (overlaps(copy.destination, copy.destination_offset, copy.destination_offset + copy.size) ||
+            overlaps(copy.source, copy.source_offset, copy.source_offset + copy.size))
+        {
+            barrier(
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+            written.clear();
+        }
+
+        VkBufferCopy region = {
+            .srcOffset = copy.source_offset,
+            .dstOffset = copy.destination_offset,
+            .size = copy.size
+        };
+        vk.vkCmdCopyBuffer(cmd, static_cast<VkBuffer>(copy.source), static_cast<VkBuffer>(copy.destination), 1, &region);
+        written.push_back(Range{ copy.destination, copy.destination_offset, copy.destination_offset + copy.size });
+    }
+
+    barrier(
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT |
+            VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+}
+
+void StagingRing::record(const CommandBuffer& cmd)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (batches.empty() || batches.back().recorded) return;
+
+    record_copies(cmd.getHandle().get());
+    copies.clear();
+    batches.back().recorded = true;
+}
+
+void StagingRing::submit(GpuTimeline::Ticket ticket)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& batch : batches)
+        if (batch.recorded && !batch.ticket)
+            batch.ticket = ticket;
+}
+
+void StagingRing::retire()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    collect();
+}
+
+void StagingRing::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (batches.empty() || batches.back().recorded) return;
+
+    const auto ticket = device.immediateSubmit([this](CommandBuffer& cmd)
+    {
+        record_copies(cmd.getHandle().get());
+    });
+    copies.clear();
+    batches.back().recorded = true;
+    batches.back().ticket = ticket;
+
+    // A frame that's being recorded may still use what was deferred, so it has to wait
+    // for the next flush point instead
+    auto deferred = std::move(batches.back().deferred);
+
+    collect();
+    if (!deferred.empty())
+        open_batch().deferred = std::move(deferred);
+}
+
+}
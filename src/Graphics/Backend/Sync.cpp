@@ -1,5 +1,6 @@
 #include <Graphics/Backend/Instance.hpp>
 #include <Graphics/Backend/Sync.hpp>
+#include <Graphics/Backend/Dispatch.hpp>
 
 #include <vulkan/vulkan.h>
 
@@ -7,7 +8,7 @@ namespace mn::Graphics::Backend
 {
 Fence::Fence()
 {
-    auto& device = Instance::get()->getDevice();
+    auto& device = Instance::ref().getDevice();
     handle = device->createFence();
 }
 
@@ -15,7 +16,7 @@ Fence::~Fence()
 {
     if (handle)
     {
-        auto& device = Instance::get()->getDevice();
+        auto& device = Instance::ref().getDevice();
         device->destroyFence(handle);
         handle = nullptr;
     }
@@ -23,7 +24,7 @@ Fence::~Fence()
 
 void Fence::wait() const
 {
-    auto& device = Instance::get()->getDevice();
+    auto& device = Instance::ref().getDevice();
     auto fence = handle.as<VkFence>();
     const auto err = vkWaitForFences(device->getHandle().as<VkDevice>(), 1, &fence, true, 1000000000);
     MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error waiting on fence: " << err);
@@ -31,7 +32,7 @@ void Fence::wait() const
 
 void Fence::reset() const
 {
-    auto& device = Instance::get()->getDevice();
+    auto& device = Instance::ref().getDevice();
     auto fence = handle.as<VkFence>();
     const auto err = vkResetFences(device->getHandle().as<VkDevice>(), 1, &fence);
     MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error reseting fence: " << err);
@@ -39,7 +40,7 @@ void Fence::reset() const
 
 Semaphore::Semaphore()
 {
-    auto& device = Instance::get()->getDevice();
+    auto& device = Instance::ref().getDevice();
     handle = device->createSemaphore();
 }
 
@@ -47,9 +48,88 @@ Semaphore::~Semaphore()
 {
     if (handle)
     {
-        auto& device = Instance::get()->getDevice();
+        auto& device = Instance::ref().getDevice();
         device->destroySemaphore(handle);
         handle = nullptr;
     }
 }
+
+Handle<Semaphore> Semaphore::release()
+{
+    const auto h = handle;
+    handle = nullptr;
+    return h;
+}
+
+// Created by the Device itself, so none of this can go through the Instance
+GpuTimeline::GpuTimeline(const Device& d) :
+    device(d),
+    _pending(0),
+    _completed(0)
+{
+    VkSemaphoreTypeCreateInfoKHR type_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
+        .pNext = nullptr,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR,
+        .initialValue = 0
+    };
+
+    VkSemaphoreCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &type_info,
+        .flags = 0
+    };
+
+    VkSemaphore s;
+    const auto err = vkCreateSemaphore(device.getHandle().as<VkDevice>(), &create_info, nullptr, &s);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error creating timeline semaphore (" << err << ")");
+    handle = s;
+}
+
+GpuTimeline::~GpuTimeline()
+{
+    if (handle)
+    {
+        vkDestroySemaphore(device.getHandle().as<VkDevice>(), handle.as<VkSemaphore>(), nullptr);
+        handle = nullptr;
+    }
+}
+
+GpuTimeline::Ticket GpuTimeline::completed() const
+{
+    uint64_t value;
+    const auto err = device.getDispatch().vkGetSemaphoreCounterValueKHR(device.getHandle().as<VkDevice>(), handle.as<VkSemaphore>(), &value);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error reading timeline semaphore: " << err);
+
+    // Racing threads could store out of order, only ever move forward
+    auto seen = _completed.load(std::memory_order_relaxed);
+    while (seen < value && !_completed.compare_exchange_weak(seen, value, std::memory_order_relaxed));
+    return value;
+}
+
+bool GpuTimeline::reached(Ticket ticket) const
+{
+    return ticket <= _completed.load(std::memory_order_relaxed) || ticket <= completed();
+}
+
+void GpuTimeline::wait(Ticket ticket) const
+{
+    if (ticket <= _completed.load(std::memory_order_relaxed)) return;
+
+    const auto semaphore = handle.as<VkSemaphore>();
+    VkSemaphoreWaitInfoKHR wait_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+        .pNext = nullptr,
+        .flags = 0,
+        .semaphoreCount = 1,
+        .pSemaphores = &semaphore,
+        .pValues = &ticket
+    };
+
+    const auto err = device.getDispatch().vkWaitSemaphoresKHR(device.getHandle().as<VkDevice>(), &wait_info, UINT64_MAX);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error waiting on timeline semaphore: " << err);
+
+    auto seen = _completed.load(std::memory_order_relaxed);
+    while (seen < ticket && !_completed.compare_exchange_weak(seen, ticket, std::memory_order_relaxed));
+}
 }
\ No newline at end of file
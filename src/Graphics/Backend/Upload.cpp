@@ -0,0 +1,419 @@
+#include <Graphics/Backend/Upload.hpp>
+#include <Graphics/Backend/Device.hpp>
+#include <Graphics/Backend/Command.hpp>
+#include <Graphics/Backend/Dispatch.hpp>
+
+#include <Graphics/Buffer.hpp>
+#include <Graphics/Image.hpp>
+
+#include <vulkan/vulkan.h>
+#include <vk_mem_alloc.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace mn::Graphics::Backend
+{
+
+// Where uploaded buffers and images are used, which is what frames hold back for a batch
+constexpr VkPipelineStageFlags2 CONSUMER_STAGES =
+    VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR   |
+    VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT_KHR    |
+    VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT_KHR   |
+    VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR |
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR  |
+    VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR;
+
+uint64_t UploadEngine::consumerStages()
+{
+    return CONSUMER_STAGES;
+}
+
+static std::size_t pixel_size(u32 format)
+{
+    switch (static_cast<VkFormat>(format))
+    {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_UNORM:      return 4;
+    case VK_FORMAT_R16G16B16A16_SFLOAT: return 8;
+    default:
+        MIDNIGHT_ASSERT(false, "Upload into format " << format << " isn't supported");
+        return 0;
+    }
+}
+
+UploadEngine::UploadEngine(const Device& d, mn::handle_t alloc) :
+    device(d),
+    allocator(alloc),
+    // Concurrently shared resources need no hand over
+    ownership_transfer(d.hasTransferQueue() && d.getSharedFamilies().empty())
+{   }
+
+// Only runs once the device is idle, and before the DeletionQueue is flushed: the destinations
+// dropped here queue their releases
+UploadEngine::~UploadEngine()
+{
+    for (const auto& copy : copies)
+        destroy(copy.staging);
+    copies.clear();
+
+    const auto vk_device = device.getHandle().as<VkDevice>();
+    for (const auto& batch : batches)
+    {
+        for (const auto& staging : batch.staging)
+            destroy(staging);
+        vkDestroyCommandPool(vk_device, static_cast<VkCommandPool>(batch.commands.pool), nullptr);
+    }
+    batches.clear();
+
+    for (const auto& commands : free_commands)
+        vkDestroyCommandPool(vk_device, static_cast<VkCommandPool>(commands.pool), nullptr);
+    free_commands.clear();
+}
+
+UploadEngine::Staging UploadEngine::create_staging(const void* data, std::size_t size)
+{
+    VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = nullptr,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+    };
+
+    VmaAllocationCreateInfo alloc_create_info = {
+        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+        .usage = VMA_MEMORY_USAGE_AUTO
+    };
+
+    const auto vma = static_cast<VmaAllocator>(allocator);
+
+    VkBuffer buff;
+    VmaAllocation alloc;
+    VmaAllocationInfo info;
+    const auto err = vmaCreateBuffer(vma, &buffer_create_info, &alloc_create_info, &buff, &alloc, &info);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error creating upload staging buffer: " << err);
+
+    std::memcpy(info.pMappedData, data, size);
+    vmaFlushAllocation(vma, alloc, 0, size);
+
+    return Staging{ static_cast<mn::handle_t>(buff), static_cast<mn::handle_t>(alloc) };
+}
+
+void UploadEngine::destroy(const Staging& staging) const
+{
+    vmaDestroyBuffer(static_cast<VmaAllocator>(allocator), static_cast<VkBuffer>(staging.buffer), static_cast<VmaAllocation>(staging.allocation));
+}
+
+void UploadEngine::upload(const std::shared_ptr<Graphics::Buffer>& destination, std::size_t offset, const void* data, std::size_t size)
+{
+    MIDNIGHT_ASSERT(destination, "Uploading into a null buffer");
+    MIDNIGHT_ASSERT(offset + size <= destination->allocated(), "Upload out of the buffer's bounds");
+    MIDNIGHT_ASSERT(destination->memory() == Graphics::Buffer::Memory::DeviceLocal || destination->kind() == Graphics::Buffer::Kind::Generic,
+        "Host visible buffers can't be copied into, write them through rawData()");
+    if (!size) return;
+
+    // The copy happens outside the lock, a loader thread shouldn't hold up the render loop
+    const auto staging = create_staging(data, size);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    copies.push_back(Copy {
+        .staging = staging,
+        .destination = Destination {
+            .buffer = destination,
+            .image = {},
+            .handle = destination->getHandle().get(),
+            .attachment = 0,
+            .offset = destination->getOffset() + offset,
+            .size = size
+        },
+        .width = 0,
+        .height = 0,
+        .allocated_at = destination->allocatedAt()
+    });
+}
+
+void UploadEngine::upload(const std::shared_ptr<Graphics::Image>& destination, uint32_t attachment, const void* data, std::size_t size)
+{
+    MIDNIGHT_ASSERT(destination, "Uploading into a null image");
+    MIDNIGHT_ASSERT(attachment < destination->getColorAttachments().size(), "Image has no color attachment " << attachment);
+
+    const auto& target = destination->getColorAttachments()[attachment];
+    const auto expected = static_cast<std::size_t>(Math::x(target.size)) * Math::y(target.size) * pixel_size(target.format);
+    MIDNIGHT_ASSERT(size == expected, "Image upload of " << size << " bytes, the attachment takes " << expected);
+
+    const auto staging = create_staging(data, size);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    copies.push_back(Copy {
+        .staging = staging,
+        .destination = Destination {
+            .buffer = {},
+            .image = destination,
+            .handle = target.handle,
+            .attachment = attachment,
+            .offset = 0,
+            .size = size
+        },
+        .width = Math::x(target.size),
+        .height = Math::y(target.size),
+        .allocated_at = target.allocated_at
+    });
+}
+
+UploadEngine::Commands UploadEngine::acquire_commands()
+{
+    if (!free_commands.empty())
+    {
+        const auto commands = free_commands.back();
+        free_commands.pop_back();
+        vkResetCommandPool(device.getHandle().as<VkDevice>(), static_cast<VkCommandPool>(commands.pool), 0);
+        return commands;
+    }
+
+    // One pool per batch in flight, so a finished batch's pool is reset as a whole
+    const auto pool = device.createCommandPool(QueueType::Transfer);
+    const auto buffer = device.createCommandBuffer(pool);
+    return Commands{ pool.get(), buffer.get() };
+}
+
+static VkImageMemoryBarrier image_barrier(VkImage image, VkAccessFlags src_access, VkAccessFlags dst_access, VkImageLayout old_layout, VkImageLayout new_layout, uint32_t src_family, uint32_t dst_family)
+{
+    return VkImageMemoryBarrier {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access,
+        .oldLayout = old_layout,
+        .newLayout = new_layout,
+        .srcQueueFamilyIndex = src_family,
+        .dstQueueFamilyIndex = dst_family,
+        .image = image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        }
+    };
+}
+
+static VkBufferMemoryBarrier buffer_barrier(VkBuffer buffer, std::size_t offset, std::size_t size, VkAccessFlags src_access, VkAccessFlags dst_access, uint32_t src_family, uint32_t dst_family)
+{
+    return VkBufferMemoryBarrier {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .pNext = nullptr,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access,
+        .srcQueueFamilyIndex = src_family,
+        .dstQueueFamilyIndex = dst_family,
+        .buffer = buffer,
+        .offset = offset,
+        .size = size
+    };
+}
+
+void UploadEngine::record_copies(mn::handle_t cmd) const
+{
+    const auto& vk = device.getDispatch();
+    const auto command_buffer = static_cast<VkCommandBuffer>(cmd);
+
+    // Without a family change there's nothing to release, the semaphore the graphics
+    // queue waits on makes the writes visible
+    const auto src_family = ( ownership_transfer ? device.getTransferQueue().index : VK_QUEUE_FAMILY_IGNORED );
+    const auto dst_family = ( ownership_transfer ? device.getGraphicsQueue().index : VK_QUEUE_FAMILY_IGNORED );
+
+    std::vector<VkImageMemoryBarrier> images;
+    for (const auto& copy : copies)
+        if (copy.width)
+            images.push_back(image_barrier(static_cast<VkImage>(copy.destination.handle), 0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED));
+
+    if (!images.empty())
+        vk.vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(images.size()), images.data());
+
+    images.clear();
+    std::vector<VkBufferMemoryBarrier> buffers;
+    for (const auto& copy : copies)
+    {
+        const auto source = static_cast<VkBuffer>(copy.staging.buffer);
+        const auto& destination = copy.destination;
+
+        if (copy.width)
+        {
+            const VkBufferImageCopy region = {
+                .bufferOffset = 0,
+                .bufferRowLength = 0,
+                .bufferImageHeight = 0,
+                .imageSubresource = {
+                    .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                    .mipLevel = 0,
+                    .baseArrayLayer = 0,
+                    .layerCount = 1
+                },
+                .imageOffset = { 0, 0, 0 },
+                .imageExtent = { copy.width, copy.height, 1 }
+            };
+            vk.vkCmdCopyBufferToImage(command_buffer, source, static_cast<VkImage>(destination.handle), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+            // The layout change is part of the release, and has to be repeated by the acquire
+            images.push_back(image_barrier(static_cast<VkImage>(destination.handle), VK_ACCESS_TRANSFER_WRITE_BIT, 0, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, src_family, dst_family));
+        }
+        else
+        {
+            const VkBufferCopy region = {
+                .srcOffset = 0,
+                .dstOffset = destination.offset,
+                .size = destination.size
+            };
+            vk.vkCmdCopyBuffer(command_buffer, source, static_cast<VkBuffer>(destination.handle), 1, &region);
+
+            if (ownership_transfer)
+                buffers.push_back(buffer_barrier(static_cast<VkBuffer>(destination.handle), destination.offset, destination.size, VK_ACCESS_TRANSFER_WRITE_BIT, 0, src_family, dst_family));
+        }
+    }
+
+    if (!images.empty() || !buffers.empty())
+        vk.vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+            static_cast<uint32_t>(buffers.size()), buffers.data(), static_cast<uint32_t>(images.size()), images.data());
+}
+
+UploadEngine::Ticket UploadEngine::submit()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return submit_batch();
+}
+
+UploadEngine::Ticket UploadEngine::submit_batch()
+{
+    collect();
+    if (copies.empty()) return 0;
+
+    Batch batch = {
+        .commands = acquire_commands(),
+        .staging = {},
+        .destinations = {},
+        .ticket = 0,
+        .acquired = false
+    };
+
+    const auto cmd = CommandBuffer::adopt(batch.commands.buffer);
+    cmd.begin();
+    record_copies(batch.commands.buffer);
+    cmd.end();
+
+    // Frames submitted since a destination was allocated may still be using what the batch
+    // overwrites. Fresh ones can't have been used yet, and a batch of only those goes straight away.
+    const auto submitted = device.lastSubmitted();
+    const bool overwrites = std::any_of(copies.begin(), copies.end(), [submitted](const Copy& copy) { return copy.allocated_at < submitted; });
+    batch.ticket = device.submitTransfer(cmd, ( overwrites ? submitted : 0 ));
+
+    for (auto& copy : copies)
+    {
+        batch.staging.push_back(copy.staging);
+        batch.destinations.push_back(std::move(copy.destination));
+    }
+    copies.clear();
+
+    const auto ticket = batch.ticket;
+    batches.push_back(std::move(batch));
+    return ticket;
+}
+
+bool UploadEngine::finished(Ticket ticket) const
+{
+    return device.getTransferTimeline().reached(ticket);
+}
+
+UploadEngine::Ticket UploadEngine::record_acquires(mn::handle_t cmd)
+{
+    std::vector<VkImageMemoryBarrier> images;
+    std::vector<VkBufferMemoryBarrier> buffers;
+
+    const auto src_family = device.getTransferQueue().index;
+    const auto dst_family = device.getGraphicsQueue().index;
+    const auto& timeline = device.getTransferTimeline();
+
+    // Only batches that are done, so the frame never holds its work back for a copy.
+    // They complete in order, so the first one that isn't ends it.
+    Ticket ticket = 0;
+    for (auto& batch : batches)
+    {
+        if (batch.acquired) continue;
+        if (!timeline.reached(batch.ticket)) break;
+        batch.acquired = true;
+        ticket = batch.ticket;
+
+        for (const auto& destination : batch.destinations)
+        {
+            if (const auto& image = destination.image)
+            {
+                // The attachment's tracking belongs to the thread recording frames, which is
+                // where this runs, so it only learns about the copy here
+                image->getColorAttachments()[destination.attachment].setLayout(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+                if (ownership_transfer)
+                    images.push_back(image_barrier(static_cast<VkImage>(destination.handle), 0, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, src_family, dst_family));
+            }
+            else if (ownership_transfer)
+                buffers.push_back(buffer_barrier(static_cast<VkBuffer>(destination.handle), destination.offset, destination.size, 0, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT, src_family, dst_family));
+        }
+    }
+
+    if (ticket) last_acquired = ticket;
+    if (images.empty() && buffers.empty()) return ticket;
+
+    // The submit waits for the batches at the same stages, which the acquires chain onto
+    const auto stages = static_cast<VkPipelineStageFlags>(CONSUMER_STAGES);
+    device.getDispatch().vkCmdPipelineBarrier(static_cast<VkCommandBuffer>(cmd), stages, stages, 0, 0, nullptr,
+        static_cast<uint32_t>(buffers.size()), buffers.data(), static_cast<uint32_t>(images.size()), images.data());
+    return ticket;
+}
+
+UploadEngine::Ticket UploadEngine::acquire(const CommandBuffer& cmd)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    collect();
+    return record_acquires(cmd.getHandle().get());
+}
+
+bool UploadEngine::acquired(Ticket ticket) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return ticket <= last_acquired;
+}
+
+void UploadEngine::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    submit_batch();
+    if (!batches.empty())
+        device.getTransferTimeline().wait(batches.back().ticket);
+
+    const auto pending = std::any_of(batches.begin(), batches.end(), [](const Batch& batch) { return !batch.acquired; });
+    if (pending)
+    {
+        // Every batch is done by now, so this takes all of them
+        device.immediateSubmit([this](CommandBuffer& cmd)
+        {
+            record_acquires(cmd.getHandle().get());
+        });
+    }
+
+    collect();
+}
+
+void UploadEngine::collect()
+{
+    // Batches complete in order on the transfer queue
+    const auto& timeline = device.getTransferTimeline();
+    while (!batches.empty() && batches.front().acquired && timeline.reached(batches.front().ticket))
+    {
+        auto& batch = batches.front();
+        // Which may drop the last reference to a destination, whose release waits for the frames
+        for (const auto& staging : batch.staging)
+            destroy(staging);
+        free_commands.push_back(batch.commands);
+        batches.pop_front();
+    }
+}
+
+}
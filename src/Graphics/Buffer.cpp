@@ -1,6 +1,11 @@
 #include <Graphics/Buffer.hpp>
 
 #include <Graphics/Backend/Instance.hpp>
+#include <Graphics/Backend/Staging.hpp>
+#include <Graphics/Backend/Pool.hpp>
+#include <Graphics/Backend/Dispatch.hpp>
+#include <Graphics/Backend/Command.hpp>
+#include <Graphics/Backend/Deletion.hpp>
 
 // Hack to get rid of annoying warnings from VMA
 
@@ -18,86 +23,342 @@
 
 namespace mn::Graphics
 {
-    Buffer::Buffer() :
-        _data(nullptr), _size{0}, allocation{nullptr}
+    struct Requirements
+    {
+        VkBufferUsageFlags usage;
+        VmaAllocationCreateInfo allocation;
+    };
+
+    static Requirements requirements(Buffer::Kind kind, Buffer::Memory memory)
+    {
+        const bool host = ( memory == Buffer::Memory::HostVisible );
+
+        // Device-local buffers are filled by staging copies and grown with GPU side copies,
+        // which is also how defragmentation moves them. Host visible ones are written and
+        // grown through their mapping, nothing ever copies them on the GPU.
+        const VkBufferUsageFlags transfer = ( host ? 0 : VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT );
+
+        const auto allocation = ( host ?
+            VmaAllocationCreateInfo {
+                .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+                .usage = VMA_MEMORY_USAGE_AUTO
+            } :
+            VmaAllocationCreateInfo {
+                .flags = 0,
+                .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE
+            }
+        );
+
+        switch (kind)
+        {
+        case Buffer::Kind::Vertex:
+            return { VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR | transfer, allocation };
+        case Buffer::Kind::Index:
+            return { VK_BUFFER_USAGE_INDEX_BUFFER_BIT | transfer, allocation };
+        case Buffer::Kind::Uniform:
+            return { VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | transfer, allocation };
+        case Buffer::Kind::Storage:
+            // Compute shaders write indirect arguments into storage buffers
+            return { VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR | transfer, allocation };
+        case Buffer::Kind::Staging:
+            return { 
+                VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
+                VmaAllocationCreateInfo {
+                    .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+                    .usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST
+                }
+            };
+        case Buffer::Kind::Readback:
+            // Random access so VMA picks cached memory, reads from uncached memory are painfully slow
+            return { 
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT, 
+                VmaAllocationCreateInfo {
+                    .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
+                    .usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST
+                }
+            };
+        case Buffer::Kind::Generic:
+        default:
+            return {
+                VK_BUFFER_USAGE_VERTEX_BUFFER_BIT  | 
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT   | 
+                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | 
+                VK_BUFFER_USAGE_INDEX_BUFFER_BIT   |
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                VK_BUFFER_USAGE_TRANSFER_SRC_BIT   |
+                VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR,
+                allocation
+            };
+        }
+    }
+
+    // Defragmentation moves a buffer with a GPU side copy, which only works both ways round
+    // for buffers that can be copied from and to. The rest are left where they are.
+    static bool relocatable(VkBufferUsageFlags usage)
+    {
+        const VkBufferUsageFlags transfer = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        return ( usage & transfer ) == transfer;
+    }
+
+    Buffer::Buffer(Memory memory, Backing backing) :
+        Buffer(Kind::Generic, memory, backing)
     {   }
 
+    Buffer::Buffer(Kind kind, Memory memory, Backing backing) :
+        _kind(kind), _memory(memory), _backing(backing), _usage(requirements(kind, memory).usage), allocation{nullptr}, _data(nullptr), _size{0}, _capacity{0}, _offset{0}, _allocated_at{0}
+    {
+        if (kind == Kind::Staging || kind == Kind::Readback)
+        {
+            MIDNIGHT_ASSERT(memory == Memory::HostVisible, "Staging and readback buffers have to be host visible");
+            _backing = Backing::Dedicated;
+        }
+    }
+
     Buffer::Buffer(Buffer&& b) :
-        allocation(b.allocation)
+        _kind(b._kind), _memory(b._memory), _backing(b._backing), _usage(b._usage), allocation(b.allocation), _data(b._data), _size(b._size), _capacity(b._capacity), _offset(b._offset), _allocated_at(b._allocated_at), _block(b._block)
     {   
         std::swap(handle, b.handle);
         b.allocation = nullptr;
+        b._data = nullptr;
+        b._size = 0;
+        b._capacity = 0;
+        b._offset = 0;
+        b._block.reset();
+
+        // Defragmentation finds the owner of a dedicated allocation through its user data
+        if (allocation && !_block && relocatable(_usage))
+            vmaSetAllocationUserData(static_cast<VmaAllocator>(Backend::Instance::ref().getAllocator()), allocation.as<VmaAllocation>(), static_cast<Backend::Relocatable*>(this));
     }
 
     void Buffer::rawFree()
     {
         if (handle && allocation)
         {
-            const auto allocator = static_cast<VmaAllocator>(Backend::Instance::get()->getAllocator());
-            vmaDestroyBuffer(allocator, handle.as<VkBuffer>(), allocation.as<VmaAllocation>());
+            auto& device = Backend::Instance::ref().getDevice();
+            if (_memory == Memory::DeviceLocal)
+                device->getStagingRing().cancel(handle, _offset, _capacity);
+
+            // Frames in flight may still be using it
+            release(handle.get(), allocation.get(), false);
         }
+
+        handle = nullptr;
+        allocation = nullptr;
+        _data = nullptr;
+        _size = 0;
+        _capacity = 0;
+        _offset = 0;
+        _block.reset();
+    }
+
+    void Buffer::release(mn::handle_t buffer, mn::handle_t alloc, bool copying) const
+    {
+        auto& device = Backend::Instance::ref().getDevice();
+
+        const auto free = [&]() -> std::function<void()>
+        {
+            if (_block)
+            {
+                const auto range = Backend::BufferPool::Range{ buffer, alloc, rawData(), _offset, *_block };
+                return [&pool = device->getBufferPool(), range]() { pool.free(range); };
+            }
+
+            // No longer ours, so defragmentation must leave it alone until it's destroyed
+            const auto allocator = static_cast<VmaAllocator>(Backend::Instance::ref().getAllocator());
+            vmaSetAllocationUserData(allocator, static_cast<VmaAllocation>(alloc), nullptr);
+            return [allocator, buffer, alloc]()
+            {
+                vmaDestroyBuffer(allocator, static_cast<VkBuffer>(buffer), static_cast<VmaAllocation>(alloc));
+            };
+        }();
+
+        // A queued copy still reads from it, and the copy may not be recorded until a later frame
+        if (copying)
+            device->getStagingRing().defer(free);
+        else
+            device->getDeletionQueue().push(free);
     }
 
     void Buffer::rawResize(std::size_t newsize)
     {
-        if (!newsize)
+        if (newsize > _capacity)
+            rawReallocate(_capacity ? std::max(newsize, _capacity + _capacity / 2) : newsize);
+
+        _size = newsize;
+    }
+
+    void Buffer::reserveBytes(std::size_t bytes)
+    {
+        if (bytes > _capacity) rawReallocate(bytes);
+    }
+
+    void Buffer::shrinkToFit()
+    {
+        if (!_size) rawFree();
+        else if (_size < _capacity) rawReallocate(_size);
+    }
+
+    void Buffer::rawReallocate(std::size_t newcapacity)
+    {
+        MIDNIGHT_ASSERT(newcapacity >= _size, "Reallocating would truncate the buffer");
+        if (newcapacity == _capacity) return;
+
+        auto& device = Backend::Instance::ref().getDevice();
+
+        Handle<Buffer> new_handle, new_allocation;
+        void* new_data;
+        std::size_t new_offset = 0;
+        std::optional<uint32_t> new_block;
+
+        const auto range = ( _backing == Backing::Pooled ? device->getBufferPool().allocate(_memory, _usage, newcapacity) : std::nullopt );
+        if (range)
         {
-            if (handle) rawFree();
-            return;
+            new_handle = range->buffer;
+            new_allocation = range->allocation;
+            new_data = range->mapped;
+            new_offset = range->offset;
+            new_block = range->block;
         }
+        else
+        {
+            const auto alloc_create_info = requirements(_kind, _memory).allocation;
+            const auto& families = device->getSharedFamilies();
+            VkBufferCreateInfo buffer_create_info = {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+                .pNext = nullptr,
+                .size = newcapacity,
+                .usage = _usage,
+                .sharingMode = ( families.empty() ? VK_SHARING_MODE_EXCLUSIVE : VK_SHARING_MODE_CONCURRENT ),
+                .queueFamilyIndexCount = static_cast<uint32_t>(families.size()),
+                .pQueueFamilyIndices = families.data()
+            };
+
+            const auto allocator = static_cast<VmaAllocator>(Backend::Instance::ref().getAllocator());
+            VkBuffer buff;
+            VmaAllocation alloc;
+            VmaAllocationInfo info;
+            const auto err = vmaCreateBuffer(allocator, &buffer_create_info, &alloc_create_info, &buff, &alloc, &info);
+            MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error creating buffer: " << err);
 
-        if (newsize == _size) return;
+            if (relocatable(_usage))
+                vmaSetAllocationUserData(allocator, alloc, static_cast<Backend::Relocatable*>(this));
 
-        const auto old_size = _size;
-        void* current_data = nullptr;
-        if (handle) 
+            new_handle = buff;
+            new_allocation = alloc;
+            new_data = info.pMappedData;
+        }
+
+        if (handle && allocation)
         {
-            current_data = std::malloc(_size);
-            std::memcpy(current_data, _data, _size);
-            rawFree();
+            auto& staging = device->getStagingRing();
+
+            // Host visible contents are copied straight across, device-local ones on the GPU
+            // (ordered after any uploads still queued for the old buffer)
+            if (_size && _data)
+                std::memcpy(new_data, _data, _size);
+            else if (_size)
+                staging.copy(handle, _offset, new_handle, new_offset, _size);
+
+            // Frames in flight may still be reading from the old buffer
+            release(handle.get(), allocation.get(), _size && !_data);
         }
 
+        handle = new_handle;
+        allocation = new_allocation;
+
+        _data = new_data;
+        _capacity = newcapacity;
+        _offset = new_offset;
+        _allocated_at = device->lastSubmitted();
+        _block = new_block;
+    }
+
+    mn::handle_t Buffer::relocate(mn::handle_t alloc, mn::handle_t target, Backend::CommandBuffer& cmd)
+    {
+        MIDNIGHT_ASSERT(alloc == allocation.get() && !_block, "Relocating an allocation this buffer doesn't own");
+
+        auto& device = Backend::Instance::ref().getDevice();
+        const auto allocator = static_cast<VmaAllocator>(Backend::Instance::ref().getAllocator());
+
+        const auto& families = device->getSharedFamilies();
         VkBufferCreateInfo buffer_create_info = {
             .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
             .pNext = nullptr,
-            .size = newsize,
-            .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT  | 
-                     VK_BUFFER_USAGE_TRANSFER_DST_BIT   | 
-                     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | 
-                     VK_BUFFER_USAGE_INDEX_BUFFER_BIT   |
-                     VK_BUFFER_USAGE_TRANSFER_SRC_BIT   |
-                     VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR
-        };
-
-        VmaAllocationCreateInfo alloc_create_info = {
-            .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
-            .usage = VMA_MEMORY_USAGE_AUTO
+            .size = _capacity,
+            .usage = _usage,
+            .sharingMode = ( families.empty() ? VK_SHARING_MODE_EXCLUSIVE : VK_SHARING_MODE_CONCURRENT ),
+            .queueFamilyIndexCount = static_cast<uint32_t>(families.size()),
+            .pQueueFamilyIndices = families.data()
         };
 
-        const auto allocator = static_cast<VmaAllocator>(Backend::Instance::get()->getAllocator());
         VkBuffer buff;
-        VmaAllocation alloc;
-        VmaAllocationInfo info;
-        vmaCreateBuffer(allocator, &buffer_create_info, &alloc_create_info, &buff, &alloc, &info);
+        auto err = vkCreateBuffer(device->getHandle().as<VkDevice>(), &buffer_create_info, nullptr, &buff);
+        MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error creating buffer: " << err);
 
-        allocation = alloc;
-        handle = buff;
+        err = vmaBindBufferMemory(allocator, static_cast<VmaAllocation>(target), buff);
+        MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error binding buffer memory: " << err);
 
+        if (_size)
+        {
+            // Host writes have to be visible to the copy
+            if (_data) vmaFlushAllocation(allocator, allocation.as<VmaAllocation>(), 0, VK_WHOLE_SIZE);
+
+            VkBufferCopy region = {
+                .srcOffset = 0,
+                .dstOffset = 0,
+                .size = _size
+            };
+            device->getDispatch().vkCmdCopyBuffer(cmd.getHandle().as<VkCommandBuffer>(), handle.as<VkBuffer>(), buff, 1, &region);
+        }
+
+        return static_cast<mn::handle_t>(buff);
+    }
+
+    void Buffer::relocated(mn::handle_t alloc, mn::handle_t resource)
+    {
+        auto& device = Backend::Instance::ref().getDevice();
+        const auto allocator = static_cast<VmaAllocator>(Backend::Instance::ref().getAllocator());
+
+        // The old VkBuffer is still bound to memory VMA has already moved out of
+        vkDestroyBuffer(device->getHandle().as<VkDevice>(), handle.as<VkBuffer>(), nullptr);
+        handle = resource;
+
+        // Persistently mapped allocations get mapped again at their new location
+        VmaAllocationInfo info;
+        vmaGetAllocationInfo(allocator, static_cast<VmaAllocation>(alloc), &info);
         _data = info.pMappedData;
-        _size = info.size;
+        if (_data) vmaInvalidateAllocation(allocator, static_cast<VmaAllocation>(alloc), 0, VK_WHOLE_SIZE);
+    }
+
+    void Buffer::upload(const void* data, std::size_t size, std::size_t offset)
+    {
+        MIDNIGHT_ASSERT(offset + size <= _size, "Upload out of bounds");
+        if (!size) return;
 
-        if (current_data) 
+        if (_data)
         {
-            std::memcpy(_data, current_data, old_size);
-            std::free(current_data);
+            std::memcpy(rawData() + offset, data, size);
+            return;
         }
+
+        Backend::Instance::ref().getDevice()->getStagingRing().upload(handle, _offset + offset, data, size);
+    }
+
+    void Buffer::invalidate() const
+    {
+        if (!handle || !allocation || _block) return;
+
+        const auto allocator = static_cast<VmaAllocator>(Backend::Instance::ref().getAllocator());
+        vmaInvalidateAllocation(allocator, allocation.as<VmaAllocation>(), 0, VK_WHOLE_SIZE);
     }
 
     Buffer::gpu_addr Buffer::getAddress() const
     {
         if (!handle) return nullptr;
+        MIDNIGHT_ASSERT(_usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR, "Buffer kind has no device address");
 
-        const auto& device = Backend::Instance::get()->getDevice();
+        const auto& device = Backend::Instance::ref().getDevice();
 
         VkBufferDeviceAddressInfoKHR addr_info {
             .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO_KHR,
@@ -105,8 +366,8 @@ namespace mn::Graphics
             .buffer = handle.as<VkBuffer>()
         };
 
-        PFN_vkVoidFunction pvkGetBufferDeviceAddressKHR = vkGetDeviceProcAddr(device->getHandle().as<VkDevice>(), "vkGetBufferDeviceAddressKHR");
-        return reinterpret_cast<gpu_addr>( ((PFN_vkGetBufferDeviceAddressKHR)(pvkGetBufferDeviceAddressKHR))(device->getHandle().as<VkDevice>(), &addr_info) );
+        const auto base = device->getDispatch().vkGetBufferDeviceAddressKHR(device->getHandle().as<VkDevice>(), &addr_info);
+        return reinterpret_cast<gpu_addr>(base + _offset);
     }
 
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include <Graphics/Descriptor.hpp>
 #include <Graphics/Backend/Instance.hpp>
+#include <Graphics/Backend/Deletion.hpp>
 
 #include <Graphics/Image.hpp>
 
@@ -25,7 +26,7 @@ namespace mn::Graphics
 
     Descriptor::Layout::~Layout()
     {
-        auto& device = Backend::Instance::get()->getDevice();
+        auto& device = Backend::Instance::ref().getDevice();
         if (handle)
         {
             vkDestroyDescriptorSetLayout(
@@ -38,11 +39,13 @@ namespace mn::Graphics
     template<>
     void Descriptor::update<Descriptor::Layout::Binding::Image>(uint32_t index, const std::vector<std::shared_ptr<Image>>& data)
     {
-        auto& device = Backend::Instance::get()->getDevice();
+        auto& device = Backend::Instance::ref().getDevice();
 
         std::vector<VkDescriptorImageInfo> infos;
         for (const auto& image : data)
         {
+            // The set holds on to the views, so the images can't be moved by defragmentation
+            image->pin();
             for (const auto& a : image->getColorAttachments())
                 infos.push_back(VkDescriptorImageInfo{
                     .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
@@ -62,10 +65,41 @@ namespace mn::Graphics
         vkUpdateDescriptorSets(device->getHandle().as<VkDevice>(), 1, &write, 0, nullptr);
     }
 
+    template<>
+    void Descriptor::update<Descriptor::Layout::Binding::StorageImage>(uint32_t index, const std::vector<std::shared_ptr<Image>>& data)
+    {
+        auto& device = Backend::Instance::ref().getDevice();
+
+        std::vector<VkDescriptorImageInfo> infos;
+        for (const auto& image : data)
+        {
+            image->pin();
+            for (const auto& a : image->getColorAttachments())
+            {
+                MIDNIGHT_ASSERT(a.usage & VK_IMAGE_USAGE_STORAGE_BIT, "Storage image binding of an image made without storage (see ImageFactory::addAttachment)");
+                infos.push_back(VkDescriptorImageInfo{
+                    .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+                    .imageView = static_cast<VkImageView>(a.view)
+                });
+            }
+        }
+
+        VkWriteDescriptorSet write{};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.descriptorCount = infos.size();
+        write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        write.dstSet = static_cast<VkDescriptorSet>(handle);
+        write.dstBinding = index;
+        write.dstArrayElement = 0;
+        write.pImageInfo = infos.data();
+
+        vkUpdateDescriptorSets(device->getHandle().as<VkDevice>(), 1, &write, 0, nullptr);
+    }
+
     template<>
     void Descriptor::update<Descriptor::Layout::Binding::Sampler>(uint32_t index, const std::vector<std::shared_ptr<Backend::Sampler>>& data)
     {
-        auto& device = Backend::Instance::get()->getDevice();
+        auto& device = Backend::Instance::ref().getDevice();
 
         std::vector<VkDescriptorImageInfo> infos;
         infos.reserve(data.size());
@@ -109,9 +143,18 @@ namespace mn::Graphics
         {
         case Descriptor::Layout::Binding::Sampler: return VK_DESCRIPTOR_TYPE_SAMPLER;
         case Descriptor::Layout::Binding::Image:   return VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        case Descriptor::Layout::Binding::StorageImage: return VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
         }
     }
 
+    // Storage images can't be updated after bind without a feature we don't enable
+    VkDescriptorBindingFlags get_flags(Descriptor::Layout::Binding::Type t)
+    {
+        if (t == Descriptor::Layout::Binding::StorageImage)
+            return VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+        return VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
+    }
+
     Descriptor::Layout DescriptorLayoutBuilder::build() const
     {
         std::vector<VkDescriptorType> types;
@@ -132,14 +175,14 @@ namespace mn::Graphics
                 .pImmutableSamplers = nullptr
             });
 
-            flags.push_back(VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT);
+            flags.push_back(get_flags(this->bindings[i].type));
         }
 
         // Variable descriptor here
         if (variable_binding)
         {
             const auto type = get_type(variable_binding->type);
-            flags.push_back(VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT);
+            flags.push_back(get_flags(variable_binding->type) | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT);
             bindings.push_back(VkDescriptorSetLayoutBinding {
                 .binding = static_cast<uint32_t>(this->bindings.size()),
                 .descriptorCount = variable_binding->count,
@@ -165,7 +208,7 @@ namespace mn::Graphics
         // Set binding flags
         createInfo.pNext = &bindingFlags;
 
-        auto& device = Backend::Instance::get()->getDevice();
+        auto& device = Backend::Instance::ref().getDevice();
         VkDescriptorSetLayout layout;
         MIDNIGHT_ASSERT(vkCreateDescriptorSetLayout(device->getHandle().as<VkDevice>(), &createInfo, nullptr, &layout)
             == VK_SUCCESS, "Failed to create descriptor set layout");
@@ -190,7 +233,8 @@ namespace mn::Graphics
 
         const std::vector<VkDescriptorPoolSize> pool_sizes = {
             VkDescriptorPoolSize{ .descriptorCount = 100, .type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE },
-            VkDescriptorPoolSize{ .descriptorCount = 4,   .type = VK_DESCRIPTOR_TYPE_SAMPLER }
+            VkDescriptorPoolSize{ .descriptorCount = 4,   .type = VK_DESCRIPTOR_TYPE_SAMPLER },
+            VkDescriptorPoolSize{ .descriptorCount = 16,  .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE }
         };
 
         VkDescriptorPoolCreateInfo pool_create_info{};
@@ -201,7 +245,7 @@ namespace mn::Graphics
         pool_create_info.maxSets = 1;
         pool_create_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
 
-        auto& device = Backend::Instance::get()->getDevice();
+        auto& device = Backend::Instance::ref().getDevice();
 
         VkDescriptorPool pool;
         MIDNIGHT_ASSERT(vkCreateDescriptorPool(
@@ -220,13 +264,14 @@ namespace mn::Graphics
 
     Descriptor::Pool::~Pool()
     {
-        auto& device = Backend::Instance::get()->getDevice();
+        auto& device = Backend::Instance::ref().getDevice();
         if (handle)
         {
-            vkDestroyDescriptorPool(
-                device->getHandle().as<VkDevice>(),
-                handle.as<VkDescriptorPool>(),
-                nullptr);
+            // Destroying the pool frees its sets, which frames in flight may still have bound
+            device->getDeletionQueue().push([vk_device = device->getHandle().as<VkDevice>(), pool = handle.as<VkDescriptorPool>()]()
+            {
+                vkDestroyDescriptorPool(vk_device, pool, nullptr);
+            });
         }
     }
 
@@ -261,7 +306,7 @@ namespace mn::Graphics
             alloc_info.descriptorSetCount = 1;
             alloc_info.pSetLayouts = &desc_layout;
 
-            auto& device = Backend::Instance::get()->getDevice();
+            auto& device = Backend::Instance::ref().getDevice();
 
             VkDescriptorSet set;
             MIDNIGHT_ASSERT(vkAllocateDescriptorSets(
@@ -0,0 +1,117 @@
+#include <Graphics/HeadlessTarget.hpp>
+
+#include <Graphics/Backend/Instance.hpp>
+#include <Graphics/Backend/Staging.hpp>
+#include <Graphics/Backend/Deletion.hpp>
+#include <Graphics/Backend/Readback.hpp>
+#include <Graphics/Backend/Upload.hpp>
+
+namespace mn::Graphics
+{
+
+HeadlessTarget::HeadlessTarget(const Math::Vec2u& size, const HeadlessOptions& options) :
+    frame_count(0),
+    _size(size)
+{
+    MIDNIGHT_ASSERT(options.frames_in_flight > 0, "Need at least one frame in flight");
+    MIDNIGHT_ASSERT(Math::x(size) && Math::y(size), "Headless target can't be empty");
+
+    // Creates the Instance, without a surface to go with it
+    Backend::Instance::ref();
+
+    const auto image_count = ( options.image_count ? options.image_count : options.frames_in_flight );
+    for (uint32_t i = 0; i < image_count; i++)
+    {
+        images.emplace_back(std::make_shared<Image>(
+            ImageFactory()
+                .addAttachment<Image::Color>(options.color_format, size)
+                .addAttachment<Image::DepthStencil>(Image::DF32_SU8, size)
+                .build()
+        ));
+    }
+    images_in_flight.assign(images.size(), 0);
+
+    for (uint32_t i = 0; i < options.frames_in_flight; i++)
+    {
+        auto fd = std::make_shared<FrameData>();
+        fd->create();
+        frame_data.push_back(fd);
+    }
+}
+
+HeadlessTarget::~HeadlessTarget()
+{
+    finishWork();
+
+    frame_data.clear();
+    images_in_flight.clear();
+    images.clear();
+
+    Backend::Instance::destroy();
+}
+
+RenderFrame HeadlessTarget::startFrame() const
+{
+    auto& device = Backend::Instance::ref().getDevice();
+    auto& staging = device->getStagingRing();
+
+    // Same pacing as a Window, there's just no image to acquire
+    const auto& timeline = device->getTimeline();
+    auto next_frame = get_next_frame();
+    timeline.wait(next_frame->ticket);
+    staging.retire();
+    device->getDeletionQueue().collect();
+    next_frame->release();
+    device->nextFrame();
+
+    // Images go round in order, so with more of them than frames in flight this never blocks
+    const auto n_image = static_cast<uint32_t>((frame_count - 1) % images.size());
+    timeline.wait(images_in_flight[n_image]);
+
+    next_frame->command_buffer->begin();
+
+    // Anything uploaded since the last frame lands before this frame's work
+    staging.record(*next_frame->command_buffer);
+    next_frame->transfer_ticket = device->getUploadEngine().acquire(*next_frame->command_buffer);
+
+    RenderFrame frame(n_image, images[n_image]);
+    frame.frame_data = next_frame;
+    return frame;
+}
+
+void HeadlessTarget::endFrame(RenderFrame& rf) const
+{
+    MIDNIGHT_ASSERT(!rf.compute, "Async compute started but never ended");
+
+    auto& device = Backend::Instance::ref().getDevice();
+    const auto ticket = rf.frame_data->submit(true);
+    images_in_flight[rf.image_index] = ticket;
+    device->getStagingRing().submit(ticket);
+
+    // Anything destroyed while recording this frame may have been used by it
+    device->getDeletionQueue().seal(ticket);
+    device->getReadbackQueue().seal(ticket);
+}
+
+void HeadlessTarget::runFrame(const std::function<void(RenderFrame& rf)>& func) const
+{
+    auto frame = startFrame();
+    func(frame);
+    endFrame(frame);
+}
+
+void HeadlessTarget::finishWork() const
+{
+    // Frames wait for their async compute in their last submit, so the last graphics ticket
+    // covers that too. Uploads no frame has acquired yet aren't, the Instance waits for the
+    // whole device before tearing down.
+    const auto& timeline = Backend::Instance::ref().getDevice()->getTimeline();
+    timeline.wait(timeline.pending());
+}
+
+std::shared_ptr<FrameData> HeadlessTarget::get_next_frame() const
+{
+    return frame_data[frame_count++ % frame_data.size()];
+}
+
+}
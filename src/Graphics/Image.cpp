@@ -5,20 +5,27 @@
 
 #include <Graphics/Backend/Instance.hpp>
 #include <Graphics/Backend/Device.hpp>
+#include <Graphics/Backend/Command.hpp>
+#include <Graphics/Backend/Dispatch.hpp>
+#include <Graphics/Backend/Deletion.hpp>
+
+#include <vk_mem_alloc.h>
 
 namespace mn::Graphics
 {
     template<Image::Type T>
-    Image::Attachment make_attachment(u32 format, Math::Vec2u size)
+    Image::Attachment make_attachment(u32 format, Math::Vec2u size, bool storage)
     {
         constexpr bool depth = (T == Image::DepthStencil);
-        auto& device = Backend::Instance::get()->getDevice();
+        auto& device = Backend::Instance::ref().getDevice();
         Image::Attachment a;
         std::tie(a.handle, a.allocation) = 
-            device->createImage(size, format, depth);
+            device->createImage(size, format, depth, storage);
         a.view = device->createImageView(a.handle, format, depth);
         a.format = format;
         a.size = size; 
+        a.usage = device->getImageUsage(format, depth, storage);
+        a.allocated_at = device->lastSubmitted();
         
         if (Window::ImGui_Initialized)
             a.imgui_ds = ImGui_ImplVulkan_AddTexture(
@@ -31,12 +38,45 @@ namespace mn::Graphics
         return a;
     }
 
+    void Image::Attachment::setLayout(u32 new_layout) const
+    {
+        layout = new_layout;
+        write_stages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        write_access = VK_ACCESS_2_MEMORY_WRITE_BIT;
+        read_stages = 0;
+    }
+
+    void Image::Attachment::discard(uint64_t stages) const
+    {
+        discard(stages, 0);
+    }
+
+    void Image::Attachment::discard(uint64_t stages, uint64_t access) const
+    {
+        layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        write_stages = stages;
+        write_access = access;
+        read_stages = 0;
+    }
+
     void Image::Attachment::destroy()
     {
-        auto& device = Backend::Instance::get()->getDevice();
-        device->destroyImageView(view);
+        auto& instance = Backend::Instance::ref();
+        auto& device = instance.getDevice();
+        const auto vk_device = device->getHandle().as<VkDevice>();
+        const auto allocator = static_cast<VmaAllocator>(instance.getAllocator());
+
+        // Not ours anymore, defragmentation mustn't try to move it while it waits to be destroyed
         if (allocation)
-            device->destroyImage(handle, allocation);
+            vmaSetAllocationUserData(allocator, static_cast<VmaAllocation>(allocation), nullptr);
+
+        // A frame in flight may still be rendering to or sampling from it
+        device->getDeletionQueue().push([vk_device, allocator, view = view, handle = handle, allocation = allocation]()
+        {
+            vkDestroyImageView(vk_device, static_cast<VkImageView>(view), nullptr);
+            if (allocation)
+                vmaDestroyImage(allocator, static_cast<VkImage>(handle), static_cast<VmaAllocation>(allocation));
+        });
         
         // Why don't we need this (?)
         //if (imgui_ds)
@@ -51,23 +91,167 @@ namespace mn::Graphics
     template<Image::Type T>
     void Image::Attachment::rebuild(u32 format, Math::Vec2u size)
     {
+        const auto allocator = static_cast<VmaAllocator>(Backend::Instance::ref().getAllocator());
+
+        // Hand the owning image (if it's tracked) over to the new allocation
+        void* owner = nullptr;
+        if (allocation)
+        {
+            VmaAllocationInfo info;
+            vmaGetAllocationInfo(allocator, static_cast<VmaAllocation>(allocation), &info);
+            owner = info.pUserData;
+        }
+
+        const bool storage = ( usage & VK_IMAGE_USAGE_STORAGE_BIT );
         destroy();
-        auto& device = Backend::Instance::get()->getDevice();
-        auto a = make_attachment<T>(format, size);
+        auto a = make_attachment<T>(format, size, storage);
+        vmaSetAllocationUserData(allocator, static_cast<VmaAllocation>(a.allocation), owner);
 
         allocation = a.allocation;
         view       = a.view;
         handle     = a.handle;
         format     = a.format;
         this->size = a.size;
+        usage      = a.usage;
         imgui_ds   = a.imgui_ds;
+        allocated_at = a.allocated_at;
+        discard();
     }
     template void Image::Attachment::rebuild<Image::Color>(u32, Math::Vec2u);
     template void Image::Attachment::rebuild<Image::DepthStencil>(u32, Math::Vec2u);
 
+    Image::Image(Image&& i) :
+        color_attachments(std::move(i.color_attachments)),
+        depth_attachment(std::move(i.depth_attachment)),
+        pinned(i.pinned)
+    {
+        i.color_attachments.clear();
+        i.depth_attachment.reset();
+        track();
+    }
+
+    void Image::track()
+    {
+        const auto allocator = static_cast<VmaAllocator>(Backend::Instance::ref().getAllocator());
+        void* owner = ( pinned ? nullptr : static_cast<Backend::Relocatable*>(this) );
+
+        for (const auto& a : color_attachments)
+            if (a.allocation) vmaSetAllocationUserData(allocator, static_cast<VmaAllocation>(a.allocation), owner);
+        if (depth_attachment && depth_attachment->allocation)
+            vmaSetAllocationUserData(allocator, static_cast<VmaAllocation>(depth_attachment->allocation), owner);
+    }
+
+    void Image::pin()
+    {
+        if (pinned) return;
+        pinned = true;
+        track();
+    }
+
+    Image::Attachment* Image::find(mn::handle_t allocation)
+    {
+        for (auto& a : color_attachments)
+            if (a.allocation == allocation) return &a;
+        if (depth_attachment && depth_attachment->allocation == allocation)
+            return &(*depth_attachment);
+        return nullptr;
+    }
+
+    mn::handle_t Image::relocate(mn::handle_t allocation, mn::handle_t target, Backend::CommandBuffer& cmd)
+    {
+        auto* a = find(allocation);
+        MIDNIGHT_ASSERT(a, "Relocating an allocation this image doesn't own");
+
+        auto& device = Backend::Instance::ref().getDevice();
+        const bool depth = ( depth_attachment && a == &(*depth_attachment) );
+        const auto image = device->bindImage(a->size, a->format, depth, a->usage & VK_IMAGE_USAGE_STORAGE_BIT, target);
+
+        // Nothing has been drawn or uploaded into it yet, so there's nothing to carry over
+        const auto layout = static_cast<VkImageLayout>(a->layout);
+        if (layout == VK_IMAGE_LAYOUT_UNDEFINED) return image.get();
+
+        const auto& vk = device->getDispatch();
+        const auto command_buffer = cmd.getHandle().as<VkCommandBuffer>();
+        const VkImageSubresourceRange range = {
+            .aspectMask = static_cast<VkImageAspectFlags>(depth ? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT : VK_IMAGE_ASPECT_COLOR_BIT),
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        };
+
+        const auto barrier = [&range](VkImage image, VkAccessFlags src, VkAccessFlags dst, VkImageLayout old_layout, VkImageLayout new_layout)
+        {
+            return VkImageMemoryBarrier {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                .pNext = nullptr,
+                .srcAccessMask = src,
+                .dstAccessMask = dst,
+                .oldLayout = old_layout,
+                .newLayout = new_layout,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = image,
+                .subresourceRange = range
+            };
+        };
+
+        const VkImageMemoryBarrier before[] = {
+            barrier(static_cast<VkImage>(a->handle), VK_ACCESS_MEMORY_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL),
+            barrier(image.as<VkImage>(), 0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+        };
+        vk.vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, before);
+
+        const VkImageSubresourceLayers layers = {
+            .aspectMask = range.aspectMask,
+            .mipLevel = 0,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        };
+
+        VkImageCopy region = {
+            .srcSubresource = layers,
+            .srcOffset = { 0, 0, 0 },
+            .dstSubresource = layers,
+            .dstOffset = { 0, 0, 0 },
+            .extent = { .width = Math::x(a->size), .height = Math::y(a->size), .depth = 1 }
+        };
+        vk.vkCmdCopyImage(command_buffer, static_cast<VkImage>(a->handle), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image.as<VkImage>(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+        // Leave the new image how the old one was, so the layout we're tracking stays right
+        const auto after = barrier(image.as<VkImage>(), VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout);
+        vk.vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &after);
+
+        return image.get();
+    }
+
+    void Image::relocated(mn::handle_t allocation, mn::handle_t resource)
+    {
+        auto* a = find(allocation);
+        MIDNIGHT_ASSERT(a, "Relocating an allocation this image doesn't own");
+
+        auto& device = Backend::Instance::ref().getDevice();
+        const bool depth = ( depth_attachment && a == &(*depth_attachment) );
+
+        device->destroyImageView(a->view);
+        vkDestroyImage(device->getHandle().as<VkDevice>(), static_cast<VkImage>(a->handle), nullptr);
+
+        a->handle = resource;
+        a->view = device->createImageView(a->handle, a->format, depth);
+
+        if (a->imgui_ds)
+        {
+            ImGui_ImplVulkan_RemoveTexture(static_cast<VkDescriptorSet>(a->imgui_ds));
+            a->imgui_ds = ImGui_ImplVulkan_AddTexture(
+                static_cast<VkSampler>(device->getSampler(Backend::Sampler::Nearest)->handle), 
+                static_cast<VkImageView>(a->view), 
+                VK_IMAGE_LAYOUT_GENERAL);
+        }
+    }
+
     Image::~Image()
     {
-        auto& device = Backend::Instance::get()->getDevice();
+        auto& device = Backend::Instance::ref().getDevice();
 
         if (depth_attachment) color_attachments.push_back(*depth_attachment);
         for (auto& a : color_attachments)
@@ -80,30 +264,32 @@ namespace mn::Graphics
 
     template<Image::Type T>
     ImageFactory& 
-    ImageFactory::addAttachment(u32 format, const Math::Vec2u& size)
+    ImageFactory::addAttachment(u32 format, const Math::Vec2u& size, bool storage)
     {
-        auto a = make_attachment<T>(format, size);
+        auto a = make_attachment<T>(format, size, storage);
         if constexpr (T == Image::Type::Color)
             image->color_attachments.push_back(a);
         else
             image->depth_attachment.emplace(a);
         return *this;
     }
-    template ImageFactory& ImageFactory::addAttachment<Image::Color>(u32, const Math::Vec2u&);
-    template ImageFactory& ImageFactory::addAttachment<Image::DepthStencil>(u32, const Math::Vec2u&);
+    template ImageFactory& ImageFactory::addAttachment<Image::Color>(u32, const Math::Vec2u&, bool);
+    template ImageFactory& ImageFactory::addAttachment<Image::DepthStencil>(u32, const Math::Vec2u&, bool);
 
     template<Image::Type T>
     ImageFactory&
-    ImageFactory::addImage(handle_t handle, u32 format, const Math::Vec2u& size)
+    ImageFactory::addImage(handle_t handle, u32 format, const Math::Vec2u& size, u32 usage)
     {
         constexpr bool depth = (T == Image::DepthStencil);
-        auto& device = Backend::Instance::get()->getDevice();
+        auto& device = Backend::Instance::ref().getDevice();
         Image::Attachment a;
         a.handle = handle;
         a.allocation = nullptr;
         a.view = device->createImageView(a.handle, format, depth);
         a.format = format;
         a.size = size;
+        a.usage = usage;
+        a.imgui_ds = nullptr;
 
         if constexpr (T == Image::Type::Color)
             image->color_attachments.push_back(a);
@@ -112,8 +298,8 @@ namespace mn::Graphics
 
         return *this;
     }
-    template ImageFactory& ImageFactory::addImage<Image::Color>(handle_t, u32, const Math::Vec2u&);
-    template ImageFactory& ImageFactory::addImage<Image::DepthStencil>(handle_t, u32, const Math::Vec2u&);
+    template ImageFactory& ImageFactory::addImage<Image::Color>(handle_t, u32, const Math::Vec2u&, u32);
+    template ImageFactory& ImageFactory::addImage<Image::DepthStencil>(handle_t, u32, const Math::Vec2u&, u32);
     
     Image&& 
     ImageFactory::build()
@@ -0,0 +1,114 @@
+#include <Graphics/MemoryMonitor.hpp>
+
+#include <Graphics/Backend/Instance.hpp>
+
+#include <imgui.h>
+#include <implot.h>
+
+namespace mn::Graphics
+{
+
+constexpr float MiB = 1024.f * 1024.f;
+
+MemoryMonitor::MemoryMonitor(std::size_t h) :
+    history(h), count(0), next(0), frame(0)
+{
+    MIDNIGHT_ASSERT(history, "MemoryMonitor needs room for at least one sample");
+
+    frames.resize(history);
+    for (auto* series : { &usage, &budget, &blocks, &allocations, &buffers, &images, &descriptors })
+        series->values.resize(history);
+}
+
+void MemoryMonitor::push(Series& series, float value)
+{
+    series.values[next] = value;
+}
+
+void MemoryMonitor::plot(const char* label, const Series& series) const
+{
+    // Samples live in a ring, so once it's full the oldest one is at next
+    const auto offset = static_cast<int>( count < history ? 0 : next );
+    ImPlot::PlotLine(label, frames.data(), series.values.data(), static_cast<int>(count), 0, offset);
+}
+
+void MemoryMonitor::draw(bool* open)
+{
+    const auto stats = Backend::Instance::ref().getDevice()->memoryStats();
+
+    std::size_t heap_usage = 0, heap_budget = 0;
+    for (const auto& heap : stats.heaps)
+        if (heap.device_local)
+        {
+            heap_usage  += heap.usage;
+            heap_budget += heap.budget;
+        }
+
+    frames[next] = frame++;
+    push(usage,       heap_usage / MiB);
+    push(budget,      heap_budget / MiB);
+    push(blocks,      stats.block_bytes / MiB);
+    push(allocations, stats.allocation_bytes / MiB);
+    push(buffers,     static_cast<float>(stats.buffers));
+    push(images,      static_cast<float>(stats.images));
+    push(descriptors, static_cast<float>(stats.descriptors));
+    next = (next + 1) % history;
+    count = std::min(count + 1, history);
+
+    if (!ImGui::Begin("Memory", open))
+    {
+        ImGui::End();
+        return;
+    }
+
+    ImGui::Text("Budget: %s", ( stats.driver_budget ? "VK_EXT_memory_budget" : "estimated" ));
+    ImGui::Text("VMA: %.1f MiB in %u allocations, %.1f MiB in %u blocks",
+        stats.allocation_bytes / MiB, stats.allocation_count,
+        stats.block_bytes / MiB, stats.block_count);
+    ImGui::Text("Free ranges: %zu (largest %.1f MiB), fragmentation %.0f%%",
+        stats.unused_range_count, stats.largest_unused_range / MiB, stats.fragmentation() * 100.f);
+    ImGui::Text("Live: %zu buffers, %zu images, %zu descriptors", stats.buffers, stats.images, stats.descriptors);
+
+    if (ImGui::BeginTable("heaps", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+    {
+        ImGui::TableSetupColumn("Heap");
+        ImGui::TableSetupColumn("Usage (MiB)");
+        ImGui::TableSetupColumn("Budget (MiB)");
+        ImGui::TableSetupColumn("Size (MiB)");
+        ImGui::TableHeadersRow();
+
+        for (std::size_t i = 0; i < stats.heaps.size(); i++)
+        {
+            const auto& heap = stats.heaps[i];
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn(); ImGui::Text("%zu%s", i, ( heap.device_local ? " (device)" : "" ));
+            ImGui::TableNextColumn(); ImGui::Text("%.1f", heap.usage / MiB);
+            ImGui::TableNextColumn(); ImGui::Text("%.1f", heap.budget / MiB);
+            ImGui::TableNextColumn(); ImGui::Text("%.1f", heap.size / MiB);
+        }
+        ImGui::EndTable();
+    }
+
+    if (ImPlot::BeginPlot("Device memory (MiB)", ImVec2(-1, 200)))
+    {
+        ImPlot::SetupAxes("frame", "MiB", ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit);
+        plot("usage", usage);
+        plot("budget", budget);
+        plot("VMA blocks", blocks);
+        plot("VMA allocations", allocations);
+        ImPlot::EndPlot();
+    }
+
+    if (ImPlot::BeginPlot("Live objects", ImVec2(-1, 200)))
+    {
+        ImPlot::SetupAxes("frame", "count", ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit);
+        plot("buffers", buffers);
+        plot("images", images);
+        plot("descriptors", descriptors);
+        ImPlot::EndPlot();
+    }
+
+    ImGui::End();
+}
+
+}
@@ -6,29 +6,22 @@
 namespace mn::Graphics
 {
 
-Mesh Mesh::fromFrame(const Frame& frame)
+Mesh Mesh::fromFrame(const Frame& frame, Buffer::Memory memory, Buffer::Backing backing)
 {
     Mesh m;
 
     if (frame.vertices.size())
     {
-        m.vertex = std::make_shared<TypeBuffer<Vertex>>();
+        m.vertex = std::make_shared<TypeBuffer<Vertex>>(Buffer::Kind::Vertex, memory, backing);
         m.vertex->resize(frame.vertices.size());
-
-        std::memcpy(
-            &m.vertex->at(0), 
-            reinterpret_cast<const Vertex*>(&frame.vertices[0]), 
-            frame.vertices.size() * sizeof(Vertex));
+        m.vertex->upload(frame.vertices);
     }
 
     if (frame.indices.size())
     {
-        m.index = std::make_shared<TypeBuffer<uint32_t>>();
+        m.index = std::make_shared<TypeBuffer<uint32_t>>(Buffer::Kind::Index, memory, backing);
         m.index->resize(frame.indices.size());
-        std::memcpy(
-            &m.index->at(0), 
-            reinterpret_cast<const uint32_t*>(&frame.indices[0]), 
-            frame.indices.size() * sizeof(uint32_t));
+        m.index->upload(frame.indices);
     }
 
     return m;
@@ -105,7 +98,7 @@ std::size_t Mesh::indexCount() const
 void Mesh::setVertexCount(uint32_t count)
 {
     if (!vertex)
-        vertex = std::make_shared<TypeBuffer<Vertex>>();
+        vertex = std::make_shared<TypeBuffer<Vertex>>(Buffer::Kind::Vertex);
 
     vertex->resize(count);
 }   
@@ -113,7 +106,7 @@ void Mesh::setVertexCount(uint32_t count)
 void Mesh::setIndexCount(uint32_t count)
 {
     if (!index)
-        index = std::make_shared<TypeBuffer<uint32_t>>();
+        index = std::make_shared<TypeBuffer<uint32_t>>(Buffer::Kind::Index);
 
     index->resize(count);
 }
@@ -121,7 +114,7 @@ void Mesh::setIndexCount(uint32_t count)
 std::span<Mesh::Vertex> Mesh::vertices()
 {
     using s = std::span<Vertex>;
-    return (vertex ? 
+    return (vertex && vertex->mapped() ? 
     s{
         reinterpret_cast<Vertex*>(vertex->rawData()),
         vertexCount() 
@@ -131,7 +124,7 @@ std::span<Mesh::Vertex> Mesh::vertices()
 std::span<const Mesh::Vertex> Mesh::vertices() const
 {
     using s = std::span<const Vertex>;
-    return (vertex ? 
+    return (vertex && vertex->mapped() ? 
     s{
         reinterpret_cast<const Vertex*>(vertex->rawData()),
         vertexCount() 
@@ -141,7 +134,7 @@ std::span<const Mesh::Vertex> Mesh::vertices() const
 std::span<uint32_t> Mesh::indices()
 {
     using s = std::span<uint32_t>;
-    return (index ? 
+    return (index && index->mapped() ? 
     s{
         reinterpret_cast<uint32_t*>(index->rawData()),
         indexCount() 
@@ -151,7 +144,7 @@ std::span<uint32_t> Mesh::indices()
 std::span<const uint32_t> Mesh::indices() const
 {
     using s = std::span<const uint32_t>;
-    return (index ? 
+    return (index && index->mapped() ? 
     s{
         reinterpret_cast<const uint32_t*>(index->rawData()),
         indexCount() 
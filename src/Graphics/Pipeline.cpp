@@ -3,6 +3,8 @@
 #include <Graphics/Buffer.hpp>
 #include <Graphics/Image.hpp>
 #include <Graphics/Backend/Command.hpp>
+#include <Graphics/Backend/Deletion.hpp>
+#include <Graphics/Backend/Dispatch.hpp>
 
 #include <set>
 #include <Def.hpp>
@@ -38,8 +40,7 @@ Shader::~Shader()
 {
     if (handle)
     {
-        auto instance = Backend::Instance::get();
-        instance->getDevice()->destroyShader(handle);
+        Backend::Instance::ref().getDevice()->destroyShader(handle);
         handle = nullptr;
     }
 }
@@ -64,7 +65,8 @@ void Shader::fromString(const std::string& contents, ShaderType type, const std:
     {
     case ShaderType::Vertex:   kind = shaderc_vertex_shader;   break;
     case ShaderType::Fragment: kind = shaderc_fragment_shader; break;
-    default: MIDNIGHT_ASSERT(false, "Only vertex and fragment shaders currently supported");
+    case ShaderType::Compute:  kind = shaderc_compute_shader;  break;
+    default: MIDNIGHT_ASSERT(false, "Shader type can not be 'none'");
     }
 
     Compiler compiler;
@@ -85,8 +87,7 @@ void Shader::fromString(const std::string& contents, ShaderType type, const std:
 
 void Shader::fromSpv(const std::vector<uint32_t>& data, ShaderType type)
 {
-    auto instance = Backend::Instance::get();
-    handle = instance->getDevice()->createShader(data);
+    handle = Backend::Instance::ref().getDevice()->createShader(data);
     MIDNIGHT_ASSERT(handle, "Shader creation failed");
 
     this->type = type;
@@ -131,20 +132,76 @@ void Shader::fromSpv(const std::vector<uint32_t>& data, ShaderType type)
 
         spvReflectDestroyShaderModule(&shader_mod);
     }
+
+    if (type == ShaderType::Compute)
+    {
+        SpvReflectShaderModule shader_mod;
+        const auto result = spvReflectCreateShaderModule(data.size() * sizeof(uint32_t), data.data(), &shader_mod);
+        MIDNIGHT_ASSERT(result == SPV_REFLECT_RESULT_SUCCESS, "Error during shader reflection");
+
+        const auto* entry = spvReflectGetEntryPoint(&shader_mod, "main");
+        MIDNIGHT_ASSERT(entry, "Compute shader has no 'main' entry point");
+        workgroup_size.emplace(Math::Vec3u{ entry->local_size.x, entry->local_size.y, entry->local_size.z });
+
+        spvReflectDestroyShaderModule(&shader_mod);
+    }
+}
+
+// Shared by graphics and compute pipelines, push constants are visible to every stage in stages
+static VkPipelineLayout create_layout(const std::vector<std::shared_ptr<Descriptor::Layout>>& descriptor_layouts, uint32_t push_constant_size, VkShaderStageFlags stages)
+{
+    auto& device = Backend::Instance::ref().getDevice();
+
+    VkPushConstantRange push_constant = {
+        .stageFlags = stages,
+        .offset = 0,
+        .size = push_constant_size
+    };
+
+    std::vector<VkDescriptorSetLayout> setLayouts;
+    setLayouts.reserve(descriptor_layouts.size());
+    for (const auto& d : descriptor_layouts)
+        setLayouts.push_back(d->getHandle().as<VkDescriptorSetLayout>());
+
+    VkPipelineLayoutCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
+        .pSetLayouts = reinterpret_cast<const VkDescriptorSetLayout*>(setLayouts.data()),
+        .pushConstantRangeCount = ( push_constant_size ? 1U : 0U ),
+        .pPushConstantRanges = &push_constant
+    };
+
+    VkPipelineLayout layout;
+    const auto err = vkCreatePipelineLayout(device->getHandle().as<VkDevice>(), &create_info, nullptr, &layout);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error creating pipeline layout");
+    return layout;
+}
+
+// Frames in flight may still have it bound
+static void destroy_pipeline(mn::handle_t pipeline, mn::handle_t layout)
+{
+    auto& device = Backend::Instance::ref().getDevice();
+    device->getDeletionQueue().push([vk_device = device->getHandle().as<VkDevice>(), pipeline = static_cast<VkPipeline>(pipeline), layout = static_cast<VkPipelineLayout>(layout)]()
+    {
+        vkDestroyPipeline(vk_device, pipeline, nullptr);
+        vkDestroyPipelineLayout(vk_device, layout, nullptr);
+    });
 }
 
 /*
 
 DescriptorSet::~DescriptorSet()
 {
-    auto& device = Backend::Instance::get()->getDevice();
+    auto& device = Backend::Instance::ref().getDevice();
     vkDestroyDescriptorPool(device->getHandle().as<VkDevice>(), static_cast<VkDescriptorPool>(pool), nullptr);
     vkDestroyDescriptorSetLayout(device->getHandle().as<VkDevice>(), static_cast<VkDescriptorSetLayout>(layout), nullptr);
 }
 
 void DescriptorSet::setImages(uint32_t binding, Backend::Sampler::Type type, const std::vector<std::shared_ptr<Image>>& images)
 {
-    auto& device = Backend::Instance::get()->getDevice();
+    auto& device = Backend::Instance::ref().getDevice();
     auto sampler = device->getSampler(type);
 
     std::vector<VkDescriptorImageInfo> infos;
@@ -184,23 +241,17 @@ Pipeline::Pipeline(Pipeline&& p) :
 
 Pipeline::~Pipeline()
 {
-    auto& device = Backend::Instance::get()->getDevice();
-
-    handle.destroy<VkPipeline>([&device](VkPipeline pipeline)
-    {
-        vkDestroyPipeline(device->getHandle().as<VkDevice>(), pipeline, nullptr);
-    });
+    if (!handle && !layout) return;
 
-    if (layout)
-    {
-        vkDestroyPipelineLayout(device->getHandle().as<VkDevice>(), static_cast<VkPipelineLayout>(layout), nullptr);
-        layout = nullptr;
-    }
+    destroy_pipeline(handle, layout);
+    handle = nullptr;
+    layout = nullptr;
 }
 // TODO: Need to be able to specify vertex or fragment
-void Pipeline::setPushConstant(const std::unique_ptr<Backend::CommandBuffer>& cmd, const void* data) const
+void Pipeline::setPushConstant(const Backend::CommandBuffer& cmd, const void* data) const
 {
-    vkCmdPushConstants(cmd->getHandle().as<VkCommandBuffer>(), static_cast<VkPipelineLayout>(layout), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, push_constant_size, data);
+    const auto& vk = Backend::Instance::ref().getDevice()->getDispatch();
+    vk.vkCmdPushConstants(cmd.getHandle().as<VkCommandBuffer>(), static_cast<VkPipelineLayout>(layout), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, push_constant_size, data);
 }
 
 PipelineBuilder PipelineBuilder::fromLua(const std::string& source_dir, const std::string& script)
@@ -314,37 +365,8 @@ Pipeline PipelineBuilder::build() const
     
     //std::unique_ptr<DescriptorSet> desc;
 
-    const auto layout = [&]()
-    {
-        auto& device = Backend::Instance::get()->getDevice();
-
-        // TODO: Need to be able to specify vertex and/or fragment
-        VkPushConstantRange push_constant = {
-            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-            .offset = 0,
-            .size = push_constant_size
-        };
-
-        std::vector<VkDescriptorSetLayout> setLayouts;
-        setLayouts.reserve(descriptor_layouts.size());
-        for (const auto& d : descriptor_layouts)
-            setLayouts.push_back(d->getHandle().as<VkDescriptorSetLayout>());
-
-        VkPipelineLayoutCreateInfo create_info = {
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-            .pNext = nullptr,
-            .flags = 0,
-            .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
-            .pSetLayouts = reinterpret_cast<const VkDescriptorSetLayout*>(setLayouts.data()),
-            .pushConstantRangeCount = ( push_constant_size ? 1U : 0U ),
-            .pPushConstantRanges = &push_constant
-        };
-
-        VkPipelineLayout layout;
-        const auto err = vkCreatePipelineLayout(device->getHandle().as<VkDevice>(), &create_info, nullptr, &layout);
-        MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error creating pipeline layout");
-        return layout;
-    }();
+    // TODO: Need to be able to specify vertex and/or fragment
+    const auto layout = create_layout(descriptor_layouts, push_constant_size, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
 
     const auto stages = [&]()
     {
@@ -593,7 +615,7 @@ Pipeline PipelineBuilder::build() const
     };
 
     // actually build the graphics pipeline
-    auto& device = Backend::Instance::get()->getDevice();
+    auto& device = Backend::Instance::ref().getDevice();
     
     VkPipeline pipeline;
     const auto err = vkCreateGraphicsPipelines(device->getHandle().as<VkDevice>(), VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline);
@@ -608,4 +630,99 @@ Pipeline PipelineBuilder::build() const
     return p;
 }
 
+ComputePipeline::ComputePipeline(ComputePipeline&& p) :
+    push_constant_size(p.push_constant_size),
+    descriptor_layouts(p.descriptor_layouts),
+    workgroup_size(p.workgroup_size),
+    layout(p.layout)
+{
+    handle = p.handle;
+    p.layout = nullptr;
+    p.handle = nullptr;
+}
+
+ComputePipeline::~ComputePipeline()
+{
+    if (!handle && !layout) return;
+
+    destroy_pipeline(handle, layout);
+    handle = nullptr;
+    layout = nullptr;
+}
+
+void ComputePipeline::setPushConstant(const Backend::CommandBuffer& cmd, const void* data) const
+{
+    const auto& vk = Backend::Instance::ref().getDevice()->getDispatch();
+    vk.vkCmdPushConstants(cmd.getHandle().as<VkCommandBuffer>(), static_cast<VkPipelineLayout>(layout), VK_SHADER_STAGE_COMPUTE_BIT, 0, push_constant_size, data);
+}
+
+ComputePipelineBuilder ComputePipelineBuilder::fromLua(const std::string& source_dir, const std::string& script)
+{
+    SL::Runtime runtime(source_dir + script);
+    const auto res = runtime.getGlobal<SL::Table>("ComputePipeline");
+    MIDNIGHT_ASSERT(res, "Error loading compute pipeline from lua script: Global not found");
+
+    ComputePipelineBuilder builder;
+    res->try_get<SL::String>("shader", [&](const SL::String& dir) { builder.setShader(source_dir + dir); });
+    return builder;
+}
+
+ComputePipelineBuilder& ComputePipelineBuilder::setShader(std::filesystem::path path)
+{
+    shader = std::make_shared<Shader>(path, ShaderType::Compute);
+    return *this;
+}
+
+ComputePipelineBuilder& ComputePipelineBuilder::setShader(std::shared_ptr<Shader> shader)
+{
+    MIDNIGHT_ASSERT(shader->getType() == ShaderType::Compute, "Compute pipelines take a compute shader");
+    this->shader = shader;
+    return *this;
+}
+
+ComputePipelineBuilder& ComputePipelineBuilder::addDescriptorLayout(std::shared_ptr<Descriptor::Layout> d)
+{
+    descriptor_layouts.push_back(d);
+    return *this;
+}
+
+ComputePipeline ComputePipelineBuilder::build() const
+{
+    MIDNIGHT_ASSERT(shader, "Error building compute pipeline: No shader set");
+
+    const auto layout = create_layout(descriptor_layouts, push_constant_size, VK_SHADER_STAGE_COMPUTE_BIT);
+
+    VkComputePipelineCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .pNext = nullptr,
+        .flags = 0,
+        .stage = VkPipelineShaderStageCreateInfo {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .pNext = nullptr,
+            .flags = 0,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = shader->getHandle().as<VkShaderModule>(),
+            .pName = "main",
+            .pSpecializationInfo = nullptr
+        },
+        .layout = layout,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex  = 0
+    };
+
+    auto& device = Backend::Instance::ref().getDevice();
+
+    VkPipeline pipeline;
+    const auto err = vkCreateComputePipelines(device->getHandle().as<VkDevice>(), VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline);
+    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error creating compute pipeline: " << string_VkResult(err));
+
+    ComputePipeline p(pipeline);
+    p.layout = layout;
+    p.push_constant_size = push_constant_size;
+    p.descriptor_layouts = descriptor_layouts;
+    p.workgroup_size = shader->getWorkgroupSize();
+
+    return p;
+}
+
 }
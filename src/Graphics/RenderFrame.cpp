@@ -4,73 +4,89 @@
 
 #include <Graphics/Backend/Instance.hpp>
 #include <Graphics/Backend/Device.hpp>
+#include <Graphics/Backend/Staging.hpp>
+#include <Graphics/Backend/Readback.hpp>
+#include <Graphics/Backend/Dispatch.hpp>
+#include <Graphics/Backend/Barrier.hpp>
 
 #include <vulkan/vulkan.h>
 
 namespace mn::Graphics
 {
 
-// Should make this a function in Backend::Device, it's copied from Window.cpp
-void _transition_image(VkCommandBuffer cmd, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout)
+Backend::CommandBuffer& RenderFrame::command_buffer() const
 {
-    VkImageAspectFlags aspectMask = (new_layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) ? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
-    VkImageMemoryBarrier2 image_barrier = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-        .pNext = nullptr,
-        .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-        .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
-        .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-        .dstAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_MEMORY_READ_BIT,
-        .oldLayout = old_layout,
-        .newLayout = new_layout,
-        .image = image,
-        .subresourceRange = [](VkImageAspectFlags aspectMask)
-            {
-                return VkImageSubresourceRange {
-                    .aspectMask = aspectMask,
-                    .baseMipLevel = 0,
-                    .levelCount = VK_REMAINING_MIP_LEVELS,
-                    .baseArrayLayer = 0,
-                    .layerCount = VK_REMAINING_ARRAY_LAYERS
-                };
-            }(aspectMask)
-    };
-
-    VkDependencyInfo dep_info = {
-        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-        .pNext = nullptr,
-        .imageMemoryBarrierCount = 1,
-        .pImageMemoryBarriers = &image_barrier
-    };
-    
-    auto& device = Backend::Instance::get()->getDevice();
-    PFN_vkVoidFunction pVkCmdPipelineBarrier2KHR = vkGetDeviceProcAddr(device->getHandle().as<VkDevice>(), "vkCmdPipelineBarrier2KHR");
-    ((PFN_vkCmdPipelineBarrier2KHR)(pVkCmdPipelineBarrier2KHR ))(cmd, &dep_info);
-};
+    if (secondary) return *secondary;
+    return ( compute ? *compute : *frame_data->command_buffer );
+}
 
 void RenderFrame::startRender(std::optional<std::shared_ptr<Image>> image) // maybe we can pass in a std::vector of images, then we can add the attachments on
 {
+    start_render(( image ? *image : this->image ), false);
+}
+
+void RenderFrame::startParallelRender(uint32_t workers, std::optional<std::shared_ptr<Image>> image)
+{
+    MIDNIGHT_ASSERT(workers, "Parallel render needs at least one worker");
+
+    const auto use_image = ( image ? *image : this->image );
+    start_render(use_image, true);
+
+    std::vector<u32> color_formats;
+    for (const auto& a : use_image->getColorAttachments())
+        color_formats.push_back(a.format);
+    const auto depth_format = ( use_image->hasDepthAttachment() ? use_image->getDepthAttachment().format : 0 );
+
+    while (frame_data->recorders.size() < workers)
+        frame_data->recorders.push_back(std::make_unique<Backend::CommandPool>(Backend::QueueType::Graphics));
+
+    // Viewport and scissor aren't inherited from the primary command buffer
+    const auto& image_size = use_image->getColorAttachments()[0].size;
+    const VkRect2D scissor = { 0, 0, Math::x( image_size ), Math::y( image_size ) };
+    const VkViewport viewport = { .x = 0, .y = 0, .width = static_cast<float>(Math::x(image_size)), .height = static_cast<float>(Math::y(image_size)), .minDepth = 0, .maxDepth = 1.f };
+
+    recorders.clear();
+    recorders.reserve(workers);
+    for (uint32_t i = 0; i < workers; i++)
+    {
+        // A fresh buffer every time, an earlier parallel render this frame may still be using the last one
+        auto& buffer = frame_data->recorders[i]->next(true);
+        buffer.beginSecondary(color_formats, depth_format);
+        frame_data->dispatch->vkCmdSetScissor(buffer.getHandle().as<VkCommandBuffer>(), 0, 1, &scissor);
+        frame_data->dispatch->vkCmdSetViewport(buffer.getHandle().as<VkCommandBuffer>(), 0, 1, &viewport);
+
+        RenderFrame recorder(image_index, use_image);
+        recorder.frame_data = frame_data;
+        recorder.secondary = &buffer;
+        recorders.push_back(std::move(recorder));
+    }
+}
+
+void RenderFrame::start_render(const std::shared_ptr<Image>& use_image, bool secondary_contents, Backend::BarrierBatch* pending)
+{
+    MIDNIGHT_ASSERT(!secondary, "A recorder can't start a render of its own");
+    MIDNIGHT_ASSERT(!compute, "Async compute has to be ended before rendering");
     const auto cmdBuffer = frame_data->command_buffer->getHandle().as<VkCommandBuffer>();
 
-    const auto use_image = ( image ? *image : this->image);
+    // Uploads queued since the last flush point have to land before we start drawing
+    frame_data->device->getStagingRing().record(*frame_data->command_buffer);
+
+    // Color attachments are loaded, so whatever was drawn or cleared into them is kept.
+    // Depth is cleared on load, so there's nothing to keep.
+    Backend::BarrierBatch own_batch;
+    auto& batch = ( pending ? *pending : own_batch );
 
-    frame_data->resources.insert(use_image);
     std::vector<VkRenderingAttachmentInfo> attachments;
     const auto& color_attachments = use_image->getColorAttachments();
     for (const auto& a : color_attachments)
     {
-        _transition_image(
-            cmdBuffer, 
-            static_cast<VkImage>(a.handle), 
-            VK_IMAGE_LAYOUT_UNDEFINED, 
-            VK_IMAGE_LAYOUT_GENERAL
-        );
+        batch.use(a, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT_KHR | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR);
 
         attachments.push_back(VkRenderingAttachmentInfo {
             .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
             .pNext = nullptr,
             .imageView = static_cast<VkImageView>(a.view),
-            .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
         });
     }
 
@@ -78,12 +94,12 @@ void RenderFrame::startRender(std::optional<std::shared_ptr<Image>> image) // ma
 
     if (use_image->hasDepthAttachment())
     {
-        _transition_image(
-            cmdBuffer, 
-            static_cast<VkImage>(use_image->getDepthAttachment().handle), 
-            VK_IMAGE_LAYOUT_UNDEFINED, 
-            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
-        );
+        batch.use(
+            use_image->getDepthAttachment(),
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+            VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR,
+            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT_KHR | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR,
+            true);
 
         auto attachment_info = VkRenderingAttachmentInfo {
             .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
@@ -97,12 +113,13 @@ void RenderFrame::startRender(std::optional<std::shared_ptr<Image>> image) // ma
 
         depth_attach.emplace(attachment_info);
     }
+    batch.record(*frame_data->dispatch, *frame_data->command_buffer);
 
     const auto& image_size = use_image->getColorAttachments()[0].size;
     VkRenderingInfo render_info = {
         .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
         .pNext = nullptr,
-        .flags = 0,
+        .flags = static_cast<VkRenderingFlags>( secondary_contents ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR : 0 ),
         .renderArea = { 0, 0, Math::x( image_size ), Math::y( image_size ) },
         .layerCount = 1,
         .colorAttachmentCount = static_cast<uint32_t>(attachments.size()), // For a G-buffer, we can attach multiple color attachments
@@ -110,27 +127,45 @@ void RenderFrame::startRender(std::optional<std::shared_ptr<Image>> image) // ma
         .pDepthAttachment = ( depth_attach.has_value() ? &(*depth_attach) : nullptr )
     };
 
-    const auto command_buffer = frame_data->command_buffer->getHandle().as<VkCommandBuffer>();
-
     VkRect2D sc = { 0, 0, Math::x( image_size ), Math::y( image_size ) };
-    vkCmdSetScissor(command_buffer, 0, 1, &sc);
+    frame_data->dispatch->vkCmdSetScissor(cmdBuffer, 0, 1, &sc);
 
     VkViewport extent = { .x = 0, .y = 0, .width = static_cast<float>(Math::x(image_size)), .height = static_cast<float>(Math::y(image_size)), .minDepth = 0, .maxDepth = 1.f };
-    vkCmdSetViewport(command_buffer, 0, 1, &extent);
+    frame_data->dispatch->vkCmdSetViewport(cmdBuffer, 0, 1, &extent);
 
-    auto& device = Backend::Instance::get()->getDevice();
-    auto pvkCmdBeginRenderingKHR = vkGetDeviceProcAddr(device->getHandle().as<VkDevice>(), "vkCmdBeginRenderingKHR");
-    ((PFN_vkCmdBeginRenderingKHR)(pvkCmdBeginRenderingKHR))(
-        command_buffer,
-        &render_info);
+    frame_data->dispatch->vkCmdBeginRenderingKHR(cmdBuffer, &render_info);
+    rendering = true;
 }
 
 void RenderFrame::endRender()
 {
-    auto& device = Backend::Instance::get()->getDevice();
+    MIDNIGHT_ASSERT(!secondary, "A recorder's render is ended by the RenderFrame it came from");
+    const auto cmdBuffer = frame_data->command_buffer->getHandle().as<VkCommandBuffer>();
 
-    auto pvkCmdEndRenderingKHR = vkGetDeviceProcAddr(device->getHandle().as<VkDevice>(), "vkCmdEndRenderingKHR");
-    ((PFN_vkCmdEndRenderingKHR)(pvkCmdEndRenderingKHR))(frame_data->command_buffer->getHandle().as<VkCommandBuffer>());
+    if (!recorders.empty())
+    {
+        std::vector<VkCommandBuffer> buffers;
+        buffers.reserve(recorders.size());
+        for (const auto& recorder : recorders)
+        {
+            recorder.secondary->end();
+            buffers.push_back(recorder.secondary->getHandle().as<VkCommandBuffer>());
+        }
+
+        frame_data->dispatch->vkCmdExecuteCommands(cmdBuffer, static_cast<uint32_t>(buffers.size()), buffers.data());
+
+        // Executing secondary command buffers leaves the primary's bindings undefined
+        forget_bound();
+        for (const auto& recorder : recorders)
+        {
+            bind_stats.issued += recorder.bind_stats.issued;
+            bind_stats.skipped += recorder.bind_stats.skipped;
+        }
+        recorders.clear();
+    }
+
+    frame_data->dispatch->vkCmdEndRenderingKHR(cmdBuffer);
+    rendering = false;
 }
 
 void RenderFrame::clear(std::tuple<float, float, float> color, float alpha, std::optional<std::shared_ptr<Image>> image, int attachment_index) const
@@ -157,22 +192,23 @@ void RenderFrame::clear(std::tuple<float, float, float> color, float alpha, std:
     depthvalue.depth = 0;
     depthvalue.stencil = 0;
 
-    const auto cmdBuffer = frame_data->command_buffer->getHandle().as<VkCommandBuffer>();
+    const auto cmdBuffer = command_buffer().getHandle().as<VkCommandBuffer>();
 
+    // The whole image is cleared, so its contents can go. One barrier for all of them.
     const auto& color_attachments = use_image->getColorAttachments();
+    Backend::BarrierBatch batch(compute != nullptr);
+    for (int i = 0; i < color_attachments.size(); i++)
+        if (attachment_index < 0 || i == attachment_index)
+            batch.use(color_attachments[i], VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, true);
+    batch.record(*frame_data->dispatch, command_buffer());
+
     for (int i = 0; i < color_attachments.size(); i++)
     {
         if (attachment_index >= 0 && i != attachment_index) continue;
 
-        _transition_image(
-            cmdBuffer, 
-            static_cast<VkImage>(color_attachments[i].handle), 
-            VK_IMAGE_LAYOUT_UNDEFINED, 
-            VK_IMAGE_LAYOUT_GENERAL);
-
         //clear image
-        vkCmdClearColorImage(
-            frame_data->command_buffer->getHandle().as<VkCommandBuffer>(), 
+        frame_data->dispatch->vkCmdClearColorImage(
+            cmdBuffer, 
             static_cast<VkImage>(color_attachments[i].handle), 
             VK_IMAGE_LAYOUT_GENERAL, 
             &clearValue, 
@@ -183,19 +219,29 @@ void RenderFrame::clear(std::tuple<float, float, float> color, float alpha, std:
 
 void RenderFrame::setPushConstant(const Pipeline& pipeline, const void* data) const
 {
-    pipeline.setPushConstant(frame_data->command_buffer, data);
+    if (push_constants(bound.graphics, pipeline.getLayoutHandle(), data, pipeline.getPushConstantSize()))
+        pipeline.setPushConstant(command_buffer(), data);
+}
+
+BufferSlice RenderFrame::allocate(std::size_t size, std::size_t alignment) const
+{
+    return frame_data->arena->allocate(size, alignment);
 }
 
 void RenderFrame::blit(const Image::Attachment& source, const Image::Attachment& destination) const
 {
-    // TODO: Need to put underlying image into the resources
-    const auto cmdBuffer = frame_data->command_buffer->getHandle().as<VkCommandBuffer>();
+    const auto cmdBuffer = command_buffer().getHandle().as<VkCommandBuffer>();
 
     const auto& source_attachment      = source;
     const auto& destination_attachment = destination;
 
-    _transition_image(cmdBuffer, static_cast<VkImage>(source_attachment.handle), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-    _transition_image(cmdBuffer, static_cast<VkImage>(destination_attachment.handle), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    MIDNIGHT_ASSERT(!compute, "Blits need the graphics queue");
+
+    // The destination is overwritten whole
+    Backend::BarrierBatch batch;
+    batch.use(source_attachment, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_READ_BIT_KHR);
+    batch.use(destination_attachment, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, true);
+    batch.record(*frame_data->dispatch, command_buffer());
 
     VkImageBlit blit;
     blit.srcOffsets[0] = { 0, 0, 0 };
@@ -222,11 +268,7 @@ void RenderFrame::blit(const Image::Attachment& source, const Image::Attachment&
     blit.dstSubresource.baseArrayLayer = 0;
     blit.dstSubresource.layerCount = 1;
 
-    // Need to set a memory barrier and transition the layouts here
-    // Source needs to become layout_general
-    // Destination needs to become layout_general
-
-    vkCmdBlitImage(
+    frame_data->dispatch->vkCmdBlitImage(
         cmdBuffer,
         static_cast<VkImage>(source_attachment.handle),
         VK_IMAGE_LAYOUT_GENERAL,
@@ -238,25 +280,29 @@ void RenderFrame::blit(const Image::Attachment& source, const Image::Attachment&
     );
 }
 
+std::future<Backend::ReadbackResult> RenderFrame::readback(const Image::Attachment& attachment, const std::filesystem::path& png) const
+{
+    MIDNIGHT_ASSERT(!rendering && !secondary, "Readbacks can't be recorded inside a render");
+    return frame_data->device->getReadbackQueue().record(*frame_data->command_buffer, attachment, png);
+}
+
 void RenderFrame::bind(const std::shared_ptr<Pipeline>& pipeline) const
 {
-    const auto cmdBuffer = frame_data->command_buffer->getHandle().as<VkCommandBuffer>();
+    if (!bind_pipeline(bound.graphics, pipeline->getHandle().get())) return;
 
-    frame_data->resources.insert(pipeline);
-    vkCmdBindPipeline(
-        cmdBuffer,
+    frame_data->dispatch->vkCmdBindPipeline(
+        command_buffer().getHandle().as<VkCommandBuffer>(),
         VK_PIPELINE_BIND_POINT_GRAPHICS,
         pipeline->getHandle().as<VkPipeline>());
 }
 
 void RenderFrame::bind(uint32_t set_index, const std::shared_ptr<Pipeline>& pipeline, const std::shared_ptr<Descriptor>& descriptor) const
 {
-    const auto cmdBuffer = frame_data->command_buffer->getHandle().as<VkCommandBuffer>();
+    if (!bind_set(bound.graphics, pipeline->getLayoutHandle(), set_index, descriptor->getHandle().get())) return;
 
     const auto descriptor_set = descriptor->getHandle().as<VkDescriptorSet>();
-    frame_data->resources.insert(descriptor);
-    vkCmdBindDescriptorSets(
-        cmdBuffer,
+    frame_data->dispatch->vkCmdBindDescriptorSets(
+        command_buffer().getHandle().as<VkCommandBuffer>(),
         VK_PIPELINE_BIND_POINT_GRAPHICS,
         static_cast<VkPipelineLayout>(pipeline->getLayoutHandle()),
         set_index, // It's possible we have to bind *all* the descriptor sets
@@ -268,32 +314,136 @@ void RenderFrame::bind(uint32_t set_index, const std::shared_ptr<Pipeline>& pipe
 
 }
 
-void RenderFrame::draw(uint32_t vertices, uint32_t instances) const
+void RenderFrame::bindVertices(const BufferSlice& vertices, uint32_t binding) const
 {
-    const auto cmdBuffer = frame_data->command_buffer->getHandle().as<VkCommandBuffer>();
+    bind_vertex_buffer(vertices.buffer.get(), vertices.offset, binding);
+}
 
-    vkCmdDraw(
-        cmdBuffer,
-        vertices,
+void RenderFrame::bindIndices(const BufferSlice& indices) const
+{
+    MIDNIGHT_ASSERT(!indices.stride || indices.stride == sizeof(uint32_t), "Index slices must hold uint32_t");
+
+    bind_index_buffer(indices.buffer.get(), indices.offset);
+}
+
+void RenderFrame::bind_vertex_buffer(mn::handle_t buffer, std::size_t offset, uint32_t binding) const
+{
+    const auto changed = ( binding < BoundState::MaxVertexBindings ? bind_range(bound.vertices[binding], buffer, offset) : count(true) );
+    if (!changed) return;
+
+    const auto buff = static_cast<VkBuffer>(buffer);
+    const VkDeviceSize off = offset;
+    frame_data->dispatch->vkCmdBindVertexBuffers(
+        command_buffer().getHandle().as<VkCommandBuffer>(),
+        binding,
+        1,
+        &buff,
+        &off);
+}
+
+void RenderFrame::bind_index_buffer(mn::handle_t buffer, std::size_t offset) const
+{
+    if (!bind_range(bound.indices, buffer, offset)) return;
+
+    frame_data->dispatch->vkCmdBindIndexBuffer(
+        command_buffer().getHandle().as<VkCommandBuffer>(),
+        static_cast<VkBuffer>(buffer),
+        offset,
+        VK_INDEX_TYPE_UINT32);
+}
+
+bool RenderFrame::count(bool issued) const
+{
+    ( issued ? bind_stats.issued : bind_stats.skipped )++;
+    return issued;
+}
+
+bool RenderFrame::bind_pipeline(BoundState::BindPoint& point, mn::handle_t pipeline) const
+{
+    const auto changed = ( point.pipeline != pipeline );
+    point.pipeline = pipeline;
+    return count(changed);
+}
+
+bool RenderFrame::bind_set(BoundState::BindPoint& point, mn::handle_t layout, uint32_t set, mn::handle_t descriptor) const
+{
+    if (set >= BoundState::MaxSets) return count(true);
+
+    // Sets are only remembered for the layout they were bound with. Binding a pipeline
+    // doesn't disturb them, binding sets with another layout might.
+    if (point.sets_layout != layout)
+    {
+        point.sets.fill(nullptr);
+        point.sets_layout = layout;
+    }
+
+    const auto changed = ( point.sets[set] != descriptor );
+    point.sets[set] = descriptor;
+    return count(changed);
+}
+
+bool RenderFrame::push_constants(BoundState::BindPoint& point, mn::handle_t layout, const void* data, std::size_t size) const
+{
+    const auto changed = ( point.push_layout != layout || point.push_constants.size() != size || std::memcmp(point.push_constants.data(), data, size) );
+    if (changed)
+    {
+        const auto bytes = static_cast<const std::byte*>(data);
+        point.push_layout = layout;
+        point.push_constants.assign(bytes, bytes + size);
+    }
+    return count(changed);
+}
+
+bool RenderFrame::bind_range(BoundState::Range& range, mn::handle_t buffer, std::size_t offset) const
+{
+    const auto changed = ( range.buffer != buffer || range.offset != offset );
+    range.buffer = buffer;
+    range.offset = offset;
+    return count(changed);
+}
+
+void RenderFrame::forget_bound() const
+{
+    bound = BoundState();
+}
+
+void RenderFrame::draw(const BufferSlice& vertices, uint32_t instances) const
+{
+    MIDNIGHT_ASSERT(vertices.stride, "Vertex slice has no stride, use RenderFrame::upload or set it");
+
+    bindVertices(vertices);
+    draw(static_cast<uint32_t>(vertices.count()), instances);
+}
+
+void RenderFrame::drawIndexed(const BufferSlice& vertices, const BufferSlice& indices, uint32_t instances) const
+{
+    bindVertices(vertices);
+    bindIndices(indices);
+
+    frame_data->dispatch->vkCmdDrawIndexed(
+        command_buffer().getHandle().as<VkCommandBuffer>(),
+        static_cast<uint32_t>(indices.size / sizeof(uint32_t)),
         instances,
         0,
+        0,
         0);
 }
 
-void RenderFrame::draw(const std::shared_ptr<Buffer>& buffer, uint32_t instances) const
+void RenderFrame::draw(uint32_t vertices, uint32_t instances) const
 {
-    const auto cmdBuffer = frame_data->command_buffer->getHandle().as<VkCommandBuffer>();
+    const auto cmdBuffer = command_buffer().getHandle().as<VkCommandBuffer>();
 
-    frame_data->resources.insert(buffer);
-    const auto buff = buffer->getHandle().as<VkBuffer>();
-    VkDeviceSize off = 0;
-    vkCmdBindVertexBuffers(
+    frame_data->dispatch->vkCmdDraw(
         cmdBuffer,
+        vertices,
+        instances,
         0,
-        1,
-        &buff,
-        &off);
+        0);
+}
 
+void RenderFrame::draw(const std::shared_ptr<Buffer>& buffer, uint32_t instances) const
+{
+    bind_vertex_buffer(buffer->getHandle().get(), buffer->getOffset());
     draw(buffer->vertices(), instances);
 }
 
@@ -314,27 +464,11 @@ void RenderFrame::drawIndexed(
     uint32_t index_offset,
     std::optional<std::size_t> index_count) const
 {
-    const auto cmdBuffer = frame_data->command_buffer->getHandle().as<VkCommandBuffer>();
-
-    frame_data->resources.insert(buffer);
-    const auto buff = buffer->getHandle().as<VkBuffer>();
-    VkDeviceSize off = 0;
-    vkCmdBindVertexBuffers(
-        cmdBuffer,
-        0,
-        1,
-        &buff,
-        &off);
+    bind_vertex_buffer(buffer->getHandle().get(), buffer->getOffset());
+    bind_index_buffer(indices->getHandle().get(), indices->getOffset() + index_offset * sizeof(uint32_t));
 
-    frame_data->resources.insert(indices);
-    vkCmdBindIndexBuffer(
-        cmdBuffer,
-        indices->getHandle().as<VkBuffer>(), 
-        index_offset * sizeof(uint32_t),
-        VK_INDEX_TYPE_UINT32);
-
-    vkCmdDrawIndexed(
-        cmdBuffer,
+    frame_data->dispatch->vkCmdDrawIndexed(
+        command_buffer().getHandle().as<VkCommandBuffer>(),
         (index_count ? *index_count : indices->size()),
         instances,
         0,
@@ -344,10 +478,7 @@ void RenderFrame::drawIndexed(
 
 void RenderFrame::draw(const std::shared_ptr<Pipeline>& pipeline, uint32_t vertices, uint32_t instances) const
 {
-    const auto cmdBuffer = frame_data->command_buffer->getHandle().as<VkCommandBuffer>();
-
     bind(pipeline);
-    
     draw(vertices, instances);
 }
 
@@ -355,18 +486,7 @@ void RenderFrame::draw(const std::shared_ptr<Pipeline>& pipeline, const std::sha
 {
     MIDNIGHT_ASSERT(!(buffer->allocated() % pipeline->getBindingStride()), "Buffer stride is not expected by pipeline!");
 
-    const auto cmdBuffer = frame_data->command_buffer->getHandle().as<VkCommandBuffer>();
-
-    frame_data->resources.insert(buffer);
-    const auto buff = buffer->getHandle().as<VkBuffer>();
-    VkDeviceSize off = 0;
-    vkCmdBindVertexBuffers(
-        cmdBuffer,
-        0,
-        1,
-        &buff,
-        &off);
-
+    bind_vertex_buffer(buffer->getHandle().get(), buffer->getOffset());
     draw(pipeline, buffer->vertices(), instances);
 }
 
@@ -380,6 +500,14 @@ void RenderFrame::draw(const std::shared_ptr<Pipeline>& pipeline, const std::sha
         draw(pipeline, mesh->vertex, instances);
 }
 
+void RenderFrame::draw(const std::shared_ptr<Pipeline>& pipeline, const BufferSlice& vertices, uint32_t instances) const
+{
+    MIDNIGHT_ASSERT(vertices.stride == pipeline->getBindingStride(), "Slice stride is not expected by pipeline!");
+
+    bind(pipeline);
+    draw(vertices, instances);
+}
+
 void RenderFrame::drawIndexed(
     const std::shared_ptr<Pipeline>& pipeline, 
     const std::shared_ptr<Buffer>& buffer, 
@@ -388,11 +516,207 @@ void RenderFrame::drawIndexed(
 {
     MIDNIGHT_ASSERT(!(buffer->allocated() % pipeline->getBindingStride()), "Buffer stride is not expected by pipeline!");
 
-    const auto cmdBuffer = frame_data->command_buffer->getHandle().as<VkCommandBuffer>();
-
     bind(pipeline);
-
     drawIndexed(buffer, indices, instances);
 }
 
+void RenderFrame::bind(const std::shared_ptr<ComputePipeline>& pipeline) const
+{
+    MIDNIGHT_ASSERT(!rendering && !secondary, "Compute work can't be recorded inside a render");
+    if (!bind_pipeline(bound.compute, pipeline->getHandle().get())) return;
+
+    frame_data->dispatch->vkCmdBindPipeline(
+        command_buffer().getHandle().as<VkCommandBuffer>(),
+        VK_PIPELINE_BIND_POINT_COMPUTE,
+        pipeline->getHandle().as<VkPipeline>());
+}
+
+void RenderFrame::bind(uint32_t set_index, const std::shared_ptr<ComputePipeline>& pipeline, const std::shared_ptr<Descriptor>& descriptor) const
+{
+    if (!bind_set(bound.compute, pipeline->getLayoutHandle(), set_index, descriptor->getHandle().get())) return;
+
+    const auto descriptor_set = descriptor->getHandle().as<VkDescriptorSet>();
+    frame_data->dispatch->vkCmdBindDescriptorSets(
+        command_buffer().getHandle().as<VkCommandBuffer>(),
+        VK_PIPELINE_BIND_POINT_COMPUTE,
+        static_cast<VkPipelineLayout>(pipeline->getLayoutHandle()),
+        set_index,
+        1,
+        &descriptor_set,
+        0,
+        nullptr
+    );
+}
+
+void RenderFrame::setPushConstant(const ComputePipeline& pipeline, const void* data) const
+{
+    if (push_constants(bound.compute, pipeline.getLayoutHandle(), data, pipeline.getPushConstantSize()))
+        pipeline.setPushConstant(command_buffer(), data);
+}
+
+void RenderFrame::dispatch(uint32_t x, uint32_t y, uint32_t z) const
+{
+    MIDNIGHT_ASSERT(!rendering && !secondary, "Compute work can't be recorded inside a render");
+    frame_data->dispatch->vkCmdDispatch(command_buffer().getHandle().as<VkCommandBuffer>(), x, y, z);
+}
+
+void RenderFrame::dispatchIndirect(const BufferSlice& args) const
+{
+    MIDNIGHT_ASSERT(!rendering && !secondary, "Compute work can't be recorded inside a render");
+    MIDNIGHT_ASSERT(args.size >= 3 * sizeof(uint32_t), "Indirect dispatch needs three workgroup counts");
+    MIDNIGHT_ASSERT(!(args.offset % 4), "Indirect arguments have to be 4 byte aligned");
+
+    frame_data->dispatch->vkCmdDispatchIndirect(command_buffer().getHandle().as<VkCommandBuffer>(), args.buffer.as<VkBuffer>(), args.offset);
+}
+
+void RenderFrame::dispatchIndirect(const std::shared_ptr<Buffer>& args, std::size_t offset) const
+{
+    MIDNIGHT_ASSERT(offset + 3 * sizeof(uint32_t) <= args->allocated(), "Indirect arguments out of the buffer's bounds");
+
+    dispatchIndirect(BufferSlice {
+        .data = nullptr,
+        .buffer = args->getHandle(),
+        .offset = args->getOffset() + offset,
+        .size = args->allocated() - offset,
+        .address = nullptr
+    });
+}
+
+// Whether the stages behind access exist on a compute only queue
+static bool compute_queue_access(Access access)
+{
+    return access != Access::ShaderRead && access != Access::VertexInput && access != Access::ColorAttachment;
+}
+
+void RenderFrame::barrier(Access before, Access after) const
+{
+    MIDNIGHT_ASSERT(!rendering && !secondary, "Barriers can't be recorded inside a render");
+    MIDNIGHT_ASSERT(!compute || (compute_queue_access(before) && compute_queue_access(after)), "Graphics stages can't be waited on from the compute queue");
+
+    const auto [ src_stage, src_access ] = Backend::access_scope(before);
+    const auto [ dst_stage, dst_access ] = Backend::access_scope(after);
+
+    const VkMemoryBarrier2 memory_barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        .pNext = nullptr,
+        .srcStageMask = src_stage,
+        .srcAccessMask = src_access,
+        .dstStageMask = dst_stage,
+        .dstAccessMask = dst_access
+    };
+
+    const VkDependencyInfo dep_info = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .pNext = nullptr,
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &memory_barrier
+    };
+
+    frame_data->dispatch->vkCmdPipelineBarrier2KHR(command_buffer().getHandle().as<VkCommandBuffer>(), &dep_info);
+}
+
+void RenderFrame::barrier(const BufferSlice& slice, Access before, Access after) const
+{
+    MIDNIGHT_ASSERT(!rendering && !secondary, "Barriers can't be recorded inside a render");
+    MIDNIGHT_ASSERT(!compute || (compute_queue_access(before) && compute_queue_access(after)), "Graphics stages can't be waited on from the compute queue");
+
+    const auto [ src_stage, src_access ] = Backend::access_scope(before);
+    const auto [ dst_stage, dst_access ] = Backend::access_scope(after);
+
+    const VkBufferMemoryBarrier2 buffer_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+        .pNext = nullptr,
+        .srcStageMask = src_stage,
+        .srcAccessMask = src_access,
+        .dstStageMask = dst_stage,
+        .dstAccessMask = dst_access,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = slice.buffer.as<VkBuffer>(),
+        .offset = slice.offset,
+        .size = slice.size
+    };
+
+    const VkDependencyInfo dep_info = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .pNext = nullptr,
+        .bufferMemoryBarrierCount = 1,
+        .pBufferMemoryBarriers = &buffer_barrier
+    };
+
+    frame_data->dispatch->vkCmdPipelineBarrier2KHR(command_buffer().getHandle().as<VkCommandBuffer>(), &dep_info);
+}
+
+void RenderFrame::barrier(const std::shared_ptr<Buffer>& buffer, Access before, Access after) const
+{
+    barrier(BufferSlice {
+        .data = nullptr,
+        .buffer = buffer->getHandle(),
+        .offset = buffer->getOffset(),
+        .size = buffer->allocated(),
+        .address = nullptr
+    }, before, after);
+}
+
+void RenderFrame::barrier(const Image::Attachment& attachment, Access after) const
+{
+    MIDNIGHT_ASSERT(!rendering && !secondary, "Barriers can't be recorded inside a render");
+    MIDNIGHT_ASSERT(!compute || compute_queue_access(after), "Graphics stages can't be waited on from the compute queue");
+
+    const auto [ stages, access ] = Backend::access_scope(after);
+    Backend::BarrierBatch batch(compute != nullptr);
+    batch.use(attachment, Backend::access_layout(after), stages, access);
+    batch.record(*frame_data->dispatch, command_buffer());
+}
+
+void RenderFrame::startAsyncCompute()
+{
+    MIDNIGHT_ASSERT(!rendering && !secondary, "Compute work can't be recorded inside a render");
+    MIDNIGHT_ASSERT(!compute, "Async compute already started");
+
+    // Otherwise it's recorded with everything else
+    if (!frame_data->compute_pool) return;
+
+    compute = &frame_data->compute_pool->next();
+    compute->begin();
+    forget_bound();
+}
+
+void RenderFrame::endAsyncCompute()
+{
+    if (!compute) return;
+
+    compute->end();
+    auto& device = *frame_data->device;
+
+    // The compute may use anything recorded before it, uploads queued since the frame started included
+    device.getStagingRing().record(*frame_data->command_buffer);
+    const auto graphics_ticket = frame_data->submit(false);
+    frame_data->restart();
+
+    // A later compute on the same queue implies the earlier ones, so one ticket is enough
+    frame_data->compute_ticket = device.submitCompute(*compute, graphics_ticket);
+    frame_data->compute_stages = 0;
+    compute = nullptr;
+    forget_bound();
+}
+
+void RenderFrame::waitAsyncCompute(Access consumer)
+{
+    MIDNIGHT_ASSERT(!rendering && !secondary && !compute, "Can only wait for async compute between renders, once it's ended");
+
+    if (!frame_data->compute_pool)
+    {
+        barrier(Access::ComputeWrite, consumer);
+        return;
+    }
+    if (!frame_data->compute_ticket) return;
+
+    // What was recorded up to here goes without waiting, and runs alongside the compute
+    frame_data->submit(false);
+    frame_data->restart();
+    frame_data->compute_stages = Backend::access_scope(consumer).first;
+    forget_bound();
+}
+
 }
@@ -0,0 +1,460 @@
+#include <Graphics/RenderGraph.hpp>
+#include <Graphics/Window.hpp>
+
+#include <Graphics/Backend/Instance.hpp>
+#include <Graphics/Backend/Device.hpp>
+#include <Graphics/Backend/Deletion.hpp>
+#include <Graphics/Backend/Dispatch.hpp>
+
+#include <vulkan/vulkan.h>
+#include <vk_mem_alloc.h>
+
+namespace mn::Graphics
+{
+
+// Colors first, then depth, which is also the order a transient's slots are in
+template<typename F>
+static void each_attachment(const Image& image, F&& f)
+{
+    for (const auto& a : image.getColorAttachments())
+        f(a);
+    if (image.hasDepthAttachment())
+        f(image.getDepthAttachment());
+}
+
+RenderGraph::Pass& RenderGraph::Pass::use(std::vector<Use>& uses, const Use& use)
+{
+    // An image is in one layout at a time, so a pass gets to use it one way
+    MIDNIGHT_ASSERT(&uses == &buffers || std::none_of(uses.begin(), uses.end(), [&](const Use& u) { return u.index == use.index; }),
+        "Pass " << name << " uses the same image more than once");
+
+    uses.push_back(use);
+    return *this;
+}
+
+RenderGraph::Pass& RenderGraph::Pass::render(ImageId image)
+{
+    return use(images, Use{ image.index, Access::ColorAttachment, true, true });
+}
+
+RenderGraph::Pass& RenderGraph::Pass::read(ImageId image, Access access)
+{
+    return use(images, Use{ image.index, access, false, false });
+}
+
+RenderGraph::Pass& RenderGraph::Pass::write(ImageId image, Access access)
+{
+    return use(images, Use{ image.index, access, true, false });
+}
+
+RenderGraph::Pass& RenderGraph::Pass::read(BufferId buffer, Access access)
+{
+    return use(buffers, Use{ buffer.index, access, false, false });
+}
+
+RenderGraph::Pass& RenderGraph::Pass::write(BufferId buffer, Access access)
+{
+    return use(buffers, Use{ buffer.index, access, true, false });
+}
+
+RenderGraph::~RenderGraph()
+{
+    release();
+}
+
+void RenderGraph::reset()
+{
+    passes.clear();
+    images.clear();
+    buffers.clear();
+}
+
+RenderGraph::ImageId RenderGraph::import(const std::shared_ptr<Image>& image)
+{
+    images.push_back(ImageResource{ .image = image });
+    return ImageId{ static_cast<uint32_t>(images.size() - 1) };
+}
+
+RenderGraph::BufferId RenderGraph::import(const std::shared_ptr<Buffer>& buffer)
+{
+    buffers.push_back(BufferResource{ .buffer = buffer });
+    return BufferId{ static_cast<uint32_t>(buffers.size() - 1) };
+}
+
+RenderGraph::ImageId RenderGraph::create(const ImageDesc& desc)
+{
+    MIDNIGHT_ASSERT(Math::x(desc.size) && Math::y(desc.size), "Transient image can't be empty");
+    MIDNIGHT_ASSERT(!desc.colors.empty(), "Transient images need a color attachment, renders are sized by it");
+
+    images.push_back(ImageResource{ .desc = desc });
+    return ImageId{ static_cast<uint32_t>(images.size() - 1) };
+}
+
+RenderGraph::Pass& RenderGraph::addPass(std::string name, std::function<void(RenderFrame&)> execute)
+{
+    Pass pass;
+    pass.name = std::move(name);
+    pass.execute = std::move(execute);
+    passes.push_back(std::move(pass));
+    return passes.back();
+}
+
+const std::shared_ptr<Image>& RenderGraph::getImage(ImageId image) const
+{
+    MIDNIGHT_ASSERT(image.index < images.size(), "Image isn't part of this graph");
+    return images[image.index].image;
+}
+
+std::vector<uint32_t> RenderGraph::cull() const
+{
+    // The last pass to write each resource so far, as the passes are walked in order
+    std::vector<int64_t> image_writer(images.size(), -1), buffer_writer(buffers.size(), -1);
+    std::vector<std::vector<uint32_t>> producers(passes.size());
+    std::vector<bool> needed(passes.size(), false);
+
+    for (uint32_t p = 0; p < passes.size(); p++)
+    {
+        const auto& pass = passes[p];
+        needed[p] = pass.kept;
+
+        const auto visit = [&](const std::vector<Pass::Use>& uses, std::vector<int64_t>& writer, auto imported)
+        {
+            for (const auto& use : uses)
+            {
+                MIDNIGHT_ASSERT(use.index < writer.size(), "Pass " << pass.name << " uses a resource that isn't part of this graph");
+
+                // Renders load what's there, so writes depend on the last write as much as reads do
+                if (writer[use.index] >= 0)
+                    producers[p].push_back(static_cast<uint32_t>(writer[use.index]));
+
+                if (use.write)
+                {
+                    writer[use.index] = p;
+
+                    // Imported resources outlive the graph, anything written to them is an output
+                    if (imported(use.index)) needed[p] = true;
+                }
+            }
+        };
+        visit(pass.images, image_writer, [this](uint32_t i) { return !images[i].desc.has_value(); });
+        visit(pass.buffers, buffer_writer, [](uint32_t) { return true; });
+    }
+
+    // Producers always come before the passes that use their results, one walk back covers it
+    for (auto p = passes.size(); p-- > 0;)
+        if (needed[p])
+            for (const auto producer : producers[p])
+                needed[producer] = true;
+
+    std::vector<uint32_t> order;
+    for (uint32_t p = 0; p < passes.size(); p++)
+        if (needed[p]) order.push_back(p);
+    return order;
+}
+
+void RenderGraph::place(std::vector<Signature>&& layout)
+{
+    if (layout == signature) return;
+
+    release();
+    signature = std::move(layout);
+    if (signature.empty()) return;
+
+    auto& instance = Backend::Instance::ref();
+    auto& device = instance.getDevice();
+    const auto vk_device = device->getHandle().as<VkDevice>();
+    const auto allocator = static_cast<VmaAllocator>(instance.getAllocator());
+
+    // Every attachment is an image of its own, and gets placed on its own
+    struct Candidate
+    {
+        uint32_t transient;
+        u32 format;
+        bool depth, storage;
+        VkImage image;
+        VkMemoryRequirements requirements;
+    };
+
+    std::vector<Candidate> candidates;
+    for (uint32_t t = 0; t < signature.size(); t++)
+    {
+        const auto& s = signature[t];
+        const auto add = [&](u32 format, bool depth)
+        {
+            const bool storage = s.storage && !depth;
+            Candidate c = {
+                .transient = t,
+                .format = format,
+                .depth = depth,
+                .storage = storage,
+                .image = device->createUnboundImage(Math::Vec2u{ s.width, s.height }, format, depth, storage).as<VkImage>()
+            };
+            vkGetImageMemoryRequirements(vk_device, c.image, &c.requirements);
+            candidates.push_back(c);
+        };
+
+        for (const auto format : s.colors)
+            add(format, false);
+        if (s.depth)
+            add(Image::DF32_SU8, true);
+    }
+
+    // Transients are numbered in order of first use. In that order, each attachment goes into a
+    // slot whose last occupant is done by then: the smallest one that's big enough, or else the
+    // biggest one, which grows to fit it.
+    struct Placement
+    {
+        VkDeviceSize size, alignment;
+        uint32_t memory_types, last;
+    };
+
+    std::vector<Placement> placements;
+    std::vector<uint32_t> candidate_slot(candidates.size());
+    for (uint32_t c = 0; c < candidates.size(); c++)
+    {
+        const auto& requirements = candidates[c].requirements;
+        const auto& s = signature[candidates[c].transient];
+
+        std::optional<uint32_t> best;
+        for (uint32_t i = 0; i < placements.size(); i++)
+        {
+            const auto& p = placements[i];
+            if (p.last >= s.first || !(p.memory_types & requirements.memoryTypeBits)) continue;
+            if (!best) { best = i; continue; }
+
+            const auto& b = placements[*best];
+            const bool fits = ( p.size >= requirements.size ), best_fits = ( b.size >= requirements.size );
+            if (fits ? (!best_fits || p.size < b.size) : (!best_fits && p.size > b.size))
+                best = i;
+        }
+
+        if (!best)
+        {
+            best = static_cast<uint32_t>(placements.size());
+            placements.push_back(Placement{ 0, 1, ~0u, 0 });
+        }
+
+        auto& p = placements[*best];
+        p.size = std::max(p.size, requirements.size);
+        p.alignment = std::max(p.alignment, requirements.alignment);
+        p.memory_types &= requirements.memoryTypeBits;
+        p.last = s.last;
+
+        candidate_slot[c] = *best;
+        transient_bytes += requirements.size;
+    }
+
+    // An allocation of its own per slot, without an owner, so defragmentation leaves it be
+    for (const auto& p : placements)
+    {
+        const VkMemoryRequirements requirements = {
+            .size = p.size,
+            .alignment = p.alignment,
+            .memoryTypeBits = p.memory_types
+        };
+
+        const VmaAllocationCreateInfo alloc_create_info = {
+            .usage = VMA_MEMORY_USAGE_GPU_ONLY,
+            .requiredFlags = static_cast<VkMemoryPropertyFlags>(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+        };
+
+        VmaAllocation allocation;
+        const auto err = vmaAllocateMemory(allocator, &requirements, &alloc_create_info, &allocation, nullptr);
+        MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error allocating transient image memory: " << err);
+
+        slots.push_back(Slot{ .allocation = static_cast<mn::handle_t>(allocation), .occupant = nullptr });
+        allocated_bytes += p.size;
+    }
+
+    // Views can only be made of bound images, so the Images come last
+    std::vector<ImageFactory> factories(signature.size());
+    transients.resize(signature.size());
+    for (uint32_t c = 0; c < candidates.size(); c++)
+    {
+        const auto& candidate = candidates[c];
+        const auto err = vmaBindImageMemory(allocator, static_cast<VmaAllocation>(slots[candidate_slot[c]].allocation), candidate.image);
+        MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error binding transient image memory: " << err);
+        transient_images.push_back(static_cast<mn::handle_t>(candidate.image));
+
+        const auto& s = signature[candidate.transient];
+        const auto size = Math::Vec2u{ s.width, s.height };
+        const auto usage = device->getImageUsage(candidate.format, candidate.depth, candidate.storage);
+        if (candidate.depth)
+            factories[candidate.transient].addImage<Image::DepthStencil>(static_cast<mn::handle_t>(candidate.image), candidate.format, size, usage);
+        else
+            factories[candidate.transient].addImage<Image::Color>(static_cast<mn::handle_t>(candidate.image), candidate.format, size, usage);
+        transients[candidate.transient].slots.push_back(candidate_slot[c]);
+    }
+
+    for (uint32_t t = 0; t < signature.size(); t++)
+        transients[t].image = std::make_shared<Image>(factories[t].build());
+}
+
+void RenderGraph::release()
+{
+    if (transient_images.empty() && slots.empty()) return;
+
+    auto& instance = Backend::Instance::ref();
+    auto& device = instance.getDevice();
+    const auto vk_device = device->getHandle().as<VkDevice>();
+    const auto allocator = static_cast<VmaAllocator>(instance.getAllocator());
+
+    // The Images go first, so their views are queued ahead of what they're views of
+    for (auto& image : images)
+        if (image.desc) image.image.reset();
+    transients.clear();
+
+    std::vector<mn::handle_t> allocations;
+    for (const auto& slot : slots)
+        allocations.push_back(slot.allocation);
+
+    // Frames in flight may still be using them
+    device->getDeletionQueue().push([vk_device, allocator, vk_images = std::move(transient_images), allocations = std::move(allocations)]()
+    {
+        for (const auto image : vk_images)
+            vkDestroyImage(vk_device, static_cast<VkImage>(image), nullptr);
+        for (const auto allocation : allocations)
+            vmaFreeMemory(allocator, static_cast<VmaAllocation>(allocation));
+    });
+
+    transient_images.clear();
+    slots.clear();
+    signature.clear();
+    transient_bytes = allocated_bytes = 0;
+}
+
+void RenderGraph::execute(RenderFrame& rf)
+{
+    MIDNIGHT_ASSERT(!rf.rendering && !rf.secondary && !rf.compute, "Render graphs are executed outside of renders and async compute");
+
+    const auto order = cull();
+    for (auto& image : images)
+        image.transient.reset();
+
+    // Transients get their place from the positions of the first and last pass that uses them
+    std::vector<Signature> layout;
+    for (uint32_t position = 0; position < order.size(); position++)
+    {
+        const auto& pass = passes[order[position]];
+        for (const auto& use : pass.images)
+        {
+            auto& image = images[use.index];
+            if (!image.desc) continue;
+
+            if (!image.transient)
+            {
+                // Whatever wrote it first would be running, so nothing did
+                MIDNIGHT_ASSERT(use.write, "Pass " << pass.name << " reads a transient image before anything writes to it");
+
+                image.transient = static_cast<uint32_t>(layout.size());
+                image.first = position;
+                layout.push_back(Signature {
+                    .width = Math::x(image.desc->size),
+                    .height = Math::y(image.desc->size),
+                    .colors = image.desc->colors,
+                    .depth = image.desc->depth,
+                    .storage = false,
+                    .first = position,
+                    .last = position
+                });
+            }
+
+            // Only transients compute works on are made storage images, it costs the rest compression
+            if (use.access == Access::ComputeRead || use.access == Access::ComputeWrite)
+                layout[*image.transient].storage = true;
+
+            image.last = position;
+            layout[*image.transient].last = position;
+        }
+    }
+
+    place(std::move(layout));
+    for (auto& image : images)
+        if (image.transient) image.image = transients[*image.transient].image;
+
+    // Nothing's known about buffers the graph hasn't seen before, their first use waits on everything
+    const auto key = [](const std::shared_ptr<Buffer>& buffer) { return std::pair(buffer->getHandle().get(), buffer->getOffset()); };
+    std::map<std::pair<mn::handle_t, std::size_t>, Backend::BufferUsage> usage;
+    for (const auto& b : buffers)
+    {
+        const auto previous = buffer_usage.find(key(b.buffer));
+        usage.emplace(key(b.buffer), previous != buffer_usage.end() ? previous->second : Backend::BufferUsage {
+            .write_stages = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
+            .write_access = VK_ACCESS_2_MEMORY_WRITE_BIT_KHR
+        });
+    }
+    buffer_usage = std::move(usage);
+
+    Backend::BarrierBatch batch;
+    for (uint32_t position = 0; position < order.size(); position++)
+    {
+        const auto& pass = passes[order[position]];
+        std::shared_ptr<Image> target;
+
+        for (const auto& use : pass.images)
+        {
+            const auto& resource = images[use.index];
+
+            // Whatever was in a transient's memory before has to be done with it first,
+            // earlier in this frame or in the last one
+            if (resource.transient && resource.first == position)
+            {
+                const auto& transient = transients[*resource.transient];
+                uint32_t attachment = 0;
+                each_attachment(*resource.image, [&](const Image::Attachment& a)
+                {
+                    auto& slot = slots[transient.slots[attachment++]];
+                    const auto* previous = ( slot.occupant ? slot.occupant : &a );
+                    a.discard(previous->write_stages | previous->read_stages, previous->write_access);
+                    slot.occupant = &a;
+                });
+            }
+
+            // startRender adds its own
+            if (use.target)
+            {
+                target = resource.image;
+                continue;
+            }
+
+            const auto scope = Backend::access_scope(use.access);
+            const auto layout = Backend::access_layout(use.access);
+            each_attachment(*resource.image, [&](const Image::Attachment& a)
+            {
+                batch.use(a, layout, scope.first, scope.second);
+            });
+        }
+
+        for (const auto& use : pass.buffers)
+        {
+            const auto& buffer = buffers[use.index].buffer;
+            if (!buffer->allocated()) continue;
+
+            const auto [ stages, access ] = Backend::access_scope(use.access);
+            batch.use(buffer_usage.at(key(buffer)), buffer->getHandle().get(), buffer->getOffset(), buffer->allocated(), stages, access);
+        }
+
+        if (target)
+        {
+            rf.start_render(target, false, &batch);
+            pass.execute(rf);
+            rf.endRender();
+        }
+        else
+        {
+            batch.record(*rf.frame_data->dispatch, *rf.frame_data->command_buffer);
+            pass.execute(rf);
+            MIDNIGHT_ASSERT(!rf.rendering && !rf.compute, "Pass " << pass.name << " left a render or async compute open");
+        }
+    }
+
+    frame_stats = Stats {
+        .passes = static_cast<uint32_t>(order.size()),
+        .culled = static_cast<uint32_t>(passes.size() - order.size()),
+        .barriers = batch.recorded(),
+        .transient_bytes = transient_bytes,
+        .allocated_bytes = allocated_bytes
+    };
+}
+
+}
@@ -1,5 +1,5 @@
 #include <midnight/Graphics/Backend/Instance.hpp>
-#include <midnight/Graphics/Backend/Command.hpp>
+#include <midnight/Graphics/Backend/Upload.hpp>
 #include <midnight/Graphics/Texture.hpp>
 #include <midnight/Graphics/Buffer.hpp>
 
@@ -30,21 +30,18 @@ namespace mn::Graphics
                 .build()
         );
 
-        // Allocate the GPU buffer "staging" zone
-        auto image_data = std::make_shared<mn::Graphics::TypeBuffer<uint8_t>>();
-        image_data->resize(x * y * 4);
-
-        // Copy the CPU data into the GPU region
-        std::memcpy(&image_data->at(0), data, x * y * 4);
+        // Copy the pixels on the transfer queue, without waiting for them. Frames don't wait for
+        // the copy either, the texture can be sampled once ready() says so.
+        auto& uploads = Backend::Instance::ref().getDevice()->getUploadEngine();
+        uploads.upload(image, 0, data, x * y * 4);
+        ticket = uploads.submit();
 
         // Free the CPU data
         STBI_FREE(data);
+    }
 
-        // Copy the staging data into the GPU image data
-        auto& device = Backend::Instance::get()->getDevice();
-        device->immediateSubmit([this, &image_data](mn::Graphics::Backend::CommandBuffer& cmd)
-        {
-            cmd.bufferToImage(image_data, image->getColorAttachments()[0]);
-        });
+    bool Texture::ready() const
+    {
+        return image && Backend::Instance::ref().getDevice()->getUploadEngine().acquired(ticket);
     }
 }
\ No newline at end of file
@@ -2,6 +2,12 @@
 #include <Graphics/RenderFrame.hpp>
 
 #include <Graphics/Backend/Instance.hpp>
+#include <Graphics/Backend/Staging.hpp>
+#include <Graphics/Backend/Deletion.hpp>
+#include <Graphics/Backend/Readback.hpp>
+#include <Graphics/Backend/Upload.hpp>
+#include <Graphics/Backend/Dispatch.hpp>
+#include <Graphics/Backend/Barrier.hpp>
 
 #include <imgui.h>
 #include <implot.h>
@@ -20,40 +26,90 @@ namespace mn::Graphics
 {
 using handle_t = mn::handle_t;
 
+constexpr std::size_t FRAME_ARENA_SIZE = 4 * 1024 * 1024;
+
+// Recreations in a row that acquire can still say are out of date before it's taken as an error
+constexpr uint32_t MAX_SWAPCHAIN_RETRIES = 8;
+
 void FrameData::release() 
 {
-    resources.clear();
+    command_pool->reset();
+    for (auto& pool : recorders)
+        pool->reset();
+    command_buffer = &command_pool->next();
+    if (compute_pool) compute_pool->reset();
+
+    image_acquired = nullptr;
+    compute_ticket = 0;
+    compute_stages = 0;
+    transfer_ticket = 0;
+
+    arena->reset();
+}
+
+Backend::GpuTimeline::Ticket FrameData::submit(bool last, Handle<Backend::Semaphore> render_finished)
+{
+    command_buffer->end();
+
+    // Async compute nobody said they were waiting for still has to be done by the end of the frame
+    const uint64_t stages = ( last && !compute_stages ? VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT : compute_stages );
+    const auto compute_wait = ( stages ? compute_ticket : 0 );
+
+    ticket = device->submit(*command_buffer, image_acquired, render_finished, compute_wait, stages, transfer_ticket);
+
+    image_acquired = nullptr;
+    transfer_ticket = 0;
+    if (compute_wait)
+    {
+        compute_ticket = 0;
+        compute_stages = 0;
+    }
+    return ticket;
+}
+
+void FrameData::restart()
+{
+    command_buffer = &command_pool->next();
+    command_buffer->begin();
 }
 
 void FrameData::create()
 {
-    auto& device = Backend::Instance::get()->getDevice();
-    command_pool = std::make_unique<Graphics::Backend::CommandPool>();
-    command_buffer = command_pool->allocateBuffer();
+    device   = Backend::Instance::ref().getDevice().get();
+    dispatch = &device->getDispatch();
+
+    command_pool = std::make_unique<Graphics::Backend::CommandPool>(Backend::QueueType::Graphics);
+    command_buffer = &command_pool->next();
+
+    if (device->hasComputeQueue())
+        compute_pool = std::make_unique<Graphics::Backend::CommandPool>(Backend::QueueType::Compute);
 
     // create semaphores
-    render_sem    = std::make_unique<Backend::Semaphore>();
     swapchain_sem = std::make_unique<Backend::Semaphore>();
-    render_fence  = std::make_unique<Backend::Fence>();
+    ticket = 0;
+
+    arena = std::make_unique<Backend::FrameArena>(FRAME_ARENA_SIZE);
 }
 
 void FrameData::destroy()
 {
-    render_sem.reset();
+    recorders.clear();
+    compute_pool.reset();
+    command_buffer = nullptr;
     swapchain_sem.reset();
-    render_fence.reset();
+    arena.reset();
     command_pool.reset();
 }
 
-Window::Window(const Math::Vec2u& size, const std::string& name)
+Window::Window(const Math::Vec2u& size, const std::string& name, const WindowOptions& options)
 {
-    _open(size, name);
+    _open(size, name, options);
 
     // IF IMGUI
     ImGui::CreateContext();
     ImPlot::CreateContext();
     ImGui_ImplSDL3_InitForVulkan(handle.as<SDL_Window*>());
-    const auto& instance = Backend::Instance::get();
+    auto& instance = Backend::Instance::ref();
 
     VkPipelineRenderingCreateInfoKHR c_info{};
     
@@ -64,15 +120,15 @@ Window::Window(const Math::Vec2u& size, const std::string& name)
     c_info.depthAttachmentFormat = VkFormat::VK_FORMAT_D32_SFLOAT_S8_UINT;
 
     ImGui_ImplVulkan_InitInfo init_info = {};
-	init_info.Instance = instance->getHandle().as<VkInstance>();
-	init_info.PhysicalDevice = static_cast<VkPhysicalDevice>( instance->getDevice()->getPhysicalDevice() );
-	init_info.Device = instance->getDevice()->getHandle().as<VkDevice>();
-	init_info.Queue = static_cast<VkQueue>( instance->getDevice()->getGraphicsQueue().handle );
-	init_info.DescriptorPool = static_cast<VkDescriptorPool>( instance->getDevice()->getImGuiPool() );
+	init_info.Instance = instance.getHandle().as<VkInstance>();
+	init_info.PhysicalDevice = static_cast<VkPhysicalDevice>( instance.getDevice()->getPhysicalDevice() );
+	init_info.Device = instance.getDevice()->getHandle().as<VkDevice>();
+	init_info.Queue = static_cast<VkQueue>( instance.getDevice()->getGraphicsQueue().handle );
+	init_info.DescriptorPool = static_cast<VkDescriptorPool>( instance.getDevice()->getImGuiPool() );
     init_info.PipelineRenderingCreateInfo = c_info;
     init_info.UseDynamicRendering = true;
-	init_info.MinImageCount = 3;
-	init_info.ImageCount = 3;
+	init_info.MinImageCount = std::max<uint32_t>(2, static_cast<uint32_t>(images.size()));
+	init_info.ImageCount = static_cast<uint32_t>(images.size());
 	init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
 
     // Actually create the imgui image
@@ -95,7 +151,7 @@ Window::Window(const std::string& config_file)
     MIDNIGHT_ASSERT(!SDL_Init(SDL_INIT_VIDEO), "Error initializing video");
 
     // Read in the window information from the file
-    const auto [title, width, height] = (config_file.length() ? [](const std::string& file)
+    const auto [title, width, height, options] = (config_file.length() ? [](const std::string& file)
     {
         SL::Runtime runtime(SOURCE_DIR "/" + file);
         const auto res = runtime.getGlobal<SL::Table>("WindowOptions");
@@ -104,58 +160,121 @@ Window::Window(const std::string& config_file)
         const auto string = res->get<SL::String>("title");
         const auto w = res->get<SL::Table>("size").get<SL::Number>("w");
         const auto h = res->get<SL::Table>("size").get<SL::Number>("h");
-        return std::tuple(string, w, h);
-    }(config_file) : std::tuple("window", 1280, 720) );
 
-    _open({ width, height }, title);   
+        WindowOptions options;
+        res->try_get<SL::Number>("frames_in_flight", [&](const SL::Number& frames){ options.frames_in_flight = static_cast<uint32_t>(frames); });
+        res->try_get<SL::Number>("image_count", [&](const SL::Number& count){ options.image_count = static_cast<uint32_t>(count); });
+        res->try_get<SL::Number>("present_latency", [&](const SL::Number& latency){ options.present_latency = static_cast<uint32_t>(latency); });
+        res->try_get<SL::String>("present_mode", [&](const SL::String& mode)
+        {
+            if      (mode == "fifo")         options.present_mode = PresentMode::Fifo;
+            else if (mode == "fifo_relaxed") options.present_mode = PresentMode::FifoRelaxed;
+            else if (mode == "mailbox")      options.present_mode = PresentMode::Mailbox;
+            else if (mode == "immediate")    options.present_mode = PresentMode::Immediate;
+            else MIDNIGHT_ASSERT(false, "Unknown present mode: " << mode);
+        });
+        return std::tuple(string, w, h, options);
+    }(config_file) : std::tuple("window", 1280, 720, WindowOptions{}) );
+
+    _open({ width, height }, title, options);   
 }
 
-void Window::construct_swapchain()
+void Window::construct_swapchain(mn::handle_t old_swapchain)
 {
-    auto& device = Backend::Instance::get()->getDevice();
-    const auto [ s, _images, format, size ] = device->createSwapchain(handle, surface);
+    auto& device = Backend::Instance::ref().getDevice();
+    const auto [ s, _images, format, size, usage ] = device->createSwapchain(handle, surface, options.present_mode, options.image_count, old_swapchain);
     for (const auto& image : _images)
     {
         images.emplace_back(std::make_shared<Image>(
             ImageFactory()
-                .addImage<Image::Color>(image, format, size)
+                .addImage<Image::Color>(image, format, size, usage)
                 .addAttachment<Image::DepthStencil>(Image::DF32_SU8, size)
                 .build()
         ));
     }
     swapchain = s;
+    _size = size;
+    swapchain_dirty = false;
+    first_present_id = present_id + 1;
+
+    images_in_flight.assign(images.size(), 0);
+    render_sems.clear();
+    for (std::size_t i = 0; i < images.size(); i++)
+        render_sems.push_back(std::make_unique<Backend::Semaphore>());
 }
 
-void Window::_open(const Math::Vec2u& req_size, const std::string& name)
+void Window::_open(const Math::Vec2u& req_size, const std::string& name, const WindowOptions& options)
 {
+    MIDNIGHT_ASSERT(options.frames_in_flight > 0, "Need at least one frame in flight");
+
     // Create the window
     handle = static_cast<handle_t>(SDL_CreateWindow(name.c_str(), Math::x(req_size), Math::y(req_size), SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE));
     MIDNIGHT_ASSERT(handle, "Error initializing window");
     
     _size = req_size;
+    this->options = options;
+    present_id = 0;
 
-    auto instance = mn::Graphics::Backend::Instance::get();
-    const auto& device = instance->getDevice();
-    surface   = instance->createSurface(handle);
+    auto& instance = mn::Graphics::Backend::Instance::ref();
+    const auto& device = instance.getDevice();
+    surface   = instance.createSurface(handle);
 
     construct_swapchain();
 
-    uint32_t concurrent_frames = 2;
-    for (uint32_t i = 0; i < concurrent_frames; i++)
+    for (uint32_t i = 0; i < options.frames_in_flight; i++)
     {
         auto fd = std::make_shared<FrameData>();
         fd->create();
         frame_data.push_back(fd);
     }
 
+    frame_count = 0;
     _close = false;
 }
 
+void Window::recreate_swapchain() const
+{
+    // Gross, but the swapchain has to be swapped out from inside startFrame
+    auto* self = const_cast<Window*>(this);
+
+    auto& device = Backend::Instance::ref().getDevice();
+    auto& deletion = device->getDeletionQueue();
+    const auto vk_device = device->getHandle().as<VkDevice>();
+
+    // A minimized window's surface is zero sized, which no swapchain can be made for. Wait
+    // until it's restored, only pumping events so pollEvent still gets to see all of them.
+    auto extent = device->getSurfaceExtent(handle, surface);
+    while (!Math::x(extent) || !Math::y(extent))
+    {
+        SDL_Delay(10);
+        SDL_PumpEvents();
+        extent = device->getSurfaceExtent(handle, surface);
+    }
+
+    // Frames in flight may still render into the old images or wait on their semaphores.
+    // Their attachments go to the deletion queue as the images are dropped, the semaphores
+    // and the swapchain itself follow them.
+    const auto old_swapchain = swapchain;
+    self->images.clear();
+    for (auto& sem : self->render_sems)
+        deletion.push([vk_device, s = sem->release().as<VkSemaphore>()]() { vkDestroySemaphore(vk_device, s, nullptr); });
+    self->render_sems.clear();
+
+    self->construct_swapchain(old_swapchain);
+
+    deletion.push([vk_device, s = static_cast<VkSwapchainKHR>(old_swapchain)]() { vkDestroySwapchainKHR(vk_device, s, nullptr); });
+}
+
 Window::Window(Window&& window) :
     _close(window._close),
     handle(window.handle),
     surface(window.surface),
-    swapchain(window.swapchain)
+    swapchain(window.swapchain),
+    frame_count(window.frame_count),
+    options(window.options),
+    present_id(window.present_id),
+    first_present_id(window.first_present_id),
+    swapchain_dirty(window.swapchain_dirty)
 {
     window.handle = nullptr;
     window.surface = nullptr;
@@ -207,16 +326,8 @@ bool Window::pollEvent(Event& event) const
         const uint32_t new_width  = e.window.data1;
         const uint32_t new_height = e.window.data2;
 
-        auto& device = Backend::Instance::get()->getDevice();
-        device->waitForIdle();
-
-        device->destroySwapchain(swapchain);
-        // Gross
-        auto* abused_window = const_cast<Window*>(this);
-        abused_window->images.clear();
-        abused_window->construct_swapchain();
-
-        abused_window->_size = Math::Vec2u{ new_width, new_height };
+        // A drag sends a stream of these, only the next frame has to match the window
+        swapchain_dirty = true;
 
         event.event = Event::WindowSize{ .new_width = new_width, .new_height = new_height };
         break;
@@ -245,62 +356,54 @@ bool Window::pollEvent(Event& event) const
     return res;
 }
 
-void transition_image(VkCommandBuffer cmd, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout)
-{
-    VkImageAspectFlags aspectMask = (new_layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) ? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
-    VkImageMemoryBarrier2 image_barrier = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-        .pNext = nullptr,
-        .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-        .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
-        .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-        .dstAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_MEMORY_READ_BIT,
-        .oldLayout = old_layout,
-        .newLayout = new_layout,
-        .image = image,
-        .subresourceRange = [](VkImageAspectFlags aspectMask)
-            {
-                return VkImageSubresourceRange {
-                    .aspectMask = aspectMask,
-                    .baseMipLevel = 0,
-                    .levelCount = VK_REMAINING_MIP_LEVELS,
-                    .baseArrayLayer = 0,
-                    .layerCount = VK_REMAINING_ARRAY_LAYERS
-                };
-            }(aspectMask)
-    };
-
-    VkDependencyInfo dep_info = {
-        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-        .pNext = nullptr,
-        .imageMemoryBarrierCount = 1,
-        .pImageMemoryBarriers = &image_barrier
-    };
-    
-    auto& device = Backend::Instance::get()->getDevice();
-    PFN_vkVoidFunction pVkCmdPipelineBarrier2KHR = vkGetDeviceProcAddr(device->getHandle().as<VkDevice>(), "vkCmdPipelineBarrier2KHR");
-    ((PFN_vkCmdPipelineBarrier2KHR)(pVkCmdPipelineBarrier2KHR ))(cmd, &dep_info);
-};
-
 RenderFrame Window::startFrame() const
 {
+    auto& device = Backend::Instance::ref().getDevice();
+    auto& staging = device->getStagingRing();
+
+    // Pace the CPU on what's actually been displayed, so input sampled this frame is at most
+    // present_latency presents away from the screen. A timeout just means we stop pacing this frame.
+    // Ids from before the swapchain was recreated were never presented to it, so there's nothing to
+    // pace on until it's had present_latency presents of its own, nor with one about to be replaced.
+    if (options.present_latency && device->hasPresentWait() && !swapchain_dirty &&
+        present_id >= first_present_id + options.present_latency)
+        device->waitForPresent(swapchain, present_id - options.present_latency, 100'000'000);
+
+    // Only blocks if the GPU is more than frames_in_flight frames behind
+    const auto& timeline = device->getTimeline();
     auto next_frame = get_next_frame();
-    next_frame->render_fence->wait();
+    timeline.wait(next_frame->ticket);
+    staging.retire();
+    device->getDeletionQueue().collect();
     next_frame->release();
-    // Free resources
-    next_frame->render_fence->reset();
-    auto n_image = next_image_index(next_frame);
+    device->nextFrame();
 
-    auto& device = Backend::Instance::get()->getDevice();
-    vkQueueWaitIdle(static_cast<VkQueue>(device->getGraphicsQueue().handle));
-    next_frame->command_buffer->reset();
+    if (swapchain_dirty)
+        recreate_swapchain();
+
+    auto acquired = next_image_index(next_frame);
+    for (uint32_t retries = 0; !acquired; retries++)
+    {
+        MIDNIGHT_ASSERT(retries < MAX_SWAPCHAIN_RETRIES, "Swapchain still out of date after " << retries << " recreations");
+        recreate_swapchain();
+        acquired = next_image_index(next_frame);
+    }
+    const auto n_image = *acquired;
+
+    // The image may still be in use by a different frame than the one we waited on
+    // (more swapchain images than frames in flight, or acquire handing them back out of order)
+    timeline.wait(images_in_flight[n_image]);
+
+    next_frame->image_acquired = next_frame->swapchain_sem->getHandle();
     next_frame->command_buffer->begin();
 
-    auto _image = static_cast<VkImage>(images[n_image]->getColorAttachments()[0].handle);
-    auto _depth_image = static_cast<VkImage>(images[n_image]->getDepthAttachment().handle);
-    auto _cmd   = next_frame->command_buffer->getHandle().as<VkCommandBuffer>();
-    transition_image(_cmd, _image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-    transition_image(_cmd, _depth_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    // Anything uploaded since the last frame lands before this frame's work
+    staging.record(*next_frame->command_buffer);
+    next_frame->transfer_ticket = device->getUploadEngine().acquire(*next_frame->command_buffer);
+
+    // Whatever was presented is gone, the first barrier on it only has to wait for the acquire,
+    // which the submit waits on at the color output stage
+    images[n_image]->getColorAttachments()[0].discard(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR);
 
     RenderFrame frame(n_image, images[n_image]);
     frame.frame_data = next_frame;
@@ -314,6 +417,8 @@ RenderFrame Window::startFrame() const
 
 void Window::endFrame(RenderFrame& rf) const
 {
+    MIDNIGHT_ASSERT(!rf.compute, "Async compute started but never ended");
+
     ImGui::Render();
 
     // Render the ImGui data onto the surface
@@ -324,90 +429,31 @@ void Window::endFrame(RenderFrame& rf) const
     rf.endRender();
     //rf.image_stack.pop();
     
-    auto _image = static_cast<VkImage>(images[rf.image_index]->getColorAttachments()[0].handle);
-    auto _cmd   = rf.frame_data->command_buffer->getHandle().as<VkCommandBuffer>();
-    transition_image(_cmd, _image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    // Presenting waits on the render finished semaphore, nothing after this in the frame uses it
+    Backend::BarrierBatch present;
+    present.use(images[rf.image_index]->getColorAttachments()[0], VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_2_NONE_KHR, 0);
+    present.record(*rf.frame_data->dispatch, *rf.frame_data->command_buffer);
 
     // Blit the imgui surface onto the main image
     // Blitting doesn't handle alpha, so here we'd actually want to draw a quad...
     // Currently don't have a nice way to do that
     //rf.blit(imgui_surface, images[rf.image_index]);
 
-    rf.frame_data->command_buffer->end();
+    auto& device = Backend::Instance::ref().getDevice();
+    const auto ticket = rf.frame_data->submit(true, render_sems[rf.image_index]->getHandle());
 
-    //SDL_UpdateWindowSurface(static_cast<SDL_Window*>(handle));
-    const auto semaphore_submit_info = [](VkPipelineStageFlags2 stageMask, VkSemaphore semaphore)
-    {
-        VkSemaphoreSubmitInfo submitInfo{};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
-        submitInfo.pNext = nullptr;
-        submitInfo.semaphore = semaphore;
-        submitInfo.stageMask = stageMask;
-        submitInfo.deviceIndex = 0;
-        submitInfo.value = 1;
-
-        return submitInfo;
-    };
-
-    const auto command_buffer_submit_info = [](VkCommandBuffer cmd)
-    {
-        VkCommandBufferSubmitInfo info{};
-        info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
-        info.pNext = nullptr;
-        info.commandBuffer = cmd;
-        info.deviceMask = 0;
+    images_in_flight[rf.image_index] = ticket;
+    device->getStagingRing().submit(ticket);
 
-        return info;
-    };
+    // Anything destroyed while recording this frame may have been used by it
+    device->getDeletionQueue().seal(ticket);
+    device->getReadbackQueue().seal(ticket);
 
-    const auto submit_info = [](VkCommandBufferSubmitInfo* cmd, VkSemaphoreSubmitInfo* signalSemaphoreInfo,
-        VkSemaphoreSubmitInfo* waitSemaphoreInfo)
-    {
-        VkSubmitInfo2 info = {};
-        info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
-        info.pNext = nullptr;
-
-        info.waitSemaphoreInfoCount = waitSemaphoreInfo == nullptr ? 0 : 1;
-        info.pWaitSemaphoreInfos = waitSemaphoreInfo;
-
-        info.signalSemaphoreInfoCount = signalSemaphoreInfo == nullptr ? 0 : 1;
-        info.pSignalSemaphoreInfos = signalSemaphoreInfo;
-
-        info.commandBufferInfoCount = 1;
-        info.pCommandBufferInfos = cmd;
-
-        return info;
-    };
-
-    auto cmd_info    = command_buffer_submit_info(rf.frame_data->command_buffer->getHandle().as<VkCommandBuffer>());
-    auto wait_info   = semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, rf.frame_data->swapchain_sem->getHandle().as<VkSemaphore>());
-	auto signal_info = semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, rf.frame_data->render_sem->getHandle().as<VkSemaphore>());	
-	
-	const auto submit = submit_info(&cmd_info, &signal_info, &wait_info);
-
-    auto& device = Backend::Instance::get()->getDevice();
-    
-	//submit command buffer to the queue and execute it.
-	// _renderFence will now block until the graphic commands finish execution
-    {
-        // Lock the crap up here
-        PFN_vkVoidFunction pvkQueueSubmit2KHR = vkGetDeviceProcAddr(device->getHandle().as<VkDevice>(), "vkQueueSubmit2KHR");
-        ((PFN_vkQueueSubmit2KHR)(pvkQueueSubmit2KHR))(static_cast<VkQueue>(device->getGraphicsQueue().handle), 1, &submit, rf.frame_data->render_fence->getHandle().as<VkFence>());
-    }
-    const auto _swapchain = static_cast<VkSwapchainKHR>(swapchain);
-    const auto _sema = static_cast<VkSemaphore>(rf.frame_data->render_sem->getHandle());
-    VkPresentInfoKHR presentInfo = {};
-	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	presentInfo.pNext = nullptr;
-	presentInfo.pSwapchains = &_swapchain;
-	presentInfo.swapchainCount = 1;
-
-	presentInfo.pWaitSemaphores = &_sema;
-	presentInfo.waitSemaphoreCount = 1;
-
-	presentInfo.pImageIndices = &rf.image_index;
-
-	const auto err = vkQueuePresentKHR(static_cast<VkQueue>(device->getGraphicsQueue().handle), &presentInfo);
+    const auto err = device->present(swapchain, rf.image_index, render_sems[rf.image_index]->getHandle(), ++present_id);
+    if (err == VK_ERROR_OUT_OF_DATE_KHR || err == VK_SUBOPTIMAL_KHR)
+        swapchain_dirty = true;
+    else
+        MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error presenting: " << err);
 }
 
 void Window::runFrame(const std::function<void(RenderFrame& rf)>& func) const
@@ -424,8 +470,8 @@ void Window::setTitle(const std::string& title) const
 
 void Window::finishWork() const
 {
-    auto instance = mn::Graphics::Backend::Instance::get();
-    const auto& device = instance->getDevice();
+    auto& instance = mn::Graphics::Backend::Instance::ref();
+    const auto& device = instance.getDevice();
     vkQueueWaitIdle(static_cast<VkQueue>(device->getGraphicsQueue().handle));
 }
 
@@ -448,20 +494,28 @@ Window::~Window()
     {
 	    finishWork();
         {
-            auto instance = mn::Graphics::Backend::Instance::get();
-            const auto& device = instance->getDevice();
-            finishWork();
+            auto& instance = mn::Graphics::Backend::Instance::ref();
+            const auto& device = instance.getDevice();
+
+            // finishWork only covers the graphics queue, uploads can still be running on the
+            // transfer queue, and the flush below frees whatever they use
+            device->waitForIdle();
 
             frame_data.clear();
+            images_in_flight.clear();
+            render_sems.clear();
             images.clear();
 
+            // Retired swapchains have to go before the surface does, the device is idle by now
+            device->getDeletionQueue().flush();
+
             ImGui_ImplVulkan_Shutdown();
             ImGui_ImplSDL3_Shutdown();
             ImPlot::DestroyContext();
             ImGui::DestroyContext();
 
             device->destroySwapchain(swapchain);
-            instance->destroySurface(surface);
+            instance.destroySurface(surface);
         }
         mn::Graphics::Backend::Instance::destroy();
         SDL_DestroyWindow(static_cast<SDL_Window*>(handle));
@@ -470,9 +524,9 @@ Window::~Window()
     }
 }
 
-uint32_t Window::next_image_index(std::shared_ptr<FrameData> fd) const
+std::optional<uint32_t> Window::next_image_index(std::shared_ptr<FrameData> fd) const
 {
-    auto& device = Backend::Instance::get()->getDevice();
+    auto& device = Backend::Instance::ref().getDevice();
 
     uint32_t index;
     const auto err = vkAcquireNextImageKHR(
@@ -482,15 +536,18 @@ uint32_t Window::next_image_index(std::shared_ptr<FrameData> fd) const
         fd->swapchain_sem->getHandle().as<VkSemaphore>(),
         VK_NULL_HANDLE,
         &index);
-    MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error getting next image: " << err);
+    // Out of date hasn't signaled the semaphore, so the frame can try again with it.
+    // Suboptimal has and still gives us an image, so this frame goes ahead as it is.
+    if (err == VK_ERROR_OUT_OF_DATE_KHR) return std::nullopt;
+    if (err == VK_SUBOPTIMAL_KHR) swapchain_dirty = true;
+    else MIDNIGHT_ASSERT(err == VK_SUCCESS, "Error getting next image: " << err);
 
     return index;
 }
 
 std::shared_ptr<FrameData> Window::get_next_frame() const
 {
-    static uint32_t FRAMES = 0;
-    return frame_data[FRAMES++ % frame_data.size()];
+    return frame_data[frame_count++ % frame_data.size()];
 }
 
 }